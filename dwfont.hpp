@@ -69,6 +69,12 @@ struct DWriteGlyphBitmap {
 };
 
 class DWriteGlyphRenderer {
+public:
+	// レンダリングパラメータ（ビルドキャッシュのキーにも使われるので変更時は注意）
+	static constexpr float Gamma             = 1.8f;
+	static constexpr float EnhancedContrast  = 0.5f;
+	static constexpr float GrayscaleContrast = 1.0f;
+	static constexpr float ClearTypeLevel    = 0.0f;
 protected:
 	DWriteUtil &Util;
 	IDWriteFont *Font;
@@ -112,7 +118,7 @@ public:
 				if (SUCCEEDED(fa->QueryInterface(__uuidof(IDWriteFactory3), (void**)&fa3))) {
 					IDWriteRenderingParams3 *params = nullptr;
 					if (SUCCEEDED(fa3->CreateCustomRenderingParams(
-						/*gamma*/1.8f, /*enhancedContrast*/0.5f, /*gsContrast*/1.0f, /*cleartype*/0.0f,
+						Gamma, EnhancedContrast, GrayscaleContrast, ClearTypeLevel,
 						DWRITE_PIXEL_GEOMETRY_FLAT,
 						//DWRITE_RENDERING_MODE1_NATURAL_SYMMETRIC_DOWNSAMPLED, //DWRITE_RENDERING_MODE1_NATURAL_SYMMETRIC,
 						//DWRITE_GRID_FIT_MODE_ENABLED,
@@ -132,7 +138,7 @@ public:
 				}
 				if (!Params) {
 					fa->CreateCustomRenderingParams(
-						/*gamma*/1.8f, /*enhancedContrast*/0.5f, /*cleartype*/0.0f,
+						Gamma, EnhancedContrast, ClearTypeLevel,
 						DWRITE_PIXEL_GEOMETRY_FLAT,
 						/// Specifies that the rendering mode is determined automatically based on the font and size.
 						//DWRITE_RENDERING_MODE_DEFAULT,
@@ -1,7 +1,19 @@
 #include <windows.h>
+#include <vector>
+#include <map>
+#include <cstdarg>
 #include "ncbind.hpp"
 
 #include "dwfont.hpp"
+#include "pfont.hpp"
+#include "pfontbuild.hpp"
+#include "pfontcache.hpp"
+#include "pfontdiff.hpp"
+#include "pfonteffect.hpp"
+#include "pfontresample.hpp"
+#include "pfontlayout.hpp"
+#include "pfontstack.hpp"
+#include "pfontspan.hpp"
 
 static DWriteUtil *DirectWriteUtil = NULL;
 static DWriteUtil& LoadDirectWrite() {
@@ -23,17 +35,17 @@ NCB_PRE_UNREGIST_CALLBACK(UnloadDirectWrite);
 
 
 //--------------------------------------------------------------
-// ファイル操作クラス(共通)
+// ファイル操作クラス（吉里吉里ストレージ）
 
-struct PFontFile
+struct PFontStream
 {
-	PFontFile(tjs_char const *storage, tjs_uint32 flags) : stream(0), storage(storage), commit(false)
+	PFontStream(tjs_char const *storage, tjs_uint32 flags) : stream(0), storage(storage), commit(false)
 	{
 		stream = TVPCreateIStream(storage, flags);
 		if (!stream) error(TJS_W("can't open storage"));
 	}
 
-	virtual ~PFontFile() {
+	virtual ~PFontStream() {
 		if (stream) {
 			if (commit) stream->Commit(STGC_DEFAULT);
 			stream->Release();
@@ -47,12 +59,15 @@ struct PFontFile
 		mes += storage;
 		TVPThrowExceptionMessage(mes.c_str());
 	}
+	void error(char const *message) const {
+		error(ttstr(message).c_str());
+	}
 
-	typedef ULONG SizeType;
+	typedef PFontUInt32 SizeType;
 
 	void write(void const *buf, SizeType length) {
 		if (!stream) return;
-		SizeType written = 0;
+		ULONG written = 0;
 		if (stream->Write(buf, length, &written) != S_OK || written != length)
 			error(TJS_W("can't write storage"));
 		commit = true;
@@ -60,7 +75,7 @@ struct PFontFile
 
 	void read(void *buf, SizeType length) {
 		if (!stream) return;
-		SizeType readed = 0;
+		ULONG readed = 0;
 		if (stream->Read(buf, length, &readed) != S_OK || readed != length)
 			error(TJS_W("can't read storage"));
 	}
@@ -84,119 +99,28 @@ struct PFontFile
 		return (SizeType)curpos.QuadPart;
 	}
 
-	template <typename T>
-	SizeType align(T t) {
+	SizeType getSize() const {
+		if (!stream) return 0;
 		SizeType pos = getPos();
-		write(&t, sizeof(T) - (pos % sizeof(T)));
-		return getPos();
+		LARGE_INTEGER lpos;
+		ULARGE_INTEGER endpos;
+		lpos.QuadPart  = 0;
+		endpos.QuadPart = 0;
+		stream->Seek(lpos, STREAM_SEEK_END, &endpos);
+		const_cast<PFontStream*>(this)->seek(pos);
+		return (SizeType)endpos.QuadPart;
 	}
 
 protected:
 	IStream *stream;
 	ttstr storage;
 	bool commit;
-
-	static const char*    headerText;
-	static const SizeType headerLength;
-};
-const char*               PFontFile::headerText   = "TVP pre-rendered font\x1a\x01\x02";
-const PFontFile::SizeType PFontFile::headerLength = 24;
-
-//--------------------------------------------------------------
-// ファイル操作クラス(書き込み)
-
-struct PFontSaver : public PFontFile
-{
-	PFontSaver(tjs_char const *storage) : PFontFile(storage, TJS_BS_WRITE)
-	{
-		write(headerText, headerLength);
-		write("            ", 12); // dummy index
-	}
-	virtual ~PFontSaver() {}
-
-	void writeHeader(tjs_uint32 count, SizeType chindexpos, SizeType indexpos) {
-		seek(headerLength);
-		write(&count,      4);
-		write(&chindexpos, 4);
-		write(&indexpos,   4);
-	}
-
-	// フォントイメージ（65段階）のランレングス圧縮保存
-	void writeCompress65(const unsigned char *buf, int size) {
-		if (!size) return;
-
-		unsigned char *newbuf = new unsigned char [size];
-		int newsize = 0;
-		int count = 0;
-		unsigned char last = 0xff;
-
-		int i;
-		for (i = 0; i < size; i++) {
-			if (last == buf[i]) count++;
-			else {
-				newsize = _writeRunLength65(last, newbuf, newsize, count);
-				newbuf[newsize++] = buf[i];
-				count = 0;
-			}
-			last = buf[i];
-		}
-		newsize = _writeRunLength65(last, newbuf, newsize, count);
-		try {
-			write(newbuf, (SizeType)newsize);
-		} catch(...) {
-			delete [] newbuf;
-			throw;
-		}
-		delete [] newbuf;
-	}
-private:
-	inline int _writeRunLength65(unsigned char last, unsigned char *newbuf, int newsize, int count) {
-		if(count >= 2) {
-			while (count) {
-				int len = count > 190 ? 190 : count;
-				newbuf[newsize++] = 0x40 + len; // running
-				count -= len;
-			}
-		} else {
-			while(count--) newbuf[newsize++] = last;
-		}
-		return newsize;
-	}
 };
 
-
-//--------------------------------------------------------------
-// ファイル操作クラス(読み取り)
-
-struct PFontLoader : public PFontFile
-{
-	PFontLoader(tjs_char const *storage, tjs_uint32 flags = TJS_BS_READ) : PFontFile(storage, flags)
-	{
-		if (stream && !check(headerText, headerLength))
-			error(TJS_W("invalid tft header"));
-	}
-	virtual ~PFontLoader() {}
-
-	void readHeader(tjs_uint32 &count, SizeType &chindexpos, SizeType &indexpos) {
-		seek(headerLength);
-		read(&count,      4);
-		read(&chindexpos, 4);
-		read(&indexpos,   4);
-	}
-
-	bool check(void const *buf, SizeType length) {
-		char * checkbuf = new char[length];
-		try {
-			read(checkbuf, length);
-		} catch (...) {
-			delete [] checkbuf;
-			throw;
-		}
-		bool r = !memcmp(checkbuf, buf, length);
-		delete [] checkbuf;
-		return r;
-	}
-};
+// フォーマット処理は pfont.hpp を参照
+typedef PFontFileT  <PFontStream> PFontFile;
+typedef PFontSaverT <PFontStream> PFontSaver;
+typedef PFontLoaderT<PFontStream> PFontLoader;
 
 //--------------------------------------------------------------
 // グリフ情報保持＆イメージ変換クラス
@@ -207,6 +131,7 @@ class PFontImage
 	tjs_char   code;
 	tjs_uint16 width, height;
 	tjs_int16  origin_x, origin_y, inc_x, inc_y, inc;
+	tjs_uint16 reserved; // 下位ビットは格納形式（PFontImageMode）
 
 	void setInfo(ncbPropAccessor &info) {
 		info.SetValue(TJS_W("blackbox_x"), (tTVInteger)width);
@@ -222,7 +147,8 @@ public:
 		:   offset(0),
 			code(0),
 			width(0), height(0),
-			origin_x(0), origin_y(0), inc_x(0), inc_y(0), inc(0)
+			origin_x(0), origin_y(0), inc_x(0), inc_y(0), inc(0),
+			reserved(0)
 		{}
 
 	struct GetInfoWork {
@@ -282,6 +208,7 @@ public:
 		height   = (tjs_uint16) h;
 
 		offset   = saver.getPos();
+		reserved = 0;
 
 		if (width > 0 && height > 0) {
 			if (useraw) {
@@ -290,13 +217,14 @@ public:
 				if (!oct || oct->GetLength() != w*h) {
 					saver.error(TJS_W("octet size mismatched"));
 				} else {
-					saver.writeCompress65(oct->GetData(), oct->GetLength());
+					saver.writeImage(oct->GetData(), oct->GetLength(), reserved);
 				}
 			} else {
 				unsigned char *buf = new unsigned char[w * h];
 				try {
-					copyAlphaImage65(info, buf, w, h);
-					saver.writeCompress65(buf, w * h);
+					if (info.HasValue(TJS_W("supersample"))) copyAlphaImageSS(info, buf, w, h);
+					else                                     copyAlphaImage65(info, buf, w, h);
+					saver.writeImage(buf, w * h, reserved);
 				} catch (...) {
 					delete [] buf;
 					throw;
@@ -324,6 +252,18 @@ public:
 		}
 	}
 
+	// supersample 倍で描画されたレイヤを縮小して取り込む
+	void copyAlphaImageSS(ncbPropAccessor &lay, unsigned char *buf, int w, int h) {
+		int  factor = (int) lay.getIntValue(TJS_W("supersample"));
+		int  sw     = (int) lay.getIntValue(TJS_W("imageWidth"));
+		int  sh     = (int) lay.getIntValue(TJS_W("imageHeight"));
+		long pitch  = (long)lay.getIntValue(TJS_W("mainImageBufferPitch"));
+		unsigned char *img = (unsigned char*)lay.getIntPtrValue(TJS_W("mainImageBuffer"));
+		double gamma = lay.HasValue(TJS_W("gamma"))  ? lay.getRealValue(TJS_W("gamma")) : 1.0;
+		bool  dither = lay.HasValue(TJS_W("dither")) ? !!lay.getIntValue(TJS_W("dither")) : false;
+		PFontDownsampleAlpha(img, pitch, sw, sh, w, h, factor, gamma, dither, buf);
+	}
+
 	void saveCode(PFontSaver &saver) {
 		saver.write(&code, sizeof(code));
 	}
@@ -336,8 +276,6 @@ public:
 		saver.write(&inc_x,    2);
 		saver.write(&inc_y,    2);
 		saver.write(&inc,      2);
-
-		tjs_int16 reserved = 0;
 		saver.write(&reserved, 2);
 	}
 
@@ -355,35 +293,18 @@ public:
 		loader.read(&inc_x,    2);
 		loader.read(&inc_y,    2);
 		loader.read(&inc,      2);
-
-		tjs_int16 reserved = 0;
 		loader.read(&reserved, 2);
 	}
-	void loadImage(PFontLoader &loader, tTJSVariantClosure *closure) {
-		loader.seek(offset);
-
+	void loadImage(PFontLoader &loader, tTJSVariantClosure *closure, PFontFile::SizeType chindexpos) {
 		tjs_uint size = width * height;
-		tjs_uint8 *buf = new tjs_uint8[size];
-		try {
-			tjs_uint8 *p = buf;
-			tjs_uint8 *end = p + size;
-			while (p < end) {
-				tjs_uint8 v;
-				loader.read(&v, 1);
-				if (v <= 0x40) *p++ = v;
-				else {
-					tjs_int len = (v - 0x40);
-					tjs_uint8 last = p > buf ? p[-1] : 0; // バッファアンダーフロー対策
-					if (p + len > end) len = (tjs_int)(end - p); // バッファオーバーラン対策
-					while(len--) *p++ = last;
-				}
-			}
-		} catch (...) {
-			delete [] buf;
-			throw;
+		std::vector<PFontUInt8> src, buf(size ? size : 1);
+		if (size > 0) {
+			PFontFile::SizeType srclen = loader.readImage(src, offset, size, chindexpos);
+			int mode = loader.packed ? reserved : PFontMode65;
+			if (!PFontDecodeGlyph<PFontConv64>(mode, &src.front(), srclen, width, height, &buf.front(), width))
+				loader.error(TJS_W("can't read storage"));
 		}
-		tTJSVariant image(buf, size);
-		delete [] buf;
+		tTJSVariant image(&buf.front(), size);
 
 		ncbDictionaryAccessor info;
 		setInfo(info);
@@ -449,13 +370,302 @@ public:
 	}
 };
 
+//--------------------------------------------------------------
+// ビルドキャッシュ（pfontcache.hpp を参照）
+
+static ttstr fromUTF8(const std::string &str)
+{
+	int len = ::MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, NULL, 0);
+	std::vector<wchar_t> buf(len > 0 ? len : 1, 0);
+	if (len > 0) ::MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, &buf.front(), len);
+	return ttstr((tjs_char const*)&buf.front());
+}
+static std::string toUTF8(const ttstr &str)
+{
+	int len = ::WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)str.c_str(), -1, NULL, 0, NULL, NULL);
+	std::vector<char> buf(len > 0 ? len : 1, 0);
+	if (len > 0) ::WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)str.c_str(), -1, &buf.front(), len, NULL, NULL);
+	return std::string(&buf.front());
+}
+static std::string formatString(const char *fmt, ...)
+{
+	char buf[1024];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	return buf;
+}
+
+static void setupLogFont(LOGFONT &lf, const wchar_t *face, int height, bool bold, bool italic)
+{
+	ZeroMemory(&lf, sizeof(lf));
+	lf.lfHeight         =  height < 0 ? height : -height;
+	lf.lfItalic         =  italic ? TRUE:FALSE;
+	lf.lfWeight         =  bold   ?  700:  400;
+	lf.lfCharSet        = DEFAULT_CHARSET;
+	lf.lfOutPrecision   = OUT_DEFAULT_PRECIS;
+	lf.lfQuality        = DEFAULT_QUALITY;
+	lf.lfPitchAndFamily = DEFAULT_PITCH | FF_DONTCARE;
+	wcsncpy_s(lf.lfFaceName, LF_FACESIZE, face, _TRUNCATE);
+}
+
+// 選択中のフォントのファイル内容（TrueTypeコレクションはファイル全体）
+// face を指定するとコレクション内の面番号も返す（テーブルディレクトリの一致で探す）
+static bool getFontFileData(HDC dc, std::vector<PFontUInt8> &data, int *face = 0)
+{
+	DWORD table = 0x66637474; // 'ttcf'
+	DWORD size = ::GetFontData(dc, table, 0, NULL, 0);
+	if (size == GDI_ERROR) size = ::GetFontData(dc, table = 0, 0, NULL, 0);
+	if (size == GDI_ERROR || !size) return false;
+	data.resize(size);
+	if (::GetFontData(dc, table, 0, &data.front(), size) != size) return false;
+	if (face) {
+		*face = 0;
+		if (table) {
+			BYTE head[12];
+			if (::GetFontData(dc, 0, 0, head, sizeof(head)) != sizeof(head)) return false;
+			DWORD dirsize = 12 + 16 * ((head[4] << 8) | head[5]);
+			std::vector<PFontUInt8> dir(dirsize);
+			if (::GetFontData(dc, 0, 0, &dir.front(), dirsize) != dirsize) return false;
+			*face = PFontOutlineFont::findFace(data, &dir.front(), dirsize);
+			if (*face < 0) return false;
+		}
+	}
+	return true;
+}
+static bool getFontFileData(const LOGFONT &lf, std::vector<PFontUInt8> &data, int *face = 0)
+{
+	HDC dc = ::CreateCompatibleDC(NULL);
+	HFONT font = ::CreateFontIndirect(&lf);
+	HGDIOBJ old = ::SelectObject(dc, font);
+	bool done = getFontFileData(dc, data, face);
+	::SelectObject(dc, old);
+	::DeleteObject(font);
+	::DeleteDC(dc);
+	return done;
+}
+
+// フォントファイル内容のハッシュ（TrueTypeコレクションはファイル全体）
+static bool getFontFileHash(const LOGFONT &lf, PFontUInt64 &hash)
+{
+	std::vector<PFontUInt8> data;
+	if (!getFontFileData(lf, data)) return false;
+	PFontHash64 h;
+	h.add(&data.front(), data.size());
+	hash = h.value;
+	return true;
+}
+
+// キャッシュディレクトリ（ローカルのフォルダのみ）
+class PFontCacheStorage
+{
+public:
+	PFontCacheStorage(const ttstr &dir, bool link) : link(link), hits(0), misses(0) {
+		if (dir.IsEmpty()) return;
+		local = TVPGetLocallyAccessibleName(TVPNormalizeStorageName(dir));
+		if (local.IsEmpty()) {
+			ttstr mes(TJS_W("cache directory must be local:"));
+			mes += dir;
+			TVPThrowExceptionMessage(mes.c_str());
+		}
+		tjs_char last = local.c_str()[local.length() - 1];
+		if (last != TJS_W('\\') && last != TJS_W('/')) local += TJS_W("\\");
+		::CreateDirectoryW((LPCWSTR)local.c_str(), NULL);
+	}
+
+	bool enabled() const { return !local.IsEmpty(); }
+
+	// キャッシュから出力ファイルを作成する（glyphs に文字数）
+	bool fetch(const std::string &key, tjs_char const *output, tjs_uint32 &glyphs) {
+		ttstr src = path(key), dst = getLocalName(output);
+		bool done = false;
+		if (!dst.IsEmpty() && ::GetFileAttributesW((LPCWSTR)src.c_str()) != INVALID_FILE_ATTRIBUTES) {
+			::DeleteFileW((LPCWSTR)dst.c_str());
+			done = (link && ::CreateHardLinkW((LPCWSTR)dst.c_str(), (LPCWSTR)src.c_str(), NULL)) ||
+				::CopyFileW((LPCWSTR)src.c_str(), (LPCWSTR)dst.c_str(), FALSE);
+		}
+		if (done) {
+			PFontLoader loader(output);
+			PFontFile::SizeType chindexpos, indexpos;
+			loader.readHeader(glyphs, chindexpos, indexpos);
+			hits++;
+		} else misses++;
+		return done;
+	}
+
+	// 出力前に既存のファイルを消す（ハードリンク先のキャッシュを書き換えないように）
+	void unlink(tjs_char const *output) {
+		ttstr dst = getLocalName(output);
+		if (!dst.IsEmpty()) ::DeleteFileW((LPCWSTR)dst.c_str());
+	}
+
+	// 作成したファイルを登録する（一時ファイルにコピーしてから置き換える）
+	void store(const std::string &key, tjs_char const *output) {
+		ttstr src = getLocalName(output), dst = path(key);
+		if (src.IsEmpty()) return;
+		ttstr tmp = dst + ttstr(formatString(".%u.tmp", (unsigned)::GetCurrentProcessId()).c_str());
+		if (!::CopyFileW((LPCWSTR)src.c_str(), (LPCWSTR)tmp.c_str(), FALSE) ||
+			!::MoveFileExW((LPCWSTR)tmp.c_str(), (LPCWSTR)dst.c_str(), MOVEFILE_REPLACE_EXISTING))
+			::DeleteFileW((LPCWSTR)tmp.c_str());
+	}
+
+	tjs_uint32 getHits()   const { return hits; }
+	tjs_uint32 getMisses() const { return misses; }
+
+private:
+	ttstr local;
+	bool link;
+	tjs_uint32 hits, misses;
+
+	ttstr path(const std::string &key) const { return local + ttstr(PFontCacheFileName(key).c_str()); }
+	static ttstr getLocalName(tjs_char const *storage) {
+		return TVPGetLocallyAccessibleName(TVPNormalizeStorageName(storage));
+	}
+};
+
+// ローカルファイルの情報を取得する（ファイルが無ければ false）
+static bool getLocalFileInfo(const ttstr &local, BY_HANDLE_FILE_INFORMATION &info)
+{
+	HANDLE file = ::CreateFileW((LPCWSTR)local.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	bool done = !!::GetFileInformationByHandle(file, &info);
+	::CloseHandle(file);
+	return done;
+}
+
+// 出力先が入力と同じファイルならエラーにする
+// 正規化した名前を大文字小文字を区別せずに比較し，ローカルファイルはハードリンクも含めてファイル識別子で比較する
+static void checkOverwrite(const ttstr &storage, const ttstr &output)
+{
+	ttstr src = TVPNormalizeStorageName(storage), dst = TVPNormalizeStorageName(output);
+	bool same = ::lstrcmpiW((LPCWSTR)src.c_str(), (LPCWSTR)dst.c_str()) == 0;
+	if (!same) {
+		ttstr lsrc = TVPGetLocallyAccessibleName(src), ldst = TVPGetLocallyAccessibleName(dst);
+		BY_HANDLE_FILE_INFORMATION isrc, idst;
+		if (!lsrc.IsEmpty() && !ldst.IsEmpty())
+			same = ::lstrcmpiW((LPCWSTR)lsrc.c_str(), (LPCWSTR)ldst.c_str()) == 0 ||
+				(getLocalFileInfo(lsrc, isrc) && getLocalFileInfo(ldst, idst) &&
+				 isrc.dwVolumeSerialNumber == idst.dwVolumeSerialNumber &&
+				 isrc.nFileIndexHigh == idst.nFileIndexHigh && isrc.nFileIndexLow == idst.nFileIndexLow);
+	}
+	if (same) {
+		ttstr mes(TJS_W("output overwrites input:"));
+		mes += output;
+		TVPThrowExceptionMessage(mes.c_str());
+	}
+}
+
+// ハードリンクされたファイルを独立したファイルにする
+// （link 指定でキャッシュから作成したファイルをその場で書き換えると，キャッシュのファイルも書き換わるため）
+static void separateHardLink(tjs_char const *storage)
+{
+	ttstr local = TVPGetLocallyAccessibleName(TVPNormalizeStorageName(storage));
+	if (local.IsEmpty()) return;
+	BY_HANDLE_FILE_INFORMATION info;
+	if (!getLocalFileInfo(local, info) || info.nNumberOfLinks <= 1) return;
+
+	// コピーしてから置き換える（リンク先は元の内容のまま残る）
+	ttstr tmp = local + ttstr(formatString(".%u.tmp", (unsigned)::GetCurrentProcessId()).c_str());
+	if (!::CopyFileW((LPCWSTR)local.c_str(), (LPCWSTR)tmp.c_str(), FALSE) ||
+		!::MoveFileExW((LPCWSTR)tmp.c_str(), (LPCWSTR)local.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+		::DeleteFileW((LPCWSTR)tmp.c_str());
+		ttstr mes(TJS_W("can't separate hard link:"));
+		mes += storage;
+		TVPThrowExceptionMessage(mes.c_str());
+	}
+}
+
+// savePreRenderedFont のキャッシュキー
+// cache.font の内容・レンダラの設定・cache.params・出力順と格納形式の指定・文字セットから計算する
+static std::string getSaveCacheKey(ncbPropAccessor &cacheopt, ncbPropAccessor &charray, tjs_uint32 count,
+								   const std::vector<tjs_uint32> &order, tjs_uint32 hotcount, bool hotprefix, bool packed, int levels)
+{
+	tTJSVariant fontobj;
+	if (cacheopt.HasValue(TJS_W("font"))) fontobj = cacheopt.GetValue(TJS_W("font"), ncbTypedefs::Tag<tTJSVariant>());
+	if (fontobj.Type() != tvtObject) TVPThrowExceptionMessage(TJS_W("cache.font is required"));
+	ncbPropAccessor font(fontobj);
+	ttstr face = font.getStrValue(TJS_W("face"));
+	int height = (int)font.getIntValue(TJS_W("height"));
+	bool bold   = !!font.getIntValue(TJS_W("bold"));
+	bool italic = !!font.getIntValue(TJS_W("italic"));
+	int angle  = (int)font.getIntValue(TJS_W("angle"));
+
+	LOGFONT lf;
+	setupLogFont(lf, (const wchar_t*)face.c_str(), height, bold, italic);
+	PFontUInt64 fonthash = 0;
+	if (!getFontFileHash(lf, fonthash)) {
+		ttstr mes(TJS_W("can't read font data:"));
+		mes += face;
+		TVPThrowExceptionMessage(mes.c_str());
+	}
+
+	ttstr renderer = cacheopt.HasValue(TJS_W("renderer")) ? cacheopt.getStrValue(TJS_W("renderer")) : ttstr(TJS_W("gdi"));
+	std::string params = formatString("save face=%s height=%d bold=%d italic=%d angle=%d ",
+									  toUTF8(face).c_str(), height, bold, italic, angle);
+	if (renderer == TJS_W("dwrite")) {
+		params += formatString("dwrite gamma=%g contrast=%g gscontrast=%g cleartype=%g",
+							   DWriteGlyphRenderer::Gamma, DWriteGlyphRenderer::EnhancedContrast,
+							   DWriteGlyphRenderer::GrayscaleContrast, DWriteGlyphRenderer::ClearTypeLevel);
+	} else if (renderer == TJS_W("outline")) {
+		params += "outline"; // 描画結果はフォントファイルのみで決まる（変更時は PFontCacheVersion を上げる）
+	} else {
+		params += formatString("gdi format=%d", (int)GGO_GRAY8_BITMAP);
+	}
+	if (cacheopt.HasValue(TJS_W("params"))) params += " params=" + toUTF8(cacheopt.getStrValue(TJS_W("params")));
+
+	PFontHash64 layout;
+	if (!order.empty()) layout.add(&order.front(), order.size() * sizeof(tjs_uint32));
+	params += formatString(" order=%s hot=%u prefix=%d packed=%d levels=%d", layout.hex().c_str(), hotcount, hotprefix, packed, levels);
+
+	PFontCharSet chars;
+	for (tjs_uint32 i = 0; i < count; i++) chars.add((PFontUInt16)charray.getIntValue((tjs_int32)i));
+	return PFontCacheKey(fonthash, params, chars);
+}
+
 //--------------------------------------------------------------
 // 保存処理
 
-static void savePreRenderedFont(tjs_char const *storage, tTJSVariant characters, tTJSVariant callback)
+// イメージの出力順を頻度の高い順にする
+// frequency : 辞書（文字 => 出現回数）または配列（先頭ほど頻度が高い文字またはキャラクタコード）
+// @return 頻度が指定された（0より大きい）文字数
+static tjs_uint32 getFrequencyOrder(ncbPropAccessor &charray, tjs_uint32 count, tTJSVariant frequency, std::vector<tjs_uint32> &order)
 {
-	PFontSaver saver(storage);
+	order.resize(count);
+	for (tjs_uint32 i = 0; i < count; i++) order[i] = i;
+	if (frequency.Type() != tvtObject) return 0;
+
+	std::vector<tTVInteger> weight(count, 0);
+	iTJSDispatch2 *obj = frequency.AsObjectNoAddRef();
+	ncbPropAccessor table(frequency);
+	if (obj && obj->IsInstanceOf(0, NULL, NULL, TJS_W("Array"), obj) == TJS_S_TRUE) {
+		std::map<tjs_char, tTVInteger> rank;
+		tjs_int n = table.GetArrayCount();
+		for (tjs_int j = 0; j < n; j++) {
+			tTJSVariant v = table.GetValue(j, ncbTypedefs::Tag<tTJSVariant>());
+			tjs_char ch = (v.Type() == tvtString) ? ttstr(v).c_str()[0] : (tjs_char)(tjs_int)v;
+			if (!rank.count(ch)) rank[ch] = n - j;
+		}
+		for (tjs_uint32 i = 0; i < count; i++) {
+			std::map<tjs_char, tTVInteger>::const_iterator it = rank.find((tjs_char)charray.getIntValue((tjs_int32)i));
+			if (it != rank.end()) weight[i] = it->second;
+		}
+	} else {
+		for (tjs_uint32 i = 0; i < count; i++) {
+			tjs_char key[2] = { (tjs_char)charray.getIntValue((tjs_int32)i), 0 };
+			if (table.HasValue(key)) weight[i] = table.GetValue(key, ncbTypedefs::Tag<tTVInteger>());
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [&](tjs_uint32 a, tjs_uint32 b) { return weight[a] > weight[b]; });
 
+	tjs_uint32 hot = 0;
+	for (tjs_uint32 i = 0; i < count; i++) if (weight[i] > 0) hot++;
+	return hot;
+}
+
+// @return キャッシュから作成した場合は true
+static bool savePreRenderedFont(tjs_char const *storage, tTJSVariant characters, tTJSVariant callback, tTJSVariant options)
+{
 	ncbPropAccessor charray(characters);
 	tTJSVariantClosure closure = callback.AsObjectClosureNoAddRef();
 
@@ -464,35 +674,94 @@ static void savePreRenderedFont(tjs_char const *storage, tTJSVariant characters,
 
 	// キャラ個数
 	tjs_uint32 count = charray.GetArrayCount();
-	if (!count) saver.error(TJS_W("empty characters"));
 
-	// 文字情報をキャラ個数分用意
-	PFontImage *images = new PFontImage[count];
+	// イメージの出力順（コード表・インデックスは常にコード順）
+	std::vector<tjs_uint32> order;
+	tjs_uint32 hotcount = 0;
+	bool hotprefix = false;
+	bool packed = false;
+	int  levels = 0;
+	tTJSVariant cacheopt;
+	if (options.Type() == tvtObject) {
+		ncbPropAccessor opt(options);
+		if (opt.HasValue(TJS_W("frequency")))
+			hotcount = getFrequencyOrder(charray, count, opt.GetValue(TJS_W("frequency"), ncbTypedefs::Tag<tTJSVariant>()), order);
+		hotprefix = opt.HasValue(TJS_W("hotPrefix")) && !!opt.getIntValue(TJS_W("hotPrefix"));
+		packed    = opt.HasValue(TJS_W("packed"))    && !!opt.getIntValue(TJS_W("packed"));
+		if (opt.HasValue(TJS_W("levels"))) levels = (int)opt.getIntValue(TJS_W("levels"));
+		if (opt.HasValue(TJS_W("cache"))) cacheopt = opt.GetValue(TJS_W("cache"), ncbTypedefs::Tag<tTJSVariant>());
+	}
+	if (order.empty()) getFrequencyOrder(charray, count, tTJSVariant(), order);
+
+	// ビルドキャッシュ
+	std::string key;
+	ttstr cachedir;
+	bool cachelink = false;
+	if (cacheopt.Type() == tvtObject) {
+		ncbPropAccessor copt(cacheopt);
+		cachedir  = copt.getStrValue(TJS_W("directory"));
+		cachelink = copt.HasValue(TJS_W("link")) && !!copt.getIntValue(TJS_W("link"));
+	}
+	PFontCacheStorage cache(cachedir, cachelink);
+	if (cache.enabled() && count) {
+		ncbPropAccessor copt(cacheopt);
+		key = getSaveCacheKey(copt, charray, count, order, hotcount, hotprefix, packed, levels);
+		tjs_uint32 glyphs = 0;
+		if (cache.fetch(key, storage, glyphs)) return true;
+		cache.unlink(storage);
+	}
 
-	typedef PFontFile::SizeType SizeType;
-	SizeType chindexpos = 0;
-	SizeType indexpos   = 0;
-	SizeType padding    = 0;
-	try {
-		tjs_uint32 i;
-		for (i = 0; i < count; i++) images[i].saveImage(saver, charray.getIntValue((tjs_int32)i), &closure);
+	{
+		PFontSaver saver(storage);
+		if (!count) saver.error(TJS_W("empty characters"));
+		saver.packed = packed;
+		saver.levels = levels;
+
+		// 文字情報をキャラ個数分用意
+		PFontImage *images = new PFontImage[count];
+
+		typedef PFontFile::SizeType SizeType;
+		SizeType chindexpos = 0;
+		SizeType indexpos   = 0;
+		SizeType padding    = 0;
+		SizeType extpos     = 0;
+		PFontUInt32 hotpos  = 0;
+		try {
+			tjs_uint32 i;
+			if (hotprefix) hotpos = extpos = saver.writeExtension();
+			for (i = 0; i < count; i++) {
+				tjs_uint32 n = order[i];
+				images[n].saveImage(saver, charray.getIntValue((tjs_int32)n), &closure);
+				if (i < hotcount) hotpos = saver.getPos();
+			}
 
-		chindexpos = saver.align(padding);
-		for (i = 0; i < count; i++) images[i].saveCode(saver);
+			chindexpos = saver.align(padding);
+			for (i = 0; i < count; i++) images[i].saveCode(saver);
 
-		indexpos = saver.align(padding);
-		for (i = 0; i < count; i++) images[i].saveInfo(saver);
+			indexpos = saver.align(padding);
+			for (i = 0; i < count; i++) images[i].saveInfo(saver);
 
-		saver.writeHeader(count, chindexpos, indexpos);
+			if (hotprefix) saver.writeHotPos(extpos, hotcount ? hotpos : (PFontUInt32)(extpos + 4));
+			saver.writeHeader(count, chindexpos, indexpos);
 
-	} catch (...) {
+		} catch (...) {
+			delete [] images;
+			throw;
+		}
 		delete [] images;
-		throw;
 	}
-	delete [] images;
+	if (!key.empty()) cache.store(key, storage);
+	return false;
 }
 
-NCB_ATTACH_FUNCTION(savePreRenderedFont, System, savePreRenderedFont);
+static tjs_error TJS_INTF_METHOD savePreRenderedFontCallback(tTJSVariant *result, tjs_int numparams, tTJSVariant **param, iTJSDispatch2 *objthis)
+{
+	if (numparams < 3) return TJS_E_BADPARAMCOUNT;
+	ttstr storage(*param[0]);
+	bool cached = savePreRenderedFont(storage.c_str(), *param[1], *param[2], numparams >= 4 ? *param[3] : tTJSVariant());
+	if (result) *result = cached;
+	return TJS_S_OK;
+}
 
 //--------------------------------------------------------------
 // 読み込み処理
@@ -533,7 +802,7 @@ static void loadPreRenderedFont(tjs_char const *storage, tTJSVariant characters,
 
 			loader.seek(imagepos);
 			for (i = 0; i < count; i++) {
-				images[i].loadImage(loader, &closure);
+				images[i].loadImage(loader, &closure, chindexpos);
 			}
 		}
 	} catch (...) {
@@ -549,9 +818,9 @@ NCB_ATTACH_FUNCTION(loadPreRenderedFont, System, loadPreRenderedFont);
 //--------------------------------------------------------------
 // infoのみ書き換え処理
 
-#include <vector>
 static void modifyPreRenderedFont(tjs_char const *storage, tTJSVariant callback)
 {
+	separateHardLink(storage);
 	PFontLoader loader(storage, TJS_BS_UPDATE);
 
 	tTJSVariantClosure closure = callback.AsObjectClosureNoAddRef();
@@ -584,6 +853,915 @@ static void modifyPreRenderedFont(tjs_char const *storage, tTJSVariant callback)
 
 NCB_ATTACH_FUNCTION(modifyPreRenderedFont, System, modifyPreRenderedFont);
 
+
+//--------------------------------------------------------------
+// メトリクスのみ読み込み処理
+
+template <typename T>
+static void setOctetValue(ncbPropAccessor &dict, tjs_char const *name, const std::vector<T> &v)
+{
+	tTJSVariant oct(v.empty() ? (const tjs_uint8*)"" : (const tjs_uint8*)&v.front(), (tjs_uint)(v.size() * sizeof(T)));
+	dict.SetValue(name, oct);
+}
+
+static tTJSVariant loadPreRenderedFontMetrics(tjs_char const *storage)
+{
+	PFontLoader loader(storage);
+	PFontData data;
+	loader.readTables(data);
+
+	PFontMetrics metrics;
+	metrics.assign(data);
+
+	ncbDictionaryAccessor dict;
+	dict.SetValue(TJS_W("count"), (tjs_int)data.count);
+	setOctetValue(dict, TJS_W("codes"),      metrics.codes);
+	setOctetValue(dict, TJS_W("blackbox_x"), metrics.width);
+	setOctetValue(dict, TJS_W("blackbox_y"), metrics.height);
+	setOctetValue(dict, TJS_W("origin_x"),   metrics.origin_x);
+	setOctetValue(dict, TJS_W("origin_y"),   metrics.origin_y);
+	setOctetValue(dict, TJS_W("inc_x"),      metrics.inc_x);
+	setOctetValue(dict, TJS_W("inc_y"),      metrics.inc_y);
+	setOctetValue(dict, TJS_W("inc"),        metrics.inc);
+	return tTJSVariant(dict, dict);
+}
+
+NCB_ATTACH_FUNCTION(loadPreRenderedFontMetrics, System, loadPreRenderedFontMetrics);
+
+
+//--------------------------------------------------------------
+// 全グリフ並列展開処理
+
+static tjs_error TJS_INTF_METHOD decodePreRenderedFontCallback(tTJSVariant *result, tjs_int numparams, tTJSVariant **param, iTJSDispatch2 *objthis)
+{
+	if (numparams < 1) return TJS_E_BADPARAMCOUNT;
+	ttstr storage(*param[0]);
+	int threads = (numparams >= 2 && param[1]->Type() != tvtVoid) ? (int)(tjs_int)*param[1] : 0;
+
+	PFontData data;
+	{
+		PFontLoader loader(storage.c_str());
+		loader.readData(data);
+	}
+	std::vector<PFontUInt8>  arena;
+	std::vector<PFontUInt32> offsets;
+	if (PFontDecodeAll(data, arena, offsets, threads) > 0) {
+		ttstr mes(TJS_W("invalid glyph image:"));
+		mes += storage;
+		TVPThrowExceptionMessage(mes.c_str());
+	}
+
+	if (result) {
+		data.codes.resize(data.count);
+		ncbDictionaryAccessor dict;
+		dict.SetValue(TJS_W("count"), (tjs_int)data.count);
+		setOctetValue(dict, TJS_W("codes"),   data.codes);
+		setOctetValue(dict, TJS_W("offsets"), offsets);
+		setOctetValue(dict, TJS_W("image"),   arena);
+		*result = tTJSVariant(dict, dict);
+	}
+	return TJS_S_OK;
+}
+
+
+//--------------------------------------------------------------
+// 2つのファイルの比較処理（pfontdiff.hpp を参照）
+
+static tjs_error TJS_INTF_METHOD comparePreRenderedFontCallback(tTJSVariant *result, tjs_int numparams, tTJSVariant **param, iTJSDispatch2 *objthis)
+{
+	if (numparams < 2) return TJS_E_BADPARAMCOUNT;
+	ttstr storage1(*param[0]), storage2(*param[1]);
+	int threads = 0;
+	bool images = false;
+	if (numparams >= 3 && param[2]->Type() == tvtObject) {
+		ncbPropAccessor opt(*param[2]);
+		if (opt.HasValue(TJS_W("threads"))) threads = (int)opt.getIntValue(TJS_W("threads"));
+		images = opt.HasValue(TJS_W("images")) && !!opt.getIntValue(TJS_W("images"));
+	}
+
+	PFontData a, b;
+	{
+		PFontLoader loader(storage1.c_str());
+		loader.readData(a);
+	}
+	{
+		PFontLoader loader(storage2.c_str());
+		loader.readData(b);
+	}
+	std::vector<PFontGlyphDiff> diffs;
+	const PFontUInt32 same = PFontDiffData(a, b, diffs, images, threads);
+
+	if (result) {
+		tjs_int added = 0, removed = 0, changed = 0;
+		ncbArrayAccessor glyphs;
+		for (size_t i = 0; i < diffs.size(); i++) {
+			const PFontGlyphDiff &d = diffs[i];
+			if      (d.status & PFontDiffAdded)   added++;
+			else if (d.status & PFontDiffRemoved) removed++;
+			else changed++;
+			ncbDictionaryAccessor g;
+			g.SetValue(TJS_W("code"),   (tjs_int)d.code);
+			g.SetValue(TJS_W("status"), (tjs_int)d.status);
+			g.SetValue(TJS_W("max"),    (tjs_int)d.maxError);
+			g.SetValue(TJS_W("mean"),   (tTVReal)d.meanError);
+			g.SetValue(TJS_W("pixels"), (tjs_int)d.pixels);
+			if (!d.image.empty()) {
+				g.SetValue(TJS_W("left"),   (tjs_int)d.left);
+				g.SetValue(TJS_W("top"),    (tjs_int)d.top);
+				g.SetValue(TJS_W("width"),  (tjs_int)d.width);
+				g.SetValue(TJS_W("height"), (tjs_int)d.height);
+				setOctetValue(g, TJS_W("image"), d.image);
+			}
+			glyphs.SetValue((tjs_int)i, tTJSVariant(g, g));
+		}
+		ncbDictionaryAccessor dict;
+		dict.SetValue(TJS_W("same"),    (tjs_int)same);
+		dict.SetValue(TJS_W("changed"), changed);
+		dict.SetValue(TJS_W("added"),   added);
+		dict.SetValue(TJS_W("removed"), removed);
+		dict.SetValue(TJS_W("glyphs"),  tTJSVariant(glyphs, glyphs));
+		*result = tTJSVariant(dict, dict);
+	}
+	return TJS_S_OK;
+}
+
+
+//--------------------------------------------------------------
+// 縁取り・影用の派生フォントの作成（pfonteffect.hpp を参照）
+
+static tjs_error TJS_INTF_METHOD transformPreRenderedFontCallback(tTJSVariant *result, tjs_int numparams, tTJSVariant **param, iTJSDispatch2 *objthis)
+{
+	if (numparams < 3) return TJS_E_BADPARAMCOUNT;
+	ttstr storage(*param[0]), output(*param[1]);
+	if (param[2]->Type() != tvtObject) return TJS_E_INVALIDPARAM;
+
+	PFontEffect effect;
+	int  threads = 0, levels = 0;
+	bool packed = false, dedup = false;
+	{
+		ncbPropAccessor opt(*param[2]);
+		if (opt.HasValue(TJS_W("outline"))) effect.outline = (int)opt.getIntValue(TJS_W("outline"));
+		if (opt.HasValue(TJS_W("blur")))    effect.blur    = (int)opt.getIntValue(TJS_W("blur"));
+		if (opt.HasValue(TJS_W("offsetX"))) effect.offsetX = (int)opt.getIntValue(TJS_W("offsetX"));
+		if (opt.HasValue(TJS_W("offsetY"))) effect.offsetY = (int)opt.getIntValue(TJS_W("offsetY"));
+		if (opt.HasValue(TJS_W("threads"))) threads = (int)opt.getIntValue(TJS_W("threads"));
+		if (opt.HasValue(TJS_W("levels")))  levels  = (int)opt.getIntValue(TJS_W("levels"));
+		packed = opt.HasValue(TJS_W("packed")) && !!opt.getIntValue(TJS_W("packed"));
+		dedup  = opt.HasValue(TJS_W("dedup"))  && !!opt.getIntValue(TJS_W("dedup"));
+	}
+	if (effect.outline < 0 || effect.blur < 0 || effect.outline > 64 || effect.blur > 64) return TJS_E_INVALIDPARAM;
+	checkOverwrite(storage, output);
+
+	std::vector<PFontGlyph> glyphs;
+	{
+		PFontData data;
+		PFontLoader loader(storage.c_str());
+		loader.readData(data);
+		if (PFontDecodeGlyphs(data, glyphs, threads) > 0) loader.error(TJS_W("invalid glyph image"));
+	}
+	PFontApplyEffects(glyphs, effect, threads);
+	{
+		PFontSaver saver(output.c_str());
+		saver.packed = packed || levels;
+		saver.levels = levels;
+		PFontSaveGlyphs(saver, glyphs, dedup, threads);
+	}
+	if (result) *result = (tjs_int)glyphs.size();
+	return TJS_S_OK;
+}
+
+
+//--------------------------------------------------------------
+// 大きいサイズのフォントからの縮小（pfontresample.hpp を参照）
+
+static tjs_error TJS_INTF_METHOD resamplePreRenderedFontCallback(tTJSVariant *result, tjs_int numparams, tTJSVariant **param, iTJSDispatch2 *objthis)
+{
+	if (numparams < 3) return TJS_E_BADPARAMCOUNT;
+	ttstr storage(*param[0]), output(*param[1]);
+	if (param[2]->Type() != tvtObject) return TJS_E_INVALIDPARAM;
+
+	double scale = 0;
+	int  filter = PFontResampleArea, threads = 0, levels = 0;
+	bool packed = false, dedup = false;
+	{
+		ncbPropAccessor opt(*param[2]);
+		if (opt.HasValue(TJS_W("scale"))) scale = (double)opt.GetValue(TJS_W("scale"), ncbTypedefs::Tag<tTVReal>());
+		else if (opt.HasValue(TJS_W("size")) && opt.HasValue(TJS_W("masterSize")))
+			scale = (double)opt.getIntValue(TJS_W("size")) / (double)opt.getIntValue(TJS_W("masterSize"));
+		if (opt.HasValue(TJS_W("filter"))) {
+			ttstr name = opt.getStrValue(TJS_W("filter"));
+			if      (name == TJS_W("lanczos")) filter = PFontResampleLanczos;
+			else if (name != TJS_W("area")) TVPThrowExceptionMessage(TJS_W("unknown filter"));
+		}
+		if (opt.HasValue(TJS_W("threads"))) threads = (int)opt.getIntValue(TJS_W("threads"));
+		if (opt.HasValue(TJS_W("levels")))  levels  = (int)opt.getIntValue(TJS_W("levels"));
+		packed = opt.HasValue(TJS_W("packed")) && !!opt.getIntValue(TJS_W("packed"));
+		dedup  = opt.HasValue(TJS_W("dedup"))  && !!opt.getIntValue(TJS_W("dedup"));
+	}
+	if (!(scale > 0.0 && scale <= 1.0)) return TJS_E_INVALIDPARAM;
+	checkOverwrite(storage, output);
+
+	std::vector<PFontGlyph> glyphs;
+	{
+		PFontData data;
+		PFontLoader loader(storage.c_str());
+		loader.readData(data);
+		if (PFontDecodeGlyphs(data, glyphs, threads) > 0) loader.error(TJS_W("invalid glyph image"));
+	}
+	PFontResampleGlyphs(glyphs, scale, filter, threads);
+	{
+		PFontSaver saver(output.c_str());
+		saver.packed = packed || levels;
+		saver.levels = levels;
+		PFontSaveGlyphs(saver, glyphs, dedup, threads);
+	}
+	if (result) *result = (tjs_int)glyphs.size();
+	return TJS_S_OK;
+}
+
+
+//--------------------------------------------------------------
+// 重ね合わせるファイルの一覧（文字列または配列：配列は優先順でパッチ → ベース）
+
+static void getStorageList(const tTJSVariant &storage, std::vector<ttstr> &list)
+{
+	list.clear();
+	iTJSDispatch2 *obj = (storage.Type() == tvtObject) ? storage.AsObjectNoAddRef() : 0;
+	if (obj && obj->IsInstanceOf(0, NULL, NULL, TJS_W("Array"), obj) == TJS_S_TRUE) {
+		ncbPropAccessor arr(storage);
+		const tjs_int n = arr.GetArrayCount();
+		for (tjs_int i = 0; i < n; i++) list.push_back(arr.getStrValue(i));
+	} else {
+		list.push_back(ttstr(storage));
+	}
+	if (list.empty() || list.size() > 0xFFFF) TVPThrowExceptionMessage(TJS_W("invalid storage list"));
+}
+
+//--------------------------------------------------------------
+// 重ねたファイルの平坦化（pfontstack.hpp を参照）
+
+static tjs_int flattenPreRenderedFont(tTJSVariant storages, tjs_char const *output)
+{
+	std::vector<ttstr> list;
+	getStorageList(storages, list);
+	for (size_t i = 0; i < list.size(); i++) checkOverwrite(list[i], output);
+
+	std::vector<PFontData> datas(list.size());
+	std::vector<const PFontData*> layers;
+	for (size_t i = 0; i < list.size(); i++) {
+		PFontLoader loader(list[i].c_str());
+		loader.readData(datas[i]);
+		layers.push_back(&datas[i]);
+	}
+	PFontStack stack;
+	stack.assign(layers);
+	PFontSaver saver(output);
+	PFontFlattenStack(saver, stack);
+	return (tjs_int)stack.count;
+}
+
+NCB_ATTACH_FUNCTION(flattenPreRenderedFont, System, flattenPreRenderedFont);
+
+
+//--------------------------------------------------------------
+// 使用文字キャッシュの保存/読み込み処理
+//
+// header(16byte) + entries(4)
+// entry: path, size(8), mtime(8), mode, ranges
+//        文字列は 文字数(4)+UTF-16，ranges は 要素数(4)+(先頭,個数-1)の16bit配列
+
+static const char                charCacheHeader[]     = "TFT char cache\x1a\x01";
+static const PFontFile::SizeType charCacheHeaderLength = 16;
+
+static void writeCacheString(PFontFile &file, const ttstr &str)
+{
+	tjs_uint32 len = (tjs_uint32)str.length();
+	file.write(&len, 4);
+	if (len) file.write(str.c_str(), (PFontFile::SizeType)(len * sizeof(tjs_char)));
+}
+static ttstr readCacheString(PFontFile &file)
+{
+	tjs_uint32 len = 0;
+	file.read(&len, 4);
+	if (len > 0x10000) file.error(TJS_W("invalid char cache"));
+	std::vector<tjs_char> buf(len + 1, 0);
+	if (len) file.read(&buf.front(), (PFontFile::SizeType)(len * sizeof(tjs_char)));
+	return ttstr(&buf.front());
+}
+
+static tTJSVariant loadPreRenderedCharCache(tjs_char const *storage)
+{
+	ncbArrayAccessor entries;
+	if (!TVPIsExistentStorage(storage)) return tTJSVariant(entries, entries);
+
+	PFontFile file(storage, TJS_BS_READ);
+	char header[charCacheHeaderLength];
+	file.read(header, charCacheHeaderLength);
+	if (memcmp(header, charCacheHeader, charCacheHeaderLength)) file.error(TJS_W("invalid char cache"));
+
+	tjs_uint32 count = 0;
+	file.read(&count, 4);
+	for (tjs_uint32 i = 0; i < count; i++) {
+		ttstr path = readCacheString(file);
+		tTVInteger size = 0, mtime = 0;
+		file.read(&size,  8);
+		file.read(&mtime, 8);
+		ttstr mode = readCacheString(file);
+
+		tjs_uint32 nranges = 0;
+		file.read(&nranges, 4);
+		if (nranges > 0x20000) file.error(TJS_W("invalid char cache"));
+		std::vector<PFontUInt16> ranges(nranges ? nranges : 1);
+		if (nranges) file.read(&ranges.front(), (PFontFile::SizeType)(nranges * sizeof(PFontUInt16)));
+
+		PFontCharSet chset;
+		chset.addRanges(&ranges.front(), nranges);
+		std::vector<PFontUInt16> codes;
+		chset.getCodes(codes);
+		std::vector<tjs_char> chars;
+		for (size_t n = 0; n < codes.size(); n++) if (codes[n]) chars.push_back((tjs_char)codes[n]);
+		chars.push_back(0);
+
+		ncbDictionaryAccessor ent;
+		ent.SetValue(TJS_W("path"),  path);
+		ent.SetValue(TJS_W("size"),  size);
+		ent.SetValue(TJS_W("mtime"), mtime);
+		ent.SetValue(TJS_W("mode"),  mode);
+		ent.SetValue(TJS_W("chars"), ttstr(&chars.front()));
+		entries.SetValue((tjs_int)i, tTJSVariant(ent, ent));
+	}
+	return tTJSVariant(entries, entries);
+}
+
+static void savePreRenderedCharCache(tjs_char const *storage, tTJSVariant list)
+{
+	ncbPropAccessor entries(list);
+	tjs_uint32 count = (tjs_uint32)entries.GetArrayCount();
+
+	PFontFile file(storage, TJS_BS_WRITE);
+	file.write(charCacheHeader, charCacheHeaderLength);
+	file.write(&count, 4);
+	for (tjs_uint32 i = 0; i < count; i++) {
+		ncbPropAccessor ent(entries.GetValue((tjs_int)i, ncbTypedefs::Tag<tTJSVariant>()));
+		tTVInteger size  = ent.GetValue(TJS_W("size"),  ncbTypedefs::Tag<tTVInteger>());
+		tTVInteger mtime = ent.GetValue(TJS_W("mtime"), ncbTypedefs::Tag<tTVInteger>());
+		ttstr chars = ent.getStrValue(TJS_W("chars"));
+
+		PFontCharSet chset;
+		chset.addString(chars.c_str());
+		std::vector<PFontUInt16> ranges;
+		chset.getRanges(ranges);
+		tjs_uint32 nranges = (tjs_uint32)ranges.size();
+
+		writeCacheString(file, ent.getStrValue(TJS_W("path")));
+		file.write(&size,  8);
+		file.write(&mtime, 8);
+		writeCacheString(file, ent.getStrValue(TJS_W("mode")));
+		file.write(&nranges, 4);
+		if (nranges) file.write(&ranges.front(), (PFontFile::SizeType)(nranges * sizeof(PFontUInt16)));
+	}
+}
+
+NCB_ATTACH_FUNCTION(loadPreRenderedCharCache, System, loadPreRenderedCharCache);
+NCB_ATTACH_FUNCTION(savePreRenderedCharCache, System, savePreRenderedCharCache);
+
+
+//--------------------------------------------------------------
+// マニフェストによる一括作成（pfontbuild.hpp を参照）
+
+// テキストストレージを読み込む（文字コードは吉里吉里の判定に従う）
+static ttstr loadStorageText(const ttstr &storage)
+{
+	ttstr text, part;
+	iTJSTextReadStream *stream = TVPCreateTextStreamForRead(storage, TJS_W(""));
+	try {
+		while (stream->Read(part, 0x10000) > 0) text += part;
+	} catch (...) {
+		stream->Destruct();
+		throw;
+	}
+	stream->Destruct();
+	return text;
+}
+
+// ストレージの内容をすべて読み込む
+static void loadStorageData(const ttstr &storage, std::vector<PFontUInt8> &data)
+{
+	PFontFile file(storage.c_str(), TJS_BS_READ);
+	data.resize(file.getSize());
+	if (!data.empty()) file.read(&data.front(), (PFontFile::SizeType)data.size());
+}
+
+static void getTargetLogFont(const PFontBuildTarget &target, LOGFONT &lf)
+{
+	std::vector<wchar_t> face(target.face.size() + 1, 0);
+	::MultiByteToWideChar(CP_UTF8, 0, target.face.c_str(), -1, &face.front(), (int)face.size());
+	setupLogFont(lf, &face.front(), target.size, !!(target.flags & PFontBold), !!(target.flags & PFontItalic));
+}
+
+// GDI によるグリフ供給元（作業スレッドごとに DC とフォントを持つ）
+class PFontGdiSource : public PFontGlyphSource
+{
+public:
+	PFontGdiSource(const PFontBuildTarget &target) : hdc(0), hfont(0) {
+		LOGFONT lf;
+		getTargetLogFont(target, lf);
+		hdc   = ::CreateCompatibleDC(NULL);
+		hfont = ::CreateFontIndirect(&lf);
+		::SelectObject(hdc, hfont);
+	}
+	~PFontGdiSource() {
+		if (hfont) ::DeleteObject(hfont);
+		if (hdc) ::DeleteDC(hdc);
+	}
+
+	bool render(PFontUInt16 ch, PFontGlyph &glyph) {
+		static const MAT2 mat = { {0,1}, {0,0}, {0,0}, {0,1} };
+		GLYPHMETRICS gm;
+		ZeroMemory(&gm, sizeof(gm));
+		SIZE incsz = { 0, 0 };
+		WCHAR code = (WCHAR)ch;
+		DWORD size = ::GetGlyphOutlineW(hdc, ch, GGO_GRAY8_BITMAP, &gm, 0, NULL, &mat);
+		if (size == GDI_ERROR) size = 0;
+		::GetTextExtentPoint32W(hdc, &code, 1, &incsz);
+
+		const int w = size ? gm.gmBlackBoxX : 0;
+		const int h = size ? gm.gmBlackBoxY : 0;
+		PFontIndex &info = glyph.info;
+		info.width    = (PFontUInt16)w;
+		info.height   = (PFontUInt16)h;
+		info.origin_x = (PFontInt16)gm.gmptGlyphOrigin.x;
+		info.origin_y = (PFontInt16)gm.gmptGlyphOrigin.y;
+		info.inc_x    = (PFontInt16)gm.gmCellIncX;
+		info.inc_y    = (PFontInt16)gm.gmCellIncY;
+		info.inc      = (PFontInt16)incsz.cx;
+		glyph.image.clear();
+		if (w > 0 && h > 0) {
+			std::vector<BYTE> buf(size);
+			::GetGlyphOutlineW(hdc, ch, GGO_GRAY8_BITMAP, &gm, size, &buf.front(), &mat);
+			const int pitch = (size / h) & ~0x03L;
+			glyph.image.resize((size_t)w * h);
+			for (int y = 0; y < h; y++) memcpy(&glyph.image[(size_t)y * w], &buf[(size_t)y * pitch], w);
+		}
+		return true;
+	}
+
+private:
+	HDC hdc;
+	HFONT hfont;
+};
+
+// プラットフォーム非依存の描画を使うターゲットのフォントの識別名（使わないなら空）
+// フォントファイルの指定か outline フラグ付きのフォント名（太字／斜体で別のファイルが選ばれる）
+static std::string getOutlineFontKey(const PFontBuildTarget &target)
+{
+	std::string path;
+	int face;
+	if (PFontParseFontFile(target.face, path, face)) return target.face;
+	if (target.flags & PFontOutline) return formatString("%s/%u", target.face.c_str(), target.flags & (PFontBold | PFontItalic));
+	return std::string();
+}
+
+// マニフェストのフォントを一括作成する
+// options.threads  : 作成スレッド数（省略時はCPU数）
+// options.progress : 進捗コールバック function(index, output, done, total, error)
+//                    error は完了時のみ文字列（成功なら空文字），それ以外は void
+// options.cache    : ビルドキャッシュのディレクトリ（ローカルのみ）
+// options.link     : キャッシュからハードリンクで作成する
+// @return ターゲットごとの結果 %[ output, glyphs, error, cached ] の配列
+static tTJSVariant buildPreRenderedFonts(tjs_char const *manifest, tTJSVariant options)
+{
+	int threads = 0;
+	tTJSVariant progress;
+	ttstr cachedir;
+	bool cachelink = false;
+	if (options.Type() == tvtObject) {
+		ncbPropAccessor opt(options);
+		if (opt.HasValue(TJS_W("threads")))  threads  = (int)opt.getIntValue(TJS_W("threads"));
+		if (opt.HasValue(TJS_W("progress"))) progress = opt.GetValue(TJS_W("progress"), ncbTypedefs::Tag<tTJSVariant>());
+		if (opt.HasValue(TJS_W("cache")))    cachedir = opt.getStrValue(TJS_W("cache"));
+		cachelink = opt.HasValue(TJS_W("link")) && !!opt.getIntValue(TJS_W("link"));
+	}
+	PFontCacheStorage cache(cachedir, cachelink);
+
+	PFontManifest list;
+	std::string error;
+	if (!list.parse(toUTF8(loadStorageText(manifest)), error) ||
+		!list.resolve([](const std::string &name, PFontCharSet &chars) {
+			ttstr storage = fromUTF8(name);
+			if (!TVPIsExistentStorage(storage)) return false;
+			chars.addString(loadStorageText(storage).c_str());
+			return true;
+		}, error)) {
+		ttstr mes = fromUTF8(error);
+		mes += TJS_W(":");
+		mes += manifest;
+		TVPThrowExceptionMessage(mes.c_str());
+	}
+
+	std::vector<PFontBuildTarget> &targets = list.targets;
+
+	// プラットフォーム非依存の描画に使うフォントを読み込む（ターゲット間で共有する）
+	typedef std::map<std::string, std::shared_ptr<const PFontOutlineFont> > OutlineMap;
+	OutlineMap outlines;
+	std::map<std::string, PFontUInt64> outlineHashes;
+	for (size_t i = 0; i < targets.size(); i++) {
+		const PFontBuildTarget &t = targets[i];
+		const std::string key = getOutlineFontKey(t);
+		if (key.empty() || outlines.count(key)) continue;
+		std::vector<PFontUInt8> data;
+		std::string path, error;
+		int face = 0;
+		try {
+			if (PFontParseFontFile(t.face, path, face)) loadStorageData(fromUTF8(path), data);
+			else {
+				LOGFONT lf;
+				getTargetLogFont(t, lf);
+				if (!getFontFileData(lf, data, &face)) data.clear();
+			}
+		} catch (eTJSError &) {
+			data.clear();
+		}
+		std::shared_ptr<PFontOutlineFont> font;
+		if (!data.empty()) {
+			PFontHash64 h;
+			h.add(&data.front(), data.size());
+			h.add((PFontUInt32)face);
+			outlineHashes[key] = h.value;
+			font.reset(new PFontOutlineFont());
+			if (!font->load(data, face, error)) font.reset();
+		}
+		outlines[key] = font; // 読めなければ空（ターゲットはエラーになる）
+	}
+
+	if (cache.enabled()) {
+		std::map<std::string, PFontUInt64> fonts; // 同じフォントファイルは1回だけ読む
+		for (size_t i = 0; i < targets.size(); i++) {
+			PFontBuildTarget &t = targets[i];
+			const std::string outline = getOutlineFontKey(t);
+			if (!outline.empty()) {
+				if (!outlines[outline]) continue;
+				t.key = PFontCacheKey(outlineHashes[outline], formatString("outline size=%d flags=%u", t.size, t.flags), *t.chars);
+			} else {
+				LOGFONT lf;
+				getTargetLogFont(t, lf);
+				std::string fontkey = formatString("%s/%u", t.face.c_str(), t.flags & (PFontBold | PFontItalic));
+				std::map<std::string, PFontUInt64>::iterator it = fonts.find(fontkey);
+				if (it == fonts.end()) {
+					PFontUInt64 hash = 0;
+					if (!getFontFileHash(lf, hash)) continue;
+					it = fonts.insert(std::make_pair(fontkey, hash)).first;
+				}
+				t.key = PFontCacheKey(it->second, formatString("gdi format=%d size=%d flags=%u", (int)GGO_GRAY8_BITMAP, t.size, t.flags), *t.chars);
+			}
+			try {
+				t.cached = cache.fetch(t.key, fromUTF8(t.output).c_str(), t.glyphs);
+			} catch (eTJSError &) {
+				t.cached = false;
+			}
+		}
+	}
+
+	PFontBuilder builder(targets, [&outlines](const PFontBuildTarget &target) -> PFontGlyphSource* {
+		const std::string key = getOutlineFontKey(target);
+		if (key.empty()) return new PFontGdiSource(target);
+		OutlineMap::const_iterator it = outlines.find(key);
+		return (it != outlines.end() && it->second) ? new PFontOutlineSource(it->second, target.size, target.flags) : 0;
+	}, threads);
+	builder.start();
+
+	// 進捗の通知とファイルの書き出しはこのスレッドで行う
+	PFontBuildEvent ev;
+	while (builder.wait(ev)) {
+		PFontBuildTarget &t = targets[ev.target];
+		ttstr output = fromUTF8(t.output);
+		if (ev.finished && !t.cached && t.error.empty()) {
+			try {
+				if (!t.key.empty()) cache.unlink(output.c_str());
+				{
+					PFontFile file(output.c_str(), TJS_BS_WRITE);
+					file.write(&t.file.front(), (PFontFile::SizeType)t.file.size());
+				}
+				if (!t.key.empty()) cache.store(t.key, output.c_str());
+			} catch (eTJSError &e) {
+				t.error = toUTF8(e.GetMessage());
+			}
+			std::vector<PFontUInt8>().swap(t.file);
+		}
+		if (progress.Type() == tvtObject) {
+			tTJSVariant err;
+			if (ev.finished) err = fromUTF8(t.error);
+			tTJSVariant args[] = { (tjs_int)ev.target, output, (tjs_int)ev.done, (tjs_int)ev.total, err };
+			tTJSVariant *argp[] = { args, args+1, args+2, args+3, args+4 };
+			progress.AsObjectClosureNoAddRef().FuncCall(0, NULL, NULL, NULL, 5, argp, NULL);
+		}
+	}
+
+	ncbArrayAccessor results;
+	for (size_t i = 0; i < targets.size(); i++) {
+		ncbDictionaryAccessor r;
+		r.SetValue(TJS_W("output"), fromUTF8(targets[i].output));
+		r.SetValue(TJS_W("glyphs"), (tjs_int)targets[i].glyphs);
+		r.SetValue(TJS_W("error"),  fromUTF8(targets[i].error));
+		r.SetValue(TJS_W("cached"), targets[i].cached);
+		results.SetValue((tjs_int)i, tTJSVariant(r, r));
+	}
+	if (cache.enabled())
+		TVPAddLog(ttstr(formatString("buildPreRenderedFonts: cache %u hits, %u misses", cache.getHits(), cache.getMisses()).c_str()));
+	return tTJSVariant(results, results);
+}
+
+static tjs_error TJS_INTF_METHOD buildPreRenderedFontsCallback(tTJSVariant *result, tjs_int numparams, tTJSVariant **param, iTJSDispatch2 *objthis)
+{
+	if (numparams < 1) return TJS_E_BADPARAMCOUNT;
+	ttstr manifest(*param[0]);
+	tTJSVariant r = buildPreRenderedFonts(manifest.c_str(), numparams >= 2 ? *param[1] : tTJSVariant());
+	if (result) *result = r;
+	return TJS_S_OK;
+}
+
+
+//--------------------------------------------------------------
+// 省略可能な引数を持つ関数の登録
+
+struct PreRenderedFontSystem {};
+NCB_ATTACH_CLASS(PreRenderedFontSystem, System)
+{
+	RawCallback(TJS_W("savePreRenderedFont"),   &savePreRenderedFontCallback,   TJS_STATICMEMBER);
+	RawCallback(TJS_W("decodePreRenderedFont"), &decodePreRenderedFontCallback, TJS_STATICMEMBER);
+	RawCallback(TJS_W("buildPreRenderedFonts"), &buildPreRenderedFontsCallback, TJS_STATICMEMBER);
+	RawCallback(TJS_W("comparePreRenderedFont"), &comparePreRenderedFontCallback, TJS_STATICMEMBER);
+	RawCallback(TJS_W("transformPreRenderedFont"), &transformPreRenderedFontCallback, TJS_STATICMEMBER);
+	RawCallback(TJS_W("resamplePreRenderedFont"),  &resamplePreRenderedFontCallback,  TJS_STATICMEMBER);
+}
+
+//--------------------------------------------------------------
+// 描画用の読み込み済みフォント（パッチファイルを重ねることもできる：pfontstack.hpp を参照）
+
+class PreRenderedFontReader
+{
+	// 頻出グリフ領域がある場合は先にその部分だけ読み込み，それ以外のグリフが必要になったら残りを読む
+	struct Layer {
+		PFontData data;
+		PFontLoader *loader;
+		std::vector<PFontUInt32> sizes;
+		Layer() : loader(0) {}
+		~Layer() { if (loader) delete loader; }
+	};
+	std::vector<Layer*> layers;
+	PFontStack stack;
+	int ascent, descent;
+	bool spans; // グリフをスパンに変換して保持する（pfontspan.hpp を参照）
+	std::vector<std::vector<PFontUInt8> > glyphs; // 展開済みイメージのキャッシュ
+	std::vector<PFontSpanList> spanlists;         // スパンのキャッシュ（spans 指定時）
+	std::vector<bool> decoded;
+
+	void load(const std::vector<ttstr> &list) {
+		std::vector<const PFontData*> datas;
+		for (size_t i = 0; i < list.size(); i++) {
+			Layer *layer = new Layer();
+			layers.push_back(layer);
+			PFontLoader *ld = new PFontLoader(list[i].c_str());
+			try {
+				ld->readTables(layer->data);
+				if (!ld->readImageSection(layer->data, true)) {
+					layer->data.getImageSizes(layer->sizes);
+					layer->loader = ld;
+					ld = 0;
+				}
+			} catch (...) {
+				delete ld;
+				throw;
+			}
+			delete ld;
+			datas.push_back(&layer->data);
+		}
+		stack.assign(datas);
+		stack.getExtent(ascent, descent);
+		glyphs.resize(stack.count);
+		decoded.resize(stack.count);
+	}
+	// n 番目のグリフのファイルを取得（頻出グリフ領域の外ならイメージの残りを読み込む）
+	const PFontData& getData(PFontUInt32 n) {
+		Layer &layer = *layers[stack.layer[n]];
+		const PFontUInt32 g = stack.glyph[n];
+		if (layer.loader && layer.sizes[g] && layer.data.index[g].offset + layer.sizes[g] > layer.data.hotpos) {
+			layer.loader->readImageRest(layer.data);
+			delete layer.loader;
+			layer.loader = 0;
+		}
+		return layer.data;
+	}
+	void clear() {
+		for (size_t i = 0; i < layers.size(); i++) delete layers[i];
+		layers.clear();
+	}
+public:
+	PreRenderedFontReader(const tTJSVariant &storage) : ascent(0), descent(0), spans(false) {
+		std::vector<ttstr> list;
+		getStorageList(storage, list);
+		try {
+			load(list);
+		} catch (...) {
+			clear();
+			throw;
+		}
+	}
+	~PreRenderedFontReader() {
+		clear();
+	}
+
+	long find(PFontUInt16 ch) const { return stack.find(ch); }
+	const PFontIndex& getIndex(PFontUInt32 n) const { return stack.getIndex(n); }
+
+	// 展開済みイメージを取得（不正なデータは空イメージ扱い）
+	const PFontUInt8* getGlyph(PFontUInt32 n) {
+		if (!decoded[n]) {
+			if (!getData(n).decode(stack.glyph[n], glyphs[n])) glyphs[n].clear();
+			decoded[n] = true;
+		}
+		return glyphs[n].empty() ? 0 : &glyphs[n].front();
+	}
+	// スパンを取得（不正なデータは空扱い）
+	const PFontSpanList& getGlyphSpans(PFontUInt32 n) {
+		if (!decoded[n]) {
+			if (!PFontDecodeSpans(getData(n), stack.glyph[n], spanlists[n])) spanlists[n].clear();
+			decoded[n] = true;
+		}
+		return spanlists[n];
+	}
+
+	// n 番目のグリフを 32bit ARGB の出力先に描画する（引数は PFontBlitImage と同じ）
+	bool draw(PFontUInt32 n, PFontUInt32 *dst, long pitch, int w, int h, int x, int y, PFontUInt32 color, int *rect) {
+		if (spans) return PFontBlitSpans(dst, pitch, w, h, x, y, getGlyphSpans(n), color, rect);
+		const PFontIndex &idx = getIndex(n);
+		return PFontBlitImage(dst, pitch, w, h, x, y, getGlyph(n), idx.width, idx.height, color, rect);
+	}
+
+	int  getCount()   const { return (int)stack.count; }
+	int  getLayers()  const { return (int)layers.size(); }
+	int  getAscent()  const { return ascent; }
+	int  getDescent() const { return descent; }
+	bool hasGlyph(tjs_int ch) const { return stack.find((PFontUInt16)ch) >= 0; }
+
+	// 保持形式の切り替え（変換済みのグリフは破棄する）
+	bool getSpans() const { return spans; }
+	void setSpans(bool v) {
+		if (spans == v) return;
+		spans = v;
+		std::vector<std::vector<PFontUInt8> >().swap(glyphs);
+		std::vector<PFontSpanList>().swap(spanlists);
+		if (spans) spanlists.resize(stack.count);
+		else       glyphs.resize(stack.count);
+		decoded.assign(stack.count, false);
+	}
+};
+
+NCB_REGISTER_CLASS(PreRenderedFontReader)
+{
+	Constructor<tTJSVariant>(0);
+	Method(TJS_W("hasGlyph"), &Class::hasGlyph);
+	Property(TJS_W("count"),   &Class::getCount,   (int)0);
+	Property(TJS_W("layers"),  &Class::getLayers,  (int)0);
+	Property(TJS_W("ascent"),  &Class::getAscent,  (int)0);
+	Property(TJS_W("descent"), &Class::getDescent, (int)0);
+	Property(TJS_W("spans"),   &Class::getSpans,   &Class::setSpans);
+}
+
+//--------------------------------------------------------------
+// 文字列の計測と行分割（pfontlayout.hpp を参照）
+//
+// コード表とインデックスのみ読み込み，送り幅は drawPreRenderedText と同じ inc を使う
+// 文字列の代わりに配列を渡すと複数の文字列をまとめて処理する
+
+class PreRenderedFontLayout
+{
+	PFontLayout layout;
+
+	static bool isArray(const tTJSVariant &v) {
+		iTJSDispatch2 *obj = (v.Type() == tvtObject) ? v.AsObjectNoAddRef() : 0;
+		return obj && obj->IsInstanceOf(0, NULL, NULL, TJS_W("Array"), obj) == TJS_S_TRUE;
+	}
+	static void getText(const tTJSVariant &v, std::vector<PFontUInt16> &text) {
+		ttstr str(v);
+		const tjs_char *s = str.c_str();
+		const tjs_int len = str.length();
+		text.resize(len);
+		for (tjs_int i = 0; i < len; i++) text[i] = (PFontUInt16)s[i];
+	}
+	static bool getHanging(tjs_int numparams, tTJSVariant **param, tjs_int n) {
+		return numparams > n && param[n]->Type() != tvtVoid && param[n]->operator bool();
+	}
+
+	tTJSVariant breakText(const tTJSVariant &v, int width, bool hanging) const {
+		std::vector<PFontUInt16> text;
+		getText(v, text);
+		std::vector<PFontLine> lines;
+		layout.breakLines(text.empty() ? 0 : &text.front(), text.size(), width, hanging, &lines);
+		ttstr str(v);
+		ncbArrayAccessor arr;
+		for (size_t i = 0; i < lines.size(); i++) {
+			std::vector<tjs_char> buf(str.c_str() + lines[i].start, str.c_str() + lines[i].start + lines[i].length);
+			buf.push_back(0);
+			arr.SetValue((tjs_int)i, ttstr(&buf.front()));
+		}
+		return tTJSVariant(arr, arr);
+	}
+public:
+	PreRenderedFontLayout(const tTJSVariant &storage) {
+		std::vector<ttstr> list;
+		getStorageList(storage, list);
+		std::vector<PFontData> datas(list.size());
+		std::vector<const PFontData*> layers;
+		for (size_t i = 0; i < list.size(); i++) {
+			PFontLoader loader(list[i].c_str());
+			loader.readTables(datas[i]);
+			layers.push_back(&datas[i]);
+		}
+		PFontStack stack;
+		stack.assign(layers);
+		layout.assign(stack);
+	}
+
+	bool hasGlyph(tjs_int ch) const { return layout.has((PFontUInt16)ch); }
+	int  getAdvance(tjs_int ch) const { return layout.getAdvance((PFontUInt16)ch); }
+
+	// measure(text or array) : 幅（複数行なら最も広い行の幅）
+	static tjs_error TJS_INTF_METHOD measureCallback(tTJSVariant *result, tjs_int numparams, tTJSVariant **param, PreRenderedFontLayout *self) {
+		if (numparams < 1) return TJS_E_BADPARAMCOUNT;
+		std::vector<PFontUInt16> text;
+		if (isArray(*param[0])) {
+			ncbPropAccessor src(*param[0]);
+			ncbArrayAccessor arr;
+			const tjs_int n = src.GetArrayCount();
+			for (tjs_int i = 0; i < n; i++) {
+				getText(src.GetValue(i, ncbTypedefs::Tag<tTJSVariant>()), text);
+				arr.SetValue(i, (tjs_int)self->layout.measure(text.empty() ? 0 : &text.front(), text.size()));
+			}
+			if (result) *result = tTJSVariant(arr, arr);
+		} else {
+			getText(*param[0], text);
+			if (result) *result = (tjs_int)self->layout.measure(text.empty() ? 0 : &text.front(), text.size());
+		}
+		return TJS_S_OK;
+	}
+
+	// breakLines(text or array, width, hanging=false) : 行の文字列の配列（配列を渡した場合は配列の配列）
+	static tjs_error TJS_INTF_METHOD breakLinesCallback(tTJSVariant *result, tjs_int numparams, tTJSVariant **param, PreRenderedFontLayout *self) {
+		if (numparams < 2) return TJS_E_BADPARAMCOUNT;
+		const int  width   = (int)(tjs_int)*param[1];
+		const bool hanging = getHanging(numparams, param, 2);
+		if (!result) return TJS_S_OK;
+		if (isArray(*param[0])) {
+			ncbPropAccessor src(*param[0]);
+			ncbArrayAccessor arr;
+			const tjs_int n = src.GetArrayCount();
+			for (tjs_int i = 0; i < n; i++) arr.SetValue(i, self->breakText(src.GetValue(i, ncbTypedefs::Tag<tTJSVariant>()), width, hanging));
+			*result = tTJSVariant(arr, arr);
+		} else {
+			*result = self->breakText(*param[0], width, hanging);
+		}
+		return TJS_S_OK;
+	}
+
+	// countLines(array, width, hanging=false, threads=0) : 各文字列の行数の配列（並列処理）
+	static tjs_error TJS_INTF_METHOD countLinesCallback(tTJSVariant *result, tjs_int numparams, tTJSVariant **param, PreRenderedFontLayout *self) {
+		if (numparams < 2) return TJS_E_BADPARAMCOUNT;
+		const int  width   = (int)(tjs_int)*param[1];
+		const bool hanging = getHanging(numparams, param, 2);
+		const int  threads = (numparams >= 4 && param[3]->Type() != tvtVoid) ? (int)(tjs_int)*param[3] : 0;
+
+		// 文字列の取り出しはスレッドの外で行う
+		std::vector<std::vector<PFontUInt16> > texts;
+		if (isArray(*param[0])) {
+			ncbPropAccessor src(*param[0]);
+			texts.resize(src.GetArrayCount());
+			for (size_t i = 0; i < texts.size(); i++) getText(src.GetValue((tjs_int)i, ncbTypedefs::Tag<tTJSVariant>()), texts[i]);
+		} else {
+			texts.resize(1);
+			getText(*param[0], texts[0]);
+		}
+		std::vector<PFontUInt32> counts;
+		self->layout.countLines(texts, width, hanging, counts, threads);
+		if (result) {
+			ncbArrayAccessor arr;
+			for (size_t i = 0; i < counts.size(); i++) arr.SetValue((tjs_int)i, (tjs_int)counts[i]);
+			*result = tTJSVariant(arr, arr);
+		}
+		return TJS_S_OK;
+	}
+};
+
+NCB_REGISTER_CLASS(PreRenderedFontLayout)
+{
+	Constructor<tTJSVariant>(0);
+	Method(TJS_W("hasGlyph"),   &Class::hasGlyph);
+	Method(TJS_W("getAdvance"), &Class::getAdvance);
+	RawCallback(TJS_W("measure"),    &Class::measureCallback,    0);
+	RawCallback(TJS_W("breakLines"), &Class::breakLinesCallback, 0);
+	RawCallback(TJS_W("countLines"), &Class::countLinesCallback, 0);
+}
+
 ////////////////////////////////////////////////////////////////
 
 // グリフ情報取得＆描画用拡張
@@ -592,11 +1770,12 @@ NCB_ATTACH_FUNCTION(modifyPreRenderedFont, System, modifyPreRenderedFont);
 
 struct LayerGlyphEx
 {
-	LayerGlyphEx(iTJSDispatch2 *self) : hdc(0), hfont(0), obj(self), font(0), format(GGO_GRAY8_BITMAP), charset(DEFAULT_CHARSET), dwrender(0) {
+	LayerGlyphEx(iTJSDispatch2 *self) : hdc(0), hfont(0), obj(self), font(0), format(GGO_GRAY8_BITMAP), charset(DEFAULT_CHARSET), dwrender(0), outline(0), outlineFont(0) {
 		hdc = ::CreateCompatibleDC(NULL);
 	}
 	~LayerGlyphEx() {
 		if (dwrender) delete dwrender;
+		if (outline) delete outline;
 		if (hfont) ::DeleteObject(hfont);
 		::DeleteDC(hdc);
 	}
@@ -679,6 +1858,156 @@ struct LayerGlyphEx
 		return true;
 	}
 
+	// フォントファイルを直接ラスタライズする（pfontraster.hpp，GDI / DirectWrite を使わない）
+	// 回転・下線・取り消し線には対応しない
+	bool renderOutlineGlyph(tjs_uint32 ncode) {
+		updateFont();
+		if (outlineFont != hfont) {
+			outlineFont = hfont;
+			if (outline) delete outline;
+			outline = 0;
+			std::vector<PFontUInt8> data;
+			std::string error;
+			int face = 0;
+			if (getFontFileData(hdc, data, &face)) {
+				outline = new PFontOutlineFont();
+				if (!outline->load(data, face, error)) {
+					delete outline;
+					outline = 0;
+				}
+			}
+		}
+		if (!outline) return false;
+		PFontUInt32 gid = outline->getGlyphIndex(ncode);
+		PFontGlyph glyph;
+		if (!gid || !PFontRenderOutline(*outline, gid, f_height < 0 ? -f_height : f_height,
+										!!(f_flags & TVP_TF_BOLD), !!(f_flags & TVP_TF_ITALIC), glyph)) return false;
+		const PFontIndex &info = glyph.info;
+		const int w = info.width;
+		const int h = info.height;
+		long dstpch = 0;
+		DWORD *dst = setupWriteImage(w, h, dstpch);
+		if (w > 0 && h > 0) {
+			const PFontUInt8 *buf = &glyph.image.front();
+			for (int y = 0; y < h; y++) {
+				DWORD *q = dst + y * dstpch;
+				for (int x = 0; x < w; x++) *q++ = convPixel(*buf++);
+			}
+		}
+
+		ncbPropAccessor p(obj);
+		p.SetValue(TJS_W("blackbox_x"), (tjs_int)w);
+		p.SetValue(TJS_W("blackbox_y"), (tjs_int)h);
+		p.SetValue(TJS_W("origin_x"),   (tjs_int)info.origin_x);
+		p.SetValue(TJS_W("origin_y"),   (tjs_int)info.origin_y);
+		p.SetValue(TJS_W("inc_x"),      (tjs_int)info.inc_x);
+		p.SetValue(TJS_W("inc_y"),      (tjs_int)0);
+		p.SetValue(TJS_W("inc"),        (tjs_int)info.inc);
+		return true;
+	}
+
+	// レンダリング済みフォントファイルからグリフを直接レイヤ画像に展開する
+	bool loadPreRenderedGlyph(tjs_char const *storage, tjs_int ch, bool premul) {
+		PFontLoader loader(storage);
+		typedef PFontFile::SizeType SizeType;
+		SizeType chindexpos = 0, indexpos = 0;
+		tjs_uint32 count = 0;
+		loader.readHeader(count, chindexpos, indexpos);
+
+		std::vector<PFontUInt16> codes;
+		loader.readCodes(codes, count, chindexpos);
+		long n = count ? PFontFindCode(&codes.front(), count, (PFontUInt16)ch) : -1;
+		if (n < 0) return false;
+
+		PFontIndex index;
+		loader.readIndex(index, indexpos, (tjs_uint32)n);
+		const int w = index.width;
+		const int h = index.height;
+		if (w > 0 && h > 0) {
+			std::vector<PFontUInt8> src;
+			SizeType srclen = loader.readImage(src, index.offset, (SizeType)(w * h), chindexpos);
+			long dstpch = 0;
+			DWORD *dst = setupWriteImage(w, h, dstpch);
+			bool done = premul ?
+				PFontDecodeGlyph<PFontConvARGBPremul>(index.reserved, &src.front(), srclen, w, h, (PFontUInt32*)dst, dstpch) :
+				PFontDecodeGlyph<PFontConvARGB>      (index.reserved, &src.front(), srclen, w, h, (PFontUInt32*)dst, dstpch);
+			if (!done) loader.error(TJS_W("can't read storage"));
+		}
+
+		ncbPropAccessor p(obj);
+		p.SetValue(TJS_W("blackbox_x"), (tjs_int)w);
+		p.SetValue(TJS_W("blackbox_y"), (tjs_int)h);
+		p.SetValue(TJS_W("origin_x"),   (tjs_int)index.origin_x);
+		p.SetValue(TJS_W("origin_y"),   (tjs_int)index.origin_y);
+		p.SetValue(TJS_W("inc_x"),      (tjs_int)index.inc_x);
+		p.SetValue(TJS_W("inc_y"),      (tjs_int)index.inc_y);
+		p.SetValue(TJS_W("inc"),        (tjs_int)index.inc);
+		return true;
+	}
+	static tjs_error TJS_INTF_METHOD loadPreRenderedGlyphCallback(tTJSVariant *result, tjs_int numparams, tTJSVariant **param, LayerGlyphEx *self) {
+		if (numparams < 2) return TJS_E_BADPARAMCOUNT;
+		ttstr storage(*param[0]);
+		bool premul = (numparams >= 3) && param[2]->operator bool();
+		bool r = self->loadPreRenderedGlyph(storage.c_str(), (tjs_int)*param[1], premul);
+		if (result) *result = r;
+		return TJS_S_OK;
+	}
+
+	// レンダリング済みフォントで文字列を描画する
+	// y は行の上端（ベースラインは y + ascent），改行で lineHeight（0ならascent+descent）ずつ下げる
+	void drawPreRenderedText(PreRenderedFontReader &font, const tjs_char *text, int x, int y, DWORD color, int lineHeight) {
+		ncbPropAccessor p(obj);
+		const int  lw    = (int) p.getIntValue(TJS_W("imageWidth"));
+		const int  lh    = (int) p.getIntValue(TJS_W("imageHeight"));
+		const long pitch = (long)p.getIntValue(TJS_W("mainImageBufferPitch")) / 4;
+		DWORD *buf = (DWORD*)p.getIntPtrValue(TJS_W("mainImageBufferForWrite"));
+		if (!buf || !text) return;
+
+		if (lineHeight <= 0) lineHeight = font.getAscent() + font.getDescent();
+
+		struct Placement { PFontUInt32 n; int x, y; };
+		std::vector<Placement> line;
+		int penx = x, top = y;
+		int rect[4] = { lw, lh, 0, 0 }; // 更新範囲（left, top, right, bottom）
+		for (const tjs_char *t = text;; ++t) {
+			if (*t && *t != '\n') {
+				long n = font.find((PFontUInt16)*t);
+				if (n >= 0) {
+					const PFontIndex &idx = font.getIndex((PFontUInt32)n);
+					Placement pl = { (PFontUInt32)n, penx + idx.origin_x, top + font.getAscent() - idx.origin_y };
+					if (idx.width > 0 && idx.height > 0 &&
+						pl.x < lw && pl.y < lh && pl.x + idx.width > 0 && pl.y + idx.height > 0) line.push_back(pl);
+					penx += idx.inc;
+				}
+				continue;
+			}
+			// 1行分まとめてクリップ＆合成
+			for (size_t i = 0; i < line.size(); i++) {
+				const Placement &pl = line[i];
+				font.draw(pl.n, (PFontUInt32*)buf, pitch, lw, lh, pl.x, pl.y, (PFontUInt32)color, rect);
+			}
+			line.clear();
+			if (!*t) break;
+			penx = x;
+			top += lineHeight;
+		}
+		if (rect[0] < rect[2] && rect[1] < rect[3]) p.FuncCall(0, TJS_W("update"), 0, NULL, rect[0], rect[1], rect[2] - rect[0], rect[3] - rect[1]);
+	}
+	static tjs_error TJS_INTF_METHOD drawPreRenderedTextCallback(tTJSVariant *result, tjs_int numparams, tTJSVariant **param, LayerGlyphEx *self) {
+		if (numparams < 5) return TJS_E_BADPARAMCOUNT;
+		ttstr text(*param[1]);
+		int lineHeight = (numparams >= 6) ? (int)(tjs_int)*param[5] : 0;
+		PreRenderedFontReader *font = (param[0]->Type() == tvtObject) ?
+			ncbInstanceAdaptor<PreRenderedFontReader>::GetNativeInstance(param[0]->AsObjectNoAddRef()) : 0;
+		if (font) {
+			self->drawPreRenderedText(*font, text.c_str(), (tjs_int)*param[2], (tjs_int)*param[3], (DWORD)(tjs_int64)*param[4], lineHeight);
+		} else {
+			// ファイル名またはファイル名の配列
+			PreRenderedFontReader tmp(*param[0]);
+			self->drawPreRenderedText(tmp,  text.c_str(), (tjs_int)*param[2], (tjs_int)*param[3], (DWORD)(tjs_int64)*param[4], lineHeight);
+		}
+		return TJS_S_OK;
+	}
 
 	inline DWORD convPixel(unsigned char px) { return !px ? 0 : px >= 64 ? 0xFFFFFFFF : (0x00FFFFFF | (((DWORD)px) << (2+24))); }
 	DWORD* setupWriteImage(int w, int h, long &pch) {
@@ -741,6 +2070,7 @@ struct LayerGlyphEx
 		::SelectObject(hdc, hfont);
 
 		if (dwrender) dwrender->setFont(lf);
+		outlineFont = 0; // ハンドルが再利用されても読み直す
 	}
 
 	int get_charset() const { return (int)charset; }
@@ -758,6 +2088,9 @@ private:
 
 	DWriteGlyphRenderer *dwrender;
 
+	PFontOutlineFont *outline; // renderOutlineGlyph 用（outlineFont の選択時に読み込んだもの）
+	HFONT outlineFont;
+
 	static MAT2 no_transform_affin_matrix;
 
 };
@@ -779,6 +2112,9 @@ NCB_ATTACH_CLASS_WITH_HOOK(LayerGlyphEx, Layer)
 	Method(TJS_W("setGlyphInfo"), &Class::setGlyphInfo);
 	Method(TJS_W("drawGlyph"), &Class::drawGlyph);
 	Method(TJS_W("renderGlyph"), &Class::renderGlyph);
+	Method(TJS_W("renderOutlineGlyph"), &Class::renderOutlineGlyph);
+	RawCallback(TJS_W("loadPreRenderedGlyph"), &Class::loadPreRenderedGlyphCallback, 0);
+	RawCallback(TJS_W("drawPreRenderedText"), &Class::drawPreRenderedTextCallback, 0);
 	Property(TJS_W("glyphCharset"), &Class::get_charset, &Class::set_charset);
 }
 
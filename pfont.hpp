@@ -0,0 +1,1041 @@
+#pragma once
+
+// レンダリング済みフォント(*.tft)のフォーマット処理（プラットフォーム非依存部）
+//
+// ファイル構造:
+//   header(24byte) + count(4) + chindexpos(4) + indexpos(4)
+//   image[]     各グリフの 65段階(0〜64) ランレングス圧縮イメージ
+//               （版 \x1a\x01\x03 のファイルは格納形式をグリフごとに選択：PFontImageMode を参照）
+//   code[]      キャラクタコード(16bit)のソート済み配列 (chindexpos から)
+//   index[]     PFontIndex の配列 (indexpos から)
+//
+// 拡張ブロック（任意）:
+//   image[] の先頭に "TFTX" + hotpos(4) を置くことができる
+//   hotpos までのイメージは頻出グリフがまとめて配置された領域（一括先読み用）
+//   グリフのオフセットは絶対位置なので吉里吉里本体からは無視される
+//   （詰め込み形式の圧縮イメージは先頭が任意の値になり得るため，"TFTX" があっても
+//     いずれかのグリフのオフセットが拡張ブロック内を指していれば拡張ブロックとはみなさない）
+//
+// PFONT_NO_SIMD を定義すると SSE2/SSSE3 を使わない（テストで SIMD 版との一致を確認するため）
+
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <atomic>
+#include <thread>
+
+#if !defined(PFONT_NO_SIMD) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__))
+#define PFONT_USE_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(PFONT_USE_SSE2) && (defined(__SSSE3__) || defined(__AVX__))
+#define PFONT_USE_SSSE3
+#include <tmmintrin.h>
+#endif
+
+typedef unsigned char  PFontUInt8;
+typedef unsigned short PFontUInt16;
+typedef short          PFontInt16;
+typedef unsigned int   PFontUInt32;
+typedef unsigned long long PFontUInt64;
+
+//--------------------------------------------------------------
+// グリフ情報（ファイル上のインデックスそのままの並び）
+
+struct PFontIndex
+{
+	PFontUInt32 offset;
+	PFontUInt16 width, height;
+	PFontInt16  origin_x, origin_y, inc_x, inc_y, inc;
+	PFontUInt16 reserved;
+};
+static_assert(sizeof(PFontIndex) == 20, "invalid PFontIndex size");
+
+static const char        PFontHeaderText[] = "TVP pre-rendered font\x1a\x01\x02";
+static const PFontUInt32 PFontHeaderLength = 24;
+static const char        PFontExtMagic[]   = "TFTX";
+static const PFontUInt32 PFontExtLength    = 8;
+
+//--------------------------------------------------------------
+// 展開時の出力ピクセル形式（コンパイル時に特殊化される）
+
+// 8bit 0〜64 (ファイル上の値そのまま)
+struct PFontConv64 {
+	typedef PFontUInt8 Pixel;
+	static inline Pixel conv(PFontUInt8 v) { return v; }
+};
+
+// 8bit 0〜255
+struct PFontConv255 {
+	typedef PFontUInt8 Pixel;
+	static inline Pixel conv(PFontUInt8 v) { return (Pixel)(((PFontUInt32)v * 255) >> 6); }
+};
+
+// 32bit ARGB 白＋α (LayerGlyphEx::convPixel と同値)
+struct PFontConvARGB {
+	typedef PFontUInt32 Pixel;
+	static inline Pixel conv(PFontUInt8 v) { return !v ? 0 : v >= 64 ? 0xFFFFFFFF : (0x00FFFFFF | (((PFontUInt32)v) << (2+24))); }
+};
+
+// 32bit ARGB 乗算済みα
+struct PFontConvARGBPremul {
+	typedef PFontUInt32 Pixel;
+	static inline Pixel conv(PFontUInt8 v) {
+		PFontUInt32 a = v >= 64 ? 0xFF : ((PFontUInt32)v << 2);
+		return (a << 24) | (a << 16) | (a << 8) | a;
+	}
+};
+
+//--------------------------------------------------------------
+// 65段階ランレングス圧縮の展開
+//
+// src/srclen : 圧縮データ（srclen はグリフの終端以降を含んでいてもよい）
+// dst/pitch  : 出力先と1ラインのピクセル数
+// used       : 消費したバイト数を受け取る（不要なら NULL）
+// @return 全ピクセルを展開できたら true（データ不足なら false）
+
+template <class Conv>
+bool PFontDecode65(const PFontUInt8 *src, size_t srclen, int w, int h,
+				   typename Conv::Pixel *dst, long pitch, size_t *used = NULL)
+{
+	typedef typename Conv::Pixel Pixel;
+	const PFontUInt8 *s = src, *send = src + srclen;
+	PFontUInt8 last = 0; // バッファアンダーフロー対策（先頭のランは 0 扱い）
+	Pixel *line = dst;
+	int x = 0, y = 0;
+	while (y < h) {
+		if (s >= send) {
+			if (used) *used = (size_t)(s - src);
+			return false;
+		}
+		PFontUInt8 v = *s++;
+		if (v <= 0x40) {
+			line[x] = Conv::conv(last = v);
+			if (++x >= w) x = 0, ++y, line += pitch;
+		} else {
+			const Pixel px = Conv::conv(last);
+			int len = v - 0x40;
+			while (len > 0 && y < h) { // バッファオーバーラン対策
+				int n = w - x;
+				if (n > len) n = len;
+				for (Pixel *p = line + x, *end = p + n; p < end; ++p) *p = px;
+				len -= n;
+				if ((x += n) >= w) x = 0, ++y, line += pitch;
+			}
+		}
+	}
+	if (used) *used = (size_t)(s - src);
+	return true;
+}
+
+//--------------------------------------------------------------
+// 65段階ランレングス圧縮
+//
+// out        : 出力先（size バイト以上：圧縮後は必ず元サイズ以下になる）
+// @return 圧縮後のサイズ
+
+inline size_t PFontEncode65(const PFontUInt8 *buf, size_t size, PFontUInt8 *out)
+{
+	size_t newsize = 0;
+	size_t count = 0;
+	PFontUInt8 last = 0xff;
+	struct RunLength {
+		static size_t write(PFontUInt8 last, PFontUInt8 *out, size_t newsize, size_t count) {
+			if (count >= 2) {
+				while (count) {
+					size_t len = count > 190 ? 190 : count;
+					out[newsize++] = (PFontUInt8)(0x40 + len); // running
+					count -= len;
+				}
+			} else {
+				while (count--) out[newsize++] = last;
+			}
+			return newsize;
+		}
+	};
+	for (size_t i = 0; i < size; i++) {
+		if (last == buf[i]) count++;
+		else {
+			newsize = RunLength::write(last, out, newsize, count);
+			out[newsize++] = buf[i];
+			count = 0;
+		}
+		last = buf[i];
+	}
+	return RunLength::write(last, out, newsize, count);
+}
+
+//--------------------------------------------------------------
+// 格納形式（PFontIndex::reserved の下位2bit）
+//
+// 0 : 65段階ランレングス圧縮（従来形式）
+// 1 : 1bit（0/64）              8ピクセル/byte
+// 2 : 2bit 4段階（0,21,43,64）   4ピクセル/byte
+// 3 : 4bit 16段階（0,4,…,60,64） 2ピクセル/byte
+// ピクセルは行をまたいで連続し，各バイトの下位ビットから順に並ぶ
+// 0 以外を使ったファイルはヘッダの版を PFontHeaderTextPacked にする（吉里吉里本体では読めない）
+
+enum PFontImageMode {
+	PFontMode65   = 0,
+	PFontMode1Bit = 1,
+	PFontMode2Bit = 2,
+	PFontMode4Bit = 3,
+	PFontModeMask = 0x0003
+};
+
+static const char PFontHeaderTextPacked[] = "TVP pre-rendered font\x1a\x01\x03";
+
+// 形式ごとの段階値
+inline const PFontUInt8 *PFontModeLevels(int mode, int &count)
+{
+	static const PFontUInt8 levels1[2]  = { 0, 64 };
+	static const PFontUInt8 levels2[4]  = { 0, 21, 43, 64 };
+	static const PFontUInt8 levels4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	switch (mode) {
+	case PFontMode1Bit: count = 2;  return levels1;
+	case PFontMode2Bit: count = 4;  return levels2;
+	case PFontMode4Bit: count = 16; return levels4;
+	}
+	count = 0;
+	return 0;
+}
+inline int PFontModeBits(int mode)
+{
+	return mode == PFontMode1Bit ? 1 : mode == PFontMode2Bit ? 2 : mode == PFontMode4Bit ? 4 : 8;
+}
+inline size_t PFontPackedSize(int mode, size_t pixels)
+{
+	return (pixels * PFontModeBits(mode) + 7) / 8;
+}
+
+// 1byte 分を展開するテーブル（ピクセル数は 8/bits）
+struct PFontUnpackTable
+{
+	PFontUInt8 table[3][256][8];
+	PFontUnpackTable() {
+		for (int mode = PFontMode1Bit; mode <= PFontMode4Bit; mode++) {
+			int count = 0;
+			const PFontUInt8 *levels = PFontModeLevels(mode, count);
+			const int bits = PFontModeBits(mode);
+			for (int v = 0; v < 256; v++)
+				for (int i = 0; i < 8 / bits; i++) table[mode - 1][v][i] = levels[(v >> (i * bits)) & (count - 1)];
+		}
+	}
+	static const PFontUnpackTable& get() {
+		static const PFontUnpackTable instance;
+		return instance;
+	}
+};
+
+// 詰められたイメージを 0〜64 に展開する
+// @return srclen が足りなければ false
+inline bool PFontUnpack(int mode, const PFontUInt8 *src, size_t srclen, size_t pixels, PFontUInt8 *dst)
+{
+	if (mode < PFontMode1Bit || mode > PFontMode4Bit || srclen < PFontPackedSize(mode, pixels)) return false;
+	const int per = 8 / PFontModeBits(mode);
+	size_t i = 0;
+#ifdef PFONT_USE_SSSE3
+	// 16ピクセル単位で pshufb により段階値へ変換する
+	switch (mode) {
+	case PFontMode1Bit: {
+		const __m128i spread = _mm_setr_epi8(0,0,0,0,0,0,0,0, 1,1,1,1,1,1,1,1);
+		const __m128i bits   = _mm_setr_epi8(1,2,4,8,16,32,64,-128, 1,2,4,8,16,32,64,-128);
+		const __m128i full   = _mm_set1_epi8(64);
+		for (; i + 16 <= pixels; i += 16, src += 2) {
+			PFontUInt16 w;
+			memcpy(&w, src, 2);
+			__m128i v = _mm_shuffle_epi8(_mm_cvtsi32_si128(w), spread);
+			v = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(v, bits), bits), full);
+			_mm_storeu_si128((__m128i*)(dst + i), v);
+		}
+		break;
+	}
+	case PFontMode2Bit: {
+		// ニブルごとに2ピクセル：下位2bitと上位2bitをそれぞれ表引きして交互に並べる
+		const __m128i lutlo = _mm_setr_epi8(0,21,43,64, 0,21,43,64, 0,21,43,64, 0,21,43,64);
+		const __m128i luthi = _mm_setr_epi8(0,0,0,0, 21,21,21,21, 43,43,43,43, 64,64,64,64);
+		const __m128i mask  = _mm_set1_epi8(0x0F);
+		for (; i + 32 <= pixels; i += 32, src += 8) {
+			__m128i b   = _mm_loadl_epi64((const __m128i*)src);
+			__m128i nib = _mm_unpacklo_epi8(_mm_and_si128(b, mask), _mm_and_si128(_mm_srli_epi16(b, 4), mask));
+			__m128i lo  = _mm_shuffle_epi8(lutlo, nib);
+			__m128i hi  = _mm_shuffle_epi8(luthi, nib);
+			_mm_storeu_si128((__m128i*)(dst + i),      _mm_unpacklo_epi8(lo, hi));
+			_mm_storeu_si128((__m128i*)(dst + i + 16), _mm_unpackhi_epi8(lo, hi));
+		}
+		break;
+	}
+	case PFontMode4Bit: {
+		const __m128i lut  = _mm_setr_epi8(0,4,9,13,17,21,26,30,34,38,43,47,51,55,60,64);
+		const __m128i mask = _mm_set1_epi8(0x0F);
+		for (; i + 16 <= pixels; i += 16, src += 8) {
+			__m128i b   = _mm_loadl_epi64((const __m128i*)src);
+			__m128i nib = _mm_unpacklo_epi8(_mm_and_si128(b, mask), _mm_and_si128(_mm_srli_epi16(b, 4), mask));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(lut, nib));
+		}
+		break;
+	}
+	}
+#endif
+	const PFontUInt8 (*table)[8] = PFontUnpackTable::get().table[mode - 1];
+	for (; i + per <= pixels; i += per) memcpy(dst + i, table[*src++], per);
+	if (i < pixels) memcpy(dst + i, table[*src], pixels - i);
+	return true;
+}
+
+// 格納形式に応じてグリフを展開する
+template <class Conv>
+bool PFontDecodeGlyph(int mode, const PFontUInt8 *src, size_t srclen, int w, int h,
+					  typename Conv::Pixel *dst, long pitch, size_t *used = NULL)
+{
+	mode &= PFontModeMask;
+	if (mode == PFontMode65) return PFontDecode65<Conv>(src, srclen, w, h, dst, pitch, used);
+	const size_t pixels = (size_t)w * h;
+	if (used) *used = PFontPackedSize(mode, pixels);
+	if (!pixels) return true;
+	std::vector<PFontUInt8> tmp(pixels);
+	if (!PFontUnpack(mode, src, srclen, pixels, &tmp.front())) return false;
+	const PFontUInt8 *s = &tmp.front();
+	for (int y = 0; y < h; y++, dst += pitch)
+		for (int x = 0; x < w; x++) dst[x] = Conv::conv(*s++);
+	return true;
+}
+
+// 最も近い段階値に丸める（levels : 2/4/16，それ以外は何もしない）
+inline void PFontQuantize(PFontUInt8 *buf, size_t size, int levels)
+{
+	const int mode = levels == 2 ? PFontMode1Bit : levels == 4 ? PFontMode2Bit : levels == 16 ? PFontMode4Bit : 0;
+	if (!mode) return;
+	int count = 0;
+	const PFontUInt8 *lv = PFontModeLevels(mode, count);
+	PFontUInt8 map[65];
+	for (int v = 0, k = 0; v <= 64; v++) {
+		while (k + 1 < count && (lv[k + 1] - v) < (v - lv[k])) k++;
+		map[v] = lv[k];
+	}
+	for (size_t i = 0; i < size; i++) buf[i] = map[buf[i] > 64 ? 64 : buf[i]];
+}
+
+// 格納形式を選んで圧縮する
+// packed が false なら常に65段階ランレングス圧縮
+// out  : 出力先（size バイト以上）
+// mode : 選ばれた格納形式
+// @return 圧縮後のサイズ
+inline size_t PFontEncodeGlyph(const PFontUInt8 *buf, size_t size, PFontUInt8 *out, bool packed, PFontUInt16 &mode)
+{
+	mode = PFontMode65;
+	size_t best = PFontEncode65(buf, size, out);
+	if (!packed || !size) return best;
+
+	// 全ピクセルを表現できる最小の形式（段階値は 1bit ⊂ 2bit ⊂ 4bit）
+	bool used[65] = { false };
+	for (size_t i = 0; i < size; i++) used[buf[i] > 64 ? 64 : buf[i]] = true;
+	int candidate = 0;
+	for (int m = PFontMode1Bit; m <= PFontMode4Bit && !candidate; m++) {
+		int count = 0;
+		const PFontUInt8 *lv = PFontModeLevels(m, count);
+		bool ok = true;
+		for (int v = 0; v <= 64 && ok; v++) ok = !used[v] || std::find(lv, lv + count, (PFontUInt8)v) != lv + count;
+		if (ok) candidate = m;
+	}
+	if (!candidate || PFontPackedSize(candidate, size) >= best) return best;
+
+	int count = 0;
+	const PFontUInt8 *lv = PFontModeLevels(candidate, count);
+	PFontUInt8 index[65] = { 0 };
+	for (int k = 0; k < count; k++) index[lv[k]] = (PFontUInt8)k;
+	const int bits = PFontModeBits(candidate);
+	const size_t packedsize = PFontPackedSize(candidate, size);
+	memset(out, 0, packedsize);
+	for (size_t i = 0; i < size; i++) {
+		const size_t bit = i * bits;
+		out[bit >> 3] |= (PFontUInt8)(index[buf[i]] << (bit & 7));
+	}
+	mode = (PFontUInt16)candidate;
+	return packedsize;
+}
+
+//--------------------------------------------------------------
+// キャラクタコード表の二分探索
+// @return インデックス（見つからなければ -1）
+
+inline long PFontFindCode(const PFontUInt16 *codes, PFontUInt32 count, PFontUInt16 ch)
+{
+	PFontUInt32 lo = 0, hi = count;
+	while (lo < hi) {
+		PFontUInt32 mid = (lo + hi) / 2;
+		if (codes[mid] < ch) lo = mid + 1;
+		else hi = mid;
+	}
+	return (lo < count && codes[lo] == ch) ? (long)lo : -1;
+}
+
+//--------------------------------------------------------------
+// 文字集合（16bitコードのビットセット）
+
+class PFontCharSet
+{
+	std::vector<PFontUInt32> bits;
+public:
+	PFontCharSet() : bits(0x10000 / 32, 0) {}
+
+	void add(PFontUInt16 ch) { bits[ch >> 5] |= 1U << (ch & 31); }
+	bool has(PFontUInt16 ch) const { return (bits[ch >> 5] >> (ch & 31)) & 1; }
+	void merge(const PFontCharSet &other) {
+		for (size_t i = 0; i < bits.size(); i++) bits[i] |= other.bits[i];
+	}
+	template <typename T>
+	void addString(const T *str) {
+		if (str) for (; *str; ++str) add((PFontUInt16)*str);
+	}
+
+	// 昇順のコード列
+	void getCodes(std::vector<PFontUInt16> &codes) const {
+		codes.clear();
+		for (size_t i = 0; i < bits.size(); i++) {
+			PFontUInt32 w = bits[i];
+			for (int b = 0; w; b++, w >>= 1) if (w & 1) codes.push_back((PFontUInt16)(i * 32 + b));
+		}
+	}
+
+	// 連続範囲 (先頭, 個数-1) の列に変換（保存用）
+	void getRanges(std::vector<PFontUInt16> &ranges) const {
+		ranges.clear();
+		long start = -1;
+		for (long ch = 0; ch <= 0x10000; ch++) {
+			bool on = ch < 0x10000 && has((PFontUInt16)ch);
+			if (on && start < 0) start = ch;
+			else if (!on && start >= 0) {
+				ranges.push_back((PFontUInt16)start);
+				ranges.push_back((PFontUInt16)(ch - start - 1));
+				start = -1;
+			}
+		}
+	}
+	void addRanges(const PFontUInt16 *ranges, size_t count) {
+		for (size_t i = 0; i + 1 < count; i += 2) {
+			for (long ch = ranges[i], end = (long)ranges[i] + ranges[i+1]; ch <= end; ch++) add((PFontUInt16)ch);
+		}
+	}
+};
+
+//--------------------------------------------------------------
+// メモリ上に展開したフォントデータ（コード表・インデックス・イメージ領域）
+
+struct PFontData
+{
+	PFontUInt32 count, chindexpos, indexpos, imagepos, hotpos;
+	std::vector<PFontUInt16> codes;
+	std::vector<PFontIndex>  index;
+	std::vector<PFontUInt8>  image; // imagepos〜chindexpos の内容
+
+	PFontData() : count(0), chindexpos(0), indexpos(0), imagepos(0), hotpos(0) {}
+
+	// 拡張ブロックの確認（ext はイメージ領域の先頭 PFontExtLength バイト）
+	void checkExtension(const PFontUInt8 *ext) {
+		hotpos = 0;
+		if (memcmp(ext, PFontExtMagic, 4)) return;
+		PFontUInt32 pos = 0;
+		memcpy(&pos, ext + 4, 4);
+		for (PFontUInt32 i = 0; i < count; i++) if (index[i].offset < imagepos + PFontExtLength) return;
+		if (pos >= imagepos + PFontExtLength && pos <= chindexpos) hotpos = pos;
+	}
+
+	long find(PFontUInt16 ch) const {
+		return count ? PFontFindCode(&codes.front(), count, ch) : -1;
+	}
+
+	// グリフの圧縮イメージの位置（長さは上限値：圧縮後は必ず w*h 以下）
+	bool getImage(PFontUInt32 n, const PFontUInt8 *&src, size_t &len) const {
+		const PFontIndex &idx = index[n];
+		if (idx.offset < imagepos || idx.offset > chindexpos || image.empty()) return false;
+		size_t pos  = idx.offset - imagepos;
+		size_t rest = image.size() > pos ? image.size() - pos : 0;
+		size_t size = (size_t)idx.width * idx.height;
+		src = &image.front() + pos;
+		len = size < rest ? size : rest;
+		return true;
+	}
+
+	// 各グリフの圧縮イメージの実サイズ（次のオフセットまで：共有イメージは0扱いしない）
+	void getImageSizes(std::vector<PFontUInt32> &sizes) const {
+		std::vector<PFontUInt32> offsets(count);
+		for (PFontUInt32 i = 0; i < count; i++) offsets[i] = index[i].offset;
+		std::sort(offsets.begin(), offsets.end());
+		offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+		sizes.resize(count);
+		for (PFontUInt32 i = 0; i < count; i++) {
+			const PFontIndex &idx = index[i];
+			std::vector<PFontUInt32>::const_iterator next = std::upper_bound(offsets.begin(), offsets.end(), idx.offset);
+			PFontUInt32 end  = next != offsets.end() ? *next : chindexpos;
+			PFontUInt32 size = end > idx.offset ? end - idx.offset : 0;
+			PFontUInt32 full = (PFontUInt32)idx.width * idx.height;
+			sizes[i] = size < full ? size : full;
+		}
+	}
+
+	// グリフを 0〜64 で展開する
+	bool decode(PFontUInt32 n, std::vector<PFontUInt8> &buf) const {
+		const PFontIndex &idx = index[n];
+		buf.resize((size_t)idx.width * idx.height);
+		if (buf.empty()) return true;
+		const PFontUInt8 *src = 0;
+		size_t len = 0;
+		return getImage(n, src, len) &&
+			PFontDecodeGlyph<PFontConv64>(idx.reserved, src, len, idx.width, idx.height, &buf.front(), idx.width);
+	}
+
+	// ベースラインから上下の最大ピクセル数
+	void getExtent(int &ascent, int &descent) const {
+		ascent = descent = 0;
+		for (PFontUInt32 i = 0; i < count; i++) {
+			const PFontIndex &idx = index[i];
+			if (!idx.height) continue;
+			if (ascent  < idx.origin_y) ascent  = idx.origin_y;
+			if (descent < idx.height - idx.origin_y) descent = idx.height - idx.origin_y;
+		}
+	}
+};
+
+//--------------------------------------------------------------
+// 並列処理
+//
+// 処理の重い順に並べた仕事をワーカーが先頭から取り合う（コストの偏りがあっても最後まで均等化される）
+// func はスレッドから呼ばれるので例外を投げたり吉里吉里のAPIを呼んではいけない
+
+inline int PFontThreadCount(int threads)
+{
+	if (threads > 0) return threads;
+	unsigned int hc = std::thread::hardware_concurrency();
+	return hc ? (int)hc : 1;
+}
+
+template <class F>
+void PFontParallelFor(size_t count, int threads, F func)
+{
+	threads = PFontThreadCount(threads);
+	if ((size_t)threads > count) threads = (int)count;
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i; (i = next++) < count;) func(i);
+	};
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; i++) pool.push_back(std::thread(worker));
+	worker();
+	for (size_t i = 0; i < pool.size(); i++) pool[i].join();
+}
+
+// cost の大きい順に並べたインデックス列
+template <typename T>
+void PFontSortByCost(const std::vector<T> &cost, std::vector<PFontUInt32> &order)
+{
+	order.resize(cost.size());
+	for (size_t i = 0; i < order.size(); i++) order[i] = (PFontUInt32)i;
+	std::stable_sort(order.begin(), order.end(), [&](PFontUInt32 a, PFontUInt32 b) { return cost[a] > cost[b]; });
+}
+
+//--------------------------------------------------------------
+// 全グリフを1つの連続領域に展開する
+//
+// arena   : 全グリフの 0〜64 イメージ（グリフ n は offsets[n]〜offsets[n+1]，width*height）
+// @return 展開に失敗したグリフ数（失敗したグリフは 0 埋め）
+
+inline PFontUInt32 PFontDecodeAll(const PFontData &data, std::vector<PFontUInt8> &arena, std::vector<PFontUInt32> &offsets, int threads)
+{
+	const PFontUInt32 count = data.count;
+	offsets.resize(count + 1);
+	size_t total = 0;
+	for (PFontUInt32 i = 0; i < count; i++) {
+		offsets[i] = (PFontUInt32)total;
+		total += (size_t)data.index[i].width * data.index[i].height;
+	}
+	offsets[count] = (PFontUInt32)total;
+	arena.assign(total, 0);
+
+	std::vector<PFontUInt32> sizes, order;
+	data.getImageSizes(sizes);
+	PFontSortByCost(sizes, order);
+
+	std::atomic<PFontUInt32> failed(0);
+	PFontUInt8 *base = arena.empty() ? 0 : &arena.front();
+	PFontParallelFor(order.size(), threads, [&](size_t k) {
+		const PFontUInt32 n = order[k];
+		const PFontIndex &idx = data.index[n];
+		if (!idx.width || !idx.height) return;
+		const PFontUInt8 *src = 0;
+		size_t len = 0;
+		if (!data.getImage(n, src, len) ||
+			!PFontDecodeGlyph<PFontConv64>(idx.reserved, src, len, idx.width, idx.height, base + offsets[n], idx.width)) {
+			memset(base + offsets[n], 0, (size_t)idx.width * idx.height);
+			++failed;
+		}
+	});
+	return failed;
+}
+
+//--------------------------------------------------------------
+// メトリクスのみの構造体配列（レイアウト処理用）
+
+struct PFontMetrics
+{
+	std::vector<PFontUInt16> codes, width, height;
+	std::vector<PFontInt16>  origin_x, origin_y, inc_x, inc_y, inc;
+
+	void assign(const PFontData &data) {
+		const PFontUInt32 count = data.count;
+		codes.assign(data.codes.begin(), data.codes.begin() + count);
+		width.resize(count);
+		height.resize(count);
+		origin_x.resize(count);
+		origin_y.resize(count);
+		inc_x.resize(count);
+		inc_y.resize(count);
+		inc.resize(count);
+		for (PFontUInt32 i = 0; i < count; i++) {
+			const PFontIndex &idx = data.index[i];
+			width[i]    = idx.width;
+			height[i]   = idx.height;
+			origin_x[i] = idx.origin_x;
+			origin_y[i] = idx.origin_y;
+			inc_x[i]    = idx.inc_x;
+			inc_y[i]    = idx.inc_y;
+			inc[i]      = idx.inc;
+		}
+	}
+};
+
+//--------------------------------------------------------------
+// 拡大描画された 32bit ARGB 画像のαを縮小して 0〜64 に変換する
+//
+// img/pitch  : 元画像（pitch はバイト単位），sw/sh は元画像の有効サイズ（範囲外は 0 扱い）
+// w/h        : 出力サイズ（元画像は w*factor x h*factor を想定）
+// gamma      : 1.0 以外なら α^gamma の線形空間で平均して戻す
+// dither     : 4x4 の組織的ディザで 65段階に量子化する
+
+inline void PFontDownsampleAlpha(const PFontUInt8 *img, long pitch, int sw, int sh,
+								 int w, int h, int factor, double gamma, bool dither, PFontUInt8 *out)
+{
+	static const int bayer[4][4] = { { 0, 8, 2,10 }, {12, 4,14, 6 }, { 3,11, 1, 9 }, {15, 7,13, 5 } };
+	if (factor < 1) factor = 1;
+	const bool linear = (gamma > 0.0 && gamma != 1.0);
+	PFontUInt32 lut[256];
+	for (int i = 0; i < 256; i++) lut[i] = linear ? (PFontUInt32)(std::pow(i / 255.0, gamma) * 65535.0 + 0.5) : (PFontUInt32)i;
+	const double maxsum = (double)factor * factor * (linear ? 65535.0 : 255.0);
+
+	const int cols = w * factor;
+	if (sw > cols) sw = cols;
+	std::vector<PFontUInt32> colsum(cols + 4);
+	for (int y = 0; y < h; y++) {
+		std::fill(colsum.begin(), colsum.end(), 0);
+		for (int sy = y * factor, ey = sy + factor; sy < ey && sy < sh; sy++) {
+			const PFontUInt32 *line = (const PFontUInt32*)(img + sy * pitch);
+			PFontUInt32 *sum = &colsum.front();
+			int x = 0;
+			if (linear) {
+				for (; x < sw; x++) sum[x] += lut[line[x] >> 24];
+				continue;
+			}
+#ifdef PFONT_USE_SSE2
+			for (; x + 4 <= sw; x += 4) {
+				__m128i a = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)(line + x)), 24);
+				_mm_storeu_si128((__m128i*)(sum + x), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(sum + x)), a));
+			}
+#endif
+			for (; x < sw; x++) sum[x] += line[x] >> 24;
+		}
+		PFontUInt8 *q = out + y * w;
+		for (int x = 0; x < w; x++) {
+			PFontUInt32 total = 0;
+			for (int i = 0, sx = x * factor; i < factor; i++) total += colsum[sx + i];
+			double v = total / maxsum;
+			if (linear) v = std::pow(v, 1.0 / gamma);
+			v *= 64.0;
+			int n = (int)(dither ? v + (bayer[y & 3][x & 3] + 0.5) / 16.0 : v + 0.5);
+			q[x] = (PFontUInt8)(n < 0 ? 0 : n > 64 ? 64 : n);
+		}
+	}
+}
+
+//--------------------------------------------------------------
+// 65段階のカバレッジで 32bit ARGB へ色をブレンドする
+// 各チャンネル d + ((s - d) * a >> 6)，αチャンネルも同様（s のαは 0xFF）
+
+// d + ((s - d) * a >> 6) = (d * (64 - a) + s * a) >> 6 なので2チャンネルずつまとめて計算する
+inline PFontUInt32 PFontBlendPixel(PFontUInt32 d, PFontUInt32 s, int a)
+{
+	const PFontUInt32 na = 64 - a;
+	const PFontUInt32 rb = (((d & 0x00FF00FF) * na + (s & 0x00FF00FF) * a) >> 6) & 0x00FF00FF;
+	const PFontUInt32 ga = ((((d >> 8) & 0x00FF00FF) * na + ((s >> 8) & 0x00FF00FF) * a) >> 6) & 0x00FF00FF;
+	return rb | (ga << 8);
+}
+
+inline void PFontBlendLine(PFontUInt32 *dst, const PFontUInt8 *cov, int n, PFontUInt32 color)
+{
+	color |= 0xFF000000;
+	int i = 0;
+#ifdef PFONT_USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i solid = _mm_set1_epi32((int)color);
+	const __m128i s16 = _mm_unpacklo_epi8(solid, zero);
+	for (; i + 4 <= n; i += 4) {
+		int a4;
+		memcpy(&a4, cov + i, 4);
+		if (!a4) continue;
+		if (a4 == 0x40404040) {
+			_mm_storeu_si128((__m128i*)(dst + i), solid);
+			continue;
+		}
+		__m128i a = _mm_unpacklo_epi8(_mm_cvtsi32_si128(a4), zero);
+		a = _mm_unpacklo_epi16(a, a);
+		const __m128i alo = _mm_unpacklo_epi32(a, a);
+		const __m128i ahi = _mm_unpackhi_epi32(a, a);
+		const __m128i d   = _mm_loadu_si128((const __m128i*)(dst + i));
+		__m128i dlo = _mm_unpacklo_epi8(d, zero);
+		__m128i dhi = _mm_unpackhi_epi8(d, zero);
+		dlo = _mm_add_epi16(dlo, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(s16, dlo), alo), 6));
+		dhi = _mm_add_epi16(dhi, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(s16, dhi), ahi), 6));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(dlo, dhi));
+	}
+#endif
+	for (; i < n; i++) {
+		const int a = cov[i];
+		if (!a) continue;
+		dst[i] = a >= 64 ? color : PFontBlendPixel(dst[i], color, a);
+	}
+}
+
+// 展開済みのグリフ（0〜64，w*h）を 32bit ARGB の出力先にブレンドする
+// dst/pitch : 出力先（pitch はピクセル単位），dw/dh はその大きさ（範囲外はクリップ）
+// x, y      : グリフ左上の位置
+// @return 描画したか（rect を指定すると更新範囲 left, top, right, bottom を広げる）
+inline bool PFontBlitImage(PFontUInt32 *dst, long pitch, int dw, int dh, int x, int y,
+						   const PFontUInt8 *img, int w, int h, PFontUInt32 color, int *rect = NULL)
+{
+	int sx = 0, sy = 0, cw = w, ch = h;
+	if (x < 0) sx = -x, cw += x, x = 0;
+	if (y < 0) sy = -y, ch += y, y = 0;
+	if (x + cw > dw) cw = dw - x;
+	if (y + ch > dh) ch = dh - y;
+	if (!img || cw <= 0 || ch <= 0) return false;
+	for (int j = 0; j < ch; j++) PFontBlendLine(dst + (y + j) * pitch + x, img + (size_t)(sy + j) * w + sx, cw, color);
+	if (rect) {
+		if (rect[0] > x)      rect[0] = x;
+		if (rect[1] > y)      rect[1] = y;
+		if (rect[2] < x + cw) rect[2] = x + cw;
+		if (rect[3] < y + ch) rect[3] = y + ch;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////
+// ファイル操作クラス
+//
+// Stream はプラットフォームごとのストリーム実装で，以下を持つこと
+//   Stream(storage, flags)   flags は PFontOpenMode（吉里吉里の TJS_BS_* と同値）
+//   void error(const char *message) const   （例外を投げて戻らないこと）
+//   void write(void const *buf, PFontUInt32 length)
+//   void read(void *buf, PFontUInt32 length)
+//   void seek(PFontUInt32 pos)
+//   PFontUInt32 getPos() const
+//   PFontUInt32 getSize() const   （ストリーム全体の長さ，位置は変えないこと）
+
+enum PFontOpenMode { PFontRead = 0, PFontWrite = 1, PFontUpdate = 3 };
+
+//--------------------------------------------------------------
+// ファイル操作クラス(共通)
+
+template <class Stream>
+struct PFontFileT : public Stream
+{
+	typedef PFontUInt32 SizeType;
+
+	template <typename S>
+	PFontFileT(S storage, unsigned int flags) : Stream(storage, flags) {}
+
+	template <typename T>
+	SizeType align(T t) {
+		SizeType pos = this->getPos();
+		this->write(&t, (SizeType)(sizeof(T) - (pos % sizeof(T))));
+		return this->getPos();
+	}
+};
+
+//--------------------------------------------------------------
+// ファイル操作クラス(書き込み)
+
+template <class Stream>
+struct PFontSaverT : public PFontFileT<Stream>
+{
+	typedef PFontUInt32 SizeType;
+
+	bool packed;     // 格納形式の選択を許可する
+	int  levels;     // 保存前に丸める段階数（2/4/16，0なら丸めない）
+	bool packedUsed; // 格納形式を使用した（ヘッダの版が変わる）
+
+	template <typename S>
+	PFontSaverT(S storage) : PFontFileT<Stream>(storage, PFontWrite), packed(false), levels(0), packedUsed(false)
+	{
+		this->write(PFontHeaderText, PFontHeaderLength);
+		this->write("            ", 12); // dummy index
+	}
+
+	// 拡張ブロック（頻出グリフ領域の終端は writeHotPos で後から書き込む）
+	SizeType writeExtension() {
+		PFontUInt32 hotpos = 0;
+		this->write(PFontExtMagic, 4);
+		SizeType pos = this->getPos();
+		this->write(&hotpos, 4);
+		return pos;
+	}
+	void writeHotPos(SizeType pos, PFontUInt32 hotpos) {
+		this->seek(pos);
+		this->write(&hotpos, 4);
+	}
+
+	void writeHeader(PFontUInt32 count, SizeType chindexpos, SizeType indexpos) {
+		this->seek(0);
+		this->write(packedUsed ? PFontHeaderTextPacked : PFontHeaderText, PFontHeaderLength);
+		this->write(&count,      4);
+		this->write(&chindexpos, 4);
+		this->write(&indexpos,   4);
+	}
+
+	// フォントイメージ（65段階）の保存（格納形式を mode に返す）
+	void writeImage(const PFontUInt8 *buf, int size, PFontUInt16 &mode) {
+		mode = PFontMode65;
+		if (size <= 0) return;
+		std::vector<PFontUInt8> newbuf(size);
+		std::vector<PFontUInt8> quantized;
+		if (levels) {
+			quantized.assign(buf, buf + size);
+			PFontQuantize(&quantized.front(), size, levels);
+			buf = &quantized.front();
+		}
+		size_t newsize = PFontEncodeGlyph(buf, size, &newbuf.front(), packed, mode);
+		if (mode != PFontMode65) packedUsed = true;
+		this->write(&newbuf.front(), (SizeType)newsize);
+	}
+};
+
+//--------------------------------------------------------------
+// ファイル操作クラス(読み取り)
+
+template <class Stream>
+struct PFontLoaderT : public PFontFileT<Stream>
+{
+	typedef PFontUInt32 SizeType;
+
+	template <typename S>
+	PFontLoaderT(S storage, unsigned int flags = PFontRead) : PFontFileT<Stream>(storage, flags)
+	{
+		std::vector<char> header(PFontHeaderLength);
+		this->read(&header.front(), PFontHeaderLength);
+		packed = !memcmp(&header.front(), PFontHeaderTextPacked, PFontHeaderLength);
+		if (!packed && memcmp(&header.front(), PFontHeaderText, PFontHeaderLength))
+			this->error("invalid tft header");
+	}
+
+	bool packed; // 格納形式を使用したファイル
+
+	// ヘッダを読み込む（コード表・インデックスがファイル内に収まらなければエラー）
+	void readHeader(PFontUInt32 &count, SizeType &chindexpos, SizeType &indexpos) {
+		this->seek(PFontHeaderLength);
+		this->read(&count,      4);
+		this->read(&chindexpos, 4);
+		this->read(&indexpos,   4);
+		const PFontUInt64 size = this->getSize();
+		if (chindexpos < this->getPos() ||
+			(PFontUInt64)chindexpos + (PFontUInt64)count * sizeof(PFontUInt16) > size ||
+			(PFontUInt64)indexpos   + (PFontUInt64)count * sizeof(PFontIndex)  > size)
+			this->error("invalid tft header");
+	}
+
+	// コード表を読み込む
+	void readCodes(std::vector<PFontUInt16> &codes, PFontUInt32 count, SizeType chindexpos) {
+		codes.resize(count);
+		if (!count) return;
+		this->seek(chindexpos);
+		this->read(&codes.front(), (SizeType)(count * sizeof(PFontUInt16)));
+	}
+	// インデックスを1件読み込む
+	void readIndex(PFontIndex &index, SizeType indexpos, PFontUInt32 n) {
+		this->seek(indexpos + n * (SizeType)sizeof(PFontIndex));
+		this->read(&index, (SizeType)sizeof(PFontIndex));
+		if (!packed) index.reserved &= ~PFontModeMask; // 従来形式では常に65段階
+	}
+	// 圧縮イメージを読み込む（どの格納形式でも w*h 以下なのでそれを上限とし，コード表の手前までに制限）
+	SizeType readImage(std::vector<PFontUInt8> &buf, SizeType offset, SizeType size, SizeType chindexpos) {
+		if (offset > chindexpos) this->error("invalid image offset");
+		if (size > chindexpos - offset) size = chindexpos - offset;
+		buf.resize(size ? size : 1);
+		if (size > 0) {
+			this->seek(offset);
+			this->read(&buf.front(), size);
+		}
+		return size;
+	}
+
+	// コード表・インデックスのみ読み込む（イメージ領域には触れない）
+	void readTables(PFontData &data) {
+		SizeType chindexpos = 0, indexpos = 0;
+		readHeader(data.count, chindexpos, indexpos);
+		data.imagepos   = this->getPos();
+		data.chindexpos = chindexpos;
+		data.indexpos   = indexpos;
+
+		readCodes(data.codes, data.count, chindexpos);
+		data.index.resize(data.count);
+		if (data.count > 0) {
+			this->seek(indexpos);
+			this->read(&data.index.front(), (SizeType)(data.count * sizeof(PFontIndex)));
+			if (!packed) for (PFontUInt32 i = 0; i < data.count; i++) data.index[i].reserved &= ~PFontModeMask;
+		}
+	}
+	// イメージ領域を読み込む（hotonly なら頻出グリフ領域のみ読み込み，残りがあれば false を返す）
+	bool readImageSection(PFontData &data, bool hotonly) {
+		data.image.resize(data.chindexpos - data.imagepos);
+		data.hotpos = 0;
+		if (data.image.size() >= PFontExtLength) {
+			this->seek(data.imagepos);
+			this->read(&data.image.front(), PFontExtLength);
+			data.checkExtension(&data.image.front());
+		}
+		SizeType end = (hotonly && data.hotpos) ? data.hotpos : data.chindexpos;
+		SizeType pos = data.imagepos + (data.image.size() >= PFontExtLength ? PFontExtLength : 0);
+		if (end > pos) {
+			this->seek(pos);
+			this->read(&data.image[pos - data.imagepos], end - pos);
+		}
+		return end == data.chindexpos;
+	}
+	void readImageRest(PFontData &data) {
+		SizeType pos = data.hotpos;
+		if (pos < data.imagepos || pos >= data.chindexpos) return;
+		this->seek(pos);
+		this->read(&data.image[pos - data.imagepos], data.chindexpos - pos);
+	}
+	// コード表・インデックス・イメージ領域をまとめて読み込む
+	void readData(PFontData &data) {
+		readTables(data);
+		readImageSection(data, false);
+	}
+
+	bool check(void const *buf, SizeType length) {
+		std::vector<char> checkbuf(length);
+		this->read(&checkbuf.front(), length);
+		return !memcmp(&checkbuf.front(), buf, length);
+	}
+};
+
+//--------------------------------------------------------------
+// メモリ上のグリフ（変換処理用）
+
+struct PFontGlyph
+{
+	PFontUInt16 code;
+	PFontIndex  info;                // offset は保存時に設定される
+	std::vector<PFontUInt8> image;   // 0〜64，info.width * info.height
+};
+
+// 値0の外周を切り詰める
+inline void PFontCropGlyph(PFontGlyph &g)
+{
+	const int w = g.info.width, h = g.info.height;
+	int l = w, t = h, r = 0, b = 0;
+	for (int y = 0; y < h; y++) {
+		const PFontUInt8 *line = &g.image[(size_t)y * w];
+		for (int x = 0; x < w; x++) {
+			if (!line[x]) continue;
+			if (l > x) l = x;
+			if (r < x + 1) r = x + 1;
+			if (t > y) t = y;
+			b = y + 1;
+		}
+	}
+	if (l >= r) {
+		g.image.clear();
+		g.info.width = g.info.height = 0;
+		return;
+	}
+	if (l == 0 && t == 0 && r == w && b == h) return;
+	std::vector<PFontUInt8> img((size_t)(r - l) * (b - t));
+	for (int y = t; y < b; y++) memcpy(&img[(size_t)(y - t) * (r - l)], &g.image[(size_t)y * w + l], r - l);
+	g.image.swap(img);
+	g.info.width    = (PFontUInt16)(r - l);
+	g.info.height   = (PFontUInt16)(b - t);
+	g.info.origin_x = (PFontInt16)(g.info.origin_x + l);
+	g.info.origin_y = (PFontInt16)(g.info.origin_y - t);
+}
+
+// 全グリフを展開する
+// @return 展開に失敗したグリフ数
+inline PFontUInt32 PFontDecodeGlyphs(const PFontData &data, std::vector<PFontGlyph> &glyphs, int threads)
+{
+	glyphs.resize(data.count);
+	std::atomic<PFontUInt32> failed(0);
+	PFontParallelFor(glyphs.size(), threads, [&](size_t n) {
+		PFontGlyph &g = glyphs[n];
+		g.code = data.codes[n];
+		g.info = data.index[n];
+		if (!data.decode((PFontUInt32)n, g.image)) {
+			std::fill(g.image.begin(), g.image.end(), 0);
+			++failed;
+		}
+	});
+	return failed;
+}
+
+// グリフ列をフォントファイルとして保存する（圧縮は並列に行う）
+// dedup : 圧縮後のイメージが同一のグリフはイメージを共有する
+// 格納形式の選択は saver.packed / saver.levels に従う
+template <class Saver>
+void PFontSaveGlyphs(Saver &saver, std::vector<PFontGlyph> &glyphs, bool dedup, int threads)
+{
+	typedef PFontUInt32 SizeType;
+	std::stable_sort(glyphs.begin(), glyphs.end(), [](const PFontGlyph &a, const PFontGlyph &b) { return a.code < b.code; });
+	const PFontUInt32 count = (PFontUInt32)glyphs.size();
+	if (!count) saver.error("empty characters");
+	for (PFontUInt32 i = 1; i < count; i++) if (glyphs[i-1].code == glyphs[i].code) saver.error("duplicated character");
+
+	std::vector<std::vector<PFontUInt8> > blobs(count);
+	const bool packed = saver.packed;
+	const int  levels = saver.levels;
+	PFontParallelFor(count, threads, [&](size_t n) {
+		PFontGlyph &g = glyphs[n];
+		PFontUInt16 mode = PFontMode65;
+		size_t size = (size_t)g.info.width * g.info.height;
+		if (size && g.image.size() >= size) {
+			if (levels) PFontQuantize(&g.image.front(), size, levels);
+			blobs[n].resize(size);
+			blobs[n].resize(PFontEncodeGlyph(&g.image.front(), size, &blobs[n].front(), packed, mode));
+		}
+		g.info.reserved = (PFontUInt16)((g.info.reserved & ~PFontModeMask) | mode);
+	});
+	for (PFontUInt32 i = 0; i < count; i++) if (glyphs[i].info.reserved & PFontModeMask) saver.packedUsed = true;
+
+	std::map<std::vector<PFontUInt8>, PFontUInt32> shared;
+	for (PFontUInt32 i = 0; i < count; i++) {
+		PFontIndex &info = glyphs[i].info;
+		info.offset = saver.getPos();
+		if (blobs[i].empty()) continue;
+		if (dedup) {
+			std::map<std::vector<PFontUInt8>, PFontUInt32>::const_iterator it = shared.find(blobs[i]);
+			if (it != shared.end()) {
+				info.offset = it->second;
+				continue;
+			}
+			shared[blobs[i]] = info.offset;
+		}
+		saver.write(&blobs[i].front(), (SizeType)blobs[i].size());
+	}
+
+	SizeType padding = 0;
+	SizeType chindexpos = saver.align(padding);
+	for (PFontUInt32 i = 0; i < count; i++) saver.write(&glyphs[i].code, 2);
+	SizeType indexpos = saver.align(padding);
+	for (PFontUInt32 i = 0; i < count; i++) saver.write(&glyphs[i].info, (SizeType)sizeof(PFontIndex));
+	saver.writeHeader(count, chindexpos, indexpos);
+}
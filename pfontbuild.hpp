@@ -0,0 +1,464 @@
+#pragma once
+
+// レンダリング済みフォントの一括作成（プラットフォーム非依存部）
+//
+// マニフェスト（UTF-8 テキスト，1行1ターゲット，タブ区切り，# で始まる行はコメント）:
+//   output  face  size  flags  charset
+//
+//   output  : 出力ファイル
+//   face    : フォント名（解釈はグリフ供給元による）
+//             *.ttf / *.otf / *.ttc / *.otc ならフォントファイル（コレクションの面は file.ttc#1 のように指定）
+//   size    : 文字の高さ(pixel)
+//   flags   : bold / italic / packed / mono / gray4 / gray16 / outline を + で連結（なしは -）
+//             packed は格納形式の選択，mono / gray4 / gray16 は段階数を丸めたうえで選択する
+//             outline はフォント名の指定でも pfontraster.hpp の描画を使う（フォントファイルは常にこの描画）
+//   charset : 空白またはカンマ区切りの文字セット指定（和集合）
+//             U+XXXX-U+YYYY  コード範囲
+//             U+XXXX         1文字
+//             それ以外        テキストファイル（使用されている文字）
+//
+// 文字セットは同じ指定のターゲット間で共有され，ファイルの読み込みも1回だけ行われる
+// 各ターゲットはスレッドプールで並列に作成され，結果はメモリ上に保持される
+// （ファイルへの書き出しと進捗の通知は呼び出し側のスレッドで行う）
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <stdexcept>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+#include "pfont.hpp"
+#include "pfontraster.hpp"
+
+enum PFontBuildFlags {
+	PFontBold    = 0x01,
+	PFontItalic  = 0x02,
+	PFontPacked  = 0x04, // 格納形式を選択する（PFontImageMode）
+	PFontMono    = 0x08, // 2段階に丸めて格納形式を選択する
+	PFontGray4   = 0x10, // 4段階に丸めて格納形式を選択する
+	PFontGray16  = 0x20, // 16段階に丸めて格納形式を選択する
+	PFontOutline = 0x40, // プラットフォーム非依存の描画を使う
+};
+
+//--------------------------------------------------------------
+// ファイル操作クラス（メモリ）
+
+struct PFontMemoryStream
+{
+	PFontMemoryStream(std::vector<PFontUInt8> *buffer, unsigned int flags) : buffer(buffer), pos(0) {
+		if (flags == PFontWrite) buffer->clear();
+	}
+
+	void error(const char *message) const {
+		throw std::runtime_error(message);
+	}
+
+	typedef PFontUInt32 SizeType;
+
+	void write(void const *buf, SizeType length) {
+		if (pos + length > buffer->size()) buffer->resize(pos + length);
+		if (length) memcpy(&(*buffer)[pos], buf, length);
+		pos += length;
+	}
+	void read(void *buf, SizeType length) {
+		if (pos + length > buffer->size()) error("can't read storage");
+		if (length) memcpy(buf, &(*buffer)[pos], length);
+		pos += length;
+	}
+	void seek(SizeType p) { pos = p; }
+	SizeType getPos() const { return pos; }
+	SizeType getSize() const { return (SizeType)buffer->size(); }
+
+private:
+	std::vector<PFontUInt8> *buffer;
+	SizeType pos;
+};
+
+//--------------------------------------------------------------
+// テキストの使用文字（UTF-8，BOM付きなら UTF-16LE も可，制御文字は除く）
+
+inline void PFontAddTextChars(PFontCharSet &chars, const std::string &text)
+{
+	const PFontUInt8 *p = (const PFontUInt8*)text.data(), *end = p + text.size();
+	if (text.size() >= 2 && p[0] == 0xFF && p[1] == 0xFE) {
+		for (p += 2; p + 1 < end; p += 2) {
+			PFontUInt16 ch = (PFontUInt16)(p[0] | (p[1] << 8));
+			if (ch >= 0x20 && (ch < 0xD800 || ch >= 0xE000)) chars.add(ch);
+		}
+		return;
+	}
+	if (text.size() >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF) p += 3;
+	while (p < end) {
+		PFontUInt32 ch = *p++;
+		int follow = (ch >= 0xF0) ? 3 : (ch >= 0xE0) ? 2 : (ch >= 0xC0) ? 1 : 0;
+		if (follow) ch &= 0x3F >> follow;
+		for (; follow > 0 && p < end; follow--) ch = (ch << 6) | (*p++ & 0x3F);
+		if (ch >= 0x20 && ch < 0x10000 && (ch < 0xD800 || ch >= 0xE000)) chars.add((PFontUInt16)ch);
+	}
+}
+
+//--------------------------------------------------------------
+// グリフ供給元
+
+class PFontGlyphSource
+{
+public:
+	virtual ~PFontGlyphSource() {}
+
+	// glyph.info（offset 以外）と glyph.image（0〜64，width*height）を設定する
+	// @return false なら文字を出力しない
+	virtual bool render(PFontUInt16 ch, PFontGlyph &glyph) = 0;
+};
+
+// 動作確認用の合成グリフ（フォントを使わずに決まった形を生成する）
+class PFontSyntheticSource : public PFontGlyphSource
+{
+	int size;
+	unsigned int flags;
+public:
+	PFontSyntheticSource(int size, unsigned int flags) : size(size > 2 ? size : 2), flags(flags) {}
+
+	bool render(PFontUInt16 ch, PFontGlyph &glyph) {
+		const int ascent = size * 7 / 8;
+		const int inc = (ch < 0x100) ? (size + 1) / 2 : size;
+		PFontIndex &info = glyph.info;
+		memset(&info, 0, sizeof(info));
+		info.inc_x = info.inc = (PFontInt16)inc;
+		glyph.image.clear();
+		if (ch == 0x20 || ch == 0x3000) return true;
+
+		const int slant = (flags & PFontItalic) ? size / 4 : 0;
+		const int w = inc - 1 + ((flags & PFontBold) ? 1 : 0) + slant;
+		const int h = ascent;
+		if (w <= 0 || h <= 0) return true;
+		info.width    = (PFontUInt16)w;
+		info.height   = (PFontUInt16)h;
+		info.origin_x = 0;
+		info.origin_y = (PFontInt16)ascent;
+		glyph.image.assign((size_t)w * h, 0);
+
+		// 枠＋コードで決まる縞模様（縁は中間値）
+		const int bw = w - slant;
+		for (int y = 0; y < h; y++) {
+			const int shift = slant ? slant * (h - 1 - y) / (h > 1 ? h - 1 : 1) : 0;
+			PFontUInt8 *line = &glyph.image[(size_t)y * w + shift];
+			for (int x = 0; x < bw; x++) {
+				bool edge = (x == 0 || y == 0 || x == bw - 1 || y == h - 1);
+				line[x] = edge ? 64 : (((x + y + ch) % 4) == 0) ? 32 : (((ch >> (y % 16)) & 1) ? 16 : 0);
+			}
+		}
+		return true;
+	}
+};
+
+// フォントファイルのグリフ（プラットフォーム非依存の描画，font はターゲット間で共有できる）
+class PFontOutlineSource : public PFontGlyphSource
+{
+	std::shared_ptr<const PFontOutlineFont> font;
+	int size;
+	unsigned int flags;
+public:
+	PFontOutlineSource(std::shared_ptr<const PFontOutlineFont> font, int size, unsigned int flags) : font(font), size(size), flags(flags) {}
+
+	bool render(PFontUInt16 ch, PFontGlyph &glyph) {
+		PFontUInt32 gid = font->getGlyphIndex(ch);
+		if (!gid) return false; // フォントに無い文字は出力しない
+		return PFontRenderOutline(*font, gid, size, (flags & PFontBold) != 0, (flags & PFontItalic) != 0, glyph);
+	}
+};
+
+// face がフォントファイルの指定なら path と面番号に分解する
+inline bool PFontParseFontFile(const std::string &face, std::string &path, int &index)
+{
+	path = face;
+	index = 0;
+	size_t sharp = face.rfind('#');
+	if (sharp != std::string::npos && sharp + 1 < face.size() && face.find_first_not_of("0123456789", sharp + 1) == std::string::npos) {
+		path  = face.substr(0, sharp);
+		index = atoi(face.c_str() + sharp + 1);
+	}
+	size_t dot = path.rfind('.');
+	if (dot == std::string::npos) return false;
+	std::string ext = path.substr(dot + 1);
+	for (size_t i = 0; i < ext.size(); i++) if (ext[i] >= 'A' && ext[i] <= 'Z') ext[i] += 'a' - 'A';
+	return ext == "ttf" || ext == "otf" || ext == "ttc" || ext == "otc";
+}
+
+//--------------------------------------------------------------
+// 作成ターゲット
+
+struct PFontBuildTarget
+{
+	std::string output;
+	std::string face;
+	int size;
+	unsigned int flags;
+	std::string charset;        // 文字セット指定（正規化済み，共有のキー）
+	const PFontCharSet *chars;  // 共有された文字セット
+	std::string key;            // ビルドキャッシュのキー（pfontcache.hpp）
+	bool cached;                // キャッシュから取得済み（作成しない）
+
+	// 作成結果
+	std::vector<PFontUInt8> file;
+	std::string error;
+	PFontUInt32 glyphs;
+
+	PFontBuildTarget() : size(0), flags(0), chars(0), cached(false), glyphs(0) {}
+};
+
+//--------------------------------------------------------------
+// マニフェスト
+
+class PFontManifest
+{
+public:
+	std::vector<PFontBuildTarget> targets;
+
+	// @return 書式エラーなら false（error にメッセージ）
+	bool parse(const std::string &text, std::string &error) {
+		targets.clear();
+		size_t lineno = 0;
+		for (size_t pos = 0; pos < text.size();) {
+			size_t eol = text.find('\n', pos);
+			if (eol == std::string::npos) eol = text.size();
+			std::string line = text.substr(pos, eol - pos);
+			pos = eol + 1;
+			lineno++;
+			if (lineno == 1 && line.compare(0, 3, "\xEF\xBB\xBF") == 0) line.erase(0, 3);
+			if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+			if (line.find_first_not_of(" \t") == std::string::npos || line[0] == '#') continue;
+
+			std::vector<std::string> fields;
+			split(line, "\t", fields);
+			if (fields.size() < 5) return lineError(error, lineno, "too few fields");
+
+			PFontBuildTarget t;
+			t.output = fields[0];
+			t.face   = fields[1];
+			t.size   = atoi(fields[2].c_str());
+			if (t.output.empty() || t.face.empty()) return lineError(error, lineno, "empty output or face");
+			if (t.size <= 0 || t.size > 0x7FFF) return lineError(error, lineno, "invalid size");
+
+			std::vector<std::string> flags;
+			split(fields[3], "+, ", flags);
+			for (size_t i = 0; i < flags.size(); i++) {
+				if      (flags[i] == "bold")   t.flags |= PFontBold;
+				else if (flags[i] == "italic") t.flags |= PFontItalic;
+				else if (flags[i] == "packed") t.flags |= PFontPacked;
+				else if (flags[i] == "mono")   t.flags |= PFontMono;
+				else if (flags[i] == "gray4")  t.flags |= PFontGray4;
+				else if (flags[i] == "gray16") t.flags |= PFontGray16;
+				else if (flags[i] == "outline") t.flags |= PFontOutline;
+				else if (flags[i] != "-") return lineError(error, lineno, "unknown flag");
+			}
+
+			std::vector<std::string> sources;
+			for (size_t i = 4; i < fields.size(); i++) split(fields[i], ", ", sources);
+			if (sources.empty()) return lineError(error, lineno, "empty charset");
+			for (size_t i = 0; i < sources.size(); i++) t.charset += (i ? " " : "") + sources[i];
+			targets.push_back(t);
+		}
+		return true;
+	}
+
+	// 文字セットを解決する
+	// load(const std::string &name, PFontCharSet &chars) : テキストファイルの使用文字を追加（失敗なら false）
+	template <class Loader>
+	bool resolve(Loader load, std::string &error) {
+		for (size_t i = 0; i < targets.size(); i++) {
+			PFontBuildTarget &t = targets[i];
+			std::map<std::string, PFontCharSet>::iterator it = charsets.find(t.charset);
+			if (it == charsets.end()) {
+				PFontCharSet chars;
+				std::vector<std::string> sources;
+				split(t.charset, " ", sources);
+				for (size_t j = 0; j < sources.size(); j++) {
+					if (!addSource(chars, sources[j], load)) {
+						error = "can't read charset:" + sources[j];
+						return false;
+					}
+				}
+				it = charsets.insert(std::make_pair(t.charset, chars)).first;
+			}
+			t.chars = &it->second;
+		}
+		return true;
+	}
+
+	size_t getCharSetCount() const { return charsets.size(); }
+
+private:
+	std::map<std::string, PFontCharSet> charsets; // 指定ごとの文字セット
+	std::map<std::string, PFontCharSet> files;    // 読み込んだファイルごとの文字セット
+
+	static void split(const std::string &str, const char *delims, std::vector<std::string> &out) {
+		for (size_t pos = 0; pos <= str.size();) {
+			size_t end = str.find_first_of(delims, pos);
+			if (end == std::string::npos) end = str.size();
+			if (end > pos) out.push_back(str.substr(pos, end - pos));
+			pos = end + 1;
+		}
+	}
+	static bool lineError(std::string &error, size_t lineno, const char *message) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "manifest line %u: ", (unsigned)lineno);
+		error = std::string(buf) + message;
+		return false;
+	}
+	static long parseCode(const std::string &str, size_t &pos) {
+		if (str.compare(pos, 2, "U+") == 0 || str.compare(pos, 2, "u+") == 0) pos += 2;
+		const char *begin = str.c_str() + pos;
+		char *end = 0;
+		long ch = strtol(begin, &end, 16);
+		if (end == begin || ch < 0 || ch > 0xFFFF) return -1;
+		pos += end - begin;
+		return ch;
+	}
+
+	template <class Loader>
+	bool addSource(PFontCharSet &chars, const std::string &source, Loader &load) {
+		if (source.compare(0, 2, "U+") == 0 || source.compare(0, 2, "u+") == 0) {
+			size_t pos = 0;
+			long first = parseCode(source, pos), last = first;
+			if (first >= 0 && pos < source.size() && source[pos] == '-') last = parseCode(source, ++pos);
+			if (first < 0 || last < first || pos != source.size()) return false;
+			for (long ch = first; ch <= last; ch++) chars.add((PFontUInt16)ch);
+			return true;
+		}
+		std::map<std::string, PFontCharSet>::iterator it = files.find(source);
+		if (it == files.end()) {
+			PFontCharSet loaded;
+			if (!load(source, loaded)) return false;
+			it = files.insert(std::make_pair(source, loaded)).first;
+		}
+		chars.merge(it->second);
+		return true;
+	}
+};
+
+//--------------------------------------------------------------
+// 並列作成
+//
+// 各ターゲットをスレッドプールで作成し，進捗を呼び出し側スレッドに通知する
+//   PFontBuilder builder(manifest.targets, factory, threads);
+//   builder.start();
+//   PFontBuildEvent ev;
+//   while (builder.wait(ev)) { ...進捗表示，finished なら targets[ev.target] を書き出し... }
+// 1つのターゲットの失敗（例外）は target.error に記録され，他のターゲットは続行される
+// cached が設定されたターゲットは作成せずに完了を通知する
+
+struct PFontBuildEvent
+{
+	size_t      target;
+	PFontUInt32 done, total; // 処理済み文字数／全文字数
+	bool        finished;
+};
+
+class PFontBuilder
+{
+public:
+	// ターゲットごとにグリフ供給元を作成する（作業スレッドから呼ばれる，NULL ならエラー）
+	typedef std::function<PFontGlyphSource*(const PFontBuildTarget&)> SourceFactory;
+
+	PFontBuilder(std::vector<PFontBuildTarget> &targets, SourceFactory factory, int threads)
+		: targets(targets), factory(factory), threads(threads), running(false) {}
+
+	~PFontBuilder() {
+		if (thread.joinable()) thread.join();
+	}
+
+	void start() {
+		running = true;
+		thread = std::thread([this]() {
+			// 文字数×サイズ^2 の大きい順に割り当てる
+			std::vector<double> cost(targets.size());
+			for (size_t i = 0; i < targets.size(); i++) {
+				std::vector<PFontUInt16> codes;
+				if (targets[i].chars && !targets[i].cached) targets[i].chars->getCodes(codes);
+				cost[i] = (double)codes.size() * targets[i].size * targets[i].size;
+			}
+			std::vector<PFontUInt32> order;
+			PFontSortByCost(cost, order);
+			PFontParallelFor(order.size(), threads, [&](size_t k) { build(order[k]); });
+
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+			cond.notify_all();
+		});
+	}
+
+	// 次の進捗を待つ
+	// @return 全ターゲットが終了して通知が残っていなければ false
+	bool wait(PFontBuildEvent &ev) {
+		std::unique_lock<std::mutex> lock(mutex);
+		cond.wait(lock, [this]() { return !events.empty() || !running; });
+		if (events.empty()) return false;
+		ev = events.front();
+		events.pop_front();
+		return true;
+	}
+
+private:
+	enum { ProgressInterval = 256 };
+
+	std::vector<PFontBuildTarget> &targets;
+	SourceFactory factory;
+	int threads;
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::deque<PFontBuildEvent> events;
+	bool running;
+
+	void post(size_t target, PFontUInt32 done, PFontUInt32 total, bool finished) {
+		PFontBuildEvent ev = { target, done, total, finished };
+		std::lock_guard<std::mutex> lock(mutex);
+		events.push_back(ev);
+		cond.notify_all();
+	}
+
+	void build(size_t n) {
+		PFontBuildTarget &t = targets[n];
+		std::vector<PFontUInt16> codes;
+		if (t.chars) t.chars->getCodes(codes);
+		const PFontUInt32 total = (PFontUInt32)codes.size();
+		if (t.cached) {
+			post(n, total, total, true);
+			return;
+		}
+		try {
+			std::unique_ptr<PFontGlyphSource> source(factory(t));
+			if (!source) throw std::runtime_error("no glyph source:" + t.face);
+
+			std::vector<PFontGlyph> glyphs;
+			glyphs.reserve(total);
+			for (PFontUInt32 i = 0; i < total; i++) {
+				PFontGlyph g;
+				g.code = codes[i];
+				memset(&g.info, 0, sizeof(g.info));
+				if (source->render(codes[i], g)) {
+					if (g.image.size() < (size_t)g.info.width * g.info.height) throw std::runtime_error("invalid glyph image");
+					glyphs.push_back(g);
+				}
+				if ((i + 1) % ProgressInterval == 0) post(n, i + 1, total, false);
+			}
+			PFontSaverT<PFontMemoryStream> saver(&t.file);
+			saver.packed = (t.flags & (PFontPacked | PFontMono | PFontGray4 | PFontGray16)) != 0;
+			saver.levels = (t.flags & PFontMono) ? 2 : (t.flags & PFontGray4) ? 4 : (t.flags & PFontGray16) ? 16 : 0;
+			PFontSaveGlyphs(saver, glyphs, false, 1);
+			t.glyphs = (PFontUInt32)glyphs.size();
+		} catch (std::exception &e) {
+			t.error = e.what();
+			t.file.clear();
+		} catch (...) {
+			t.error = "unknown error";
+			t.file.clear();
+		}
+		post(n, total, total, true);
+	}
+};
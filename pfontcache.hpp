@@ -0,0 +1,73 @@
+#pragma once
+
+// レンダリング済みフォントのビルドキャッシュ（プラットフォーム非依存部）
+//
+// フォントファイルの内容・レンダリングパラメータ・文字セット・フォーマットの版から
+// キーを計算し，キャッシュディレクトリの <key>.tft として作成済みのファイルを保持する
+// （ファイルのコピー／ハードリンクはプラットフォームごとの呼び出し側で行う）
+
+#include <string>
+#include <cstdio>
+
+#include "pfont.hpp"
+
+// キャッシュの版（出力内容が変わる変更をしたら上げること）
+static const PFontUInt32 PFontCacheVersion = 1;
+
+//--------------------------------------------------------------
+// FNV-1a 64bit
+
+struct PFontHash64
+{
+	PFontUInt64 value;
+	PFontHash64() : value(14695981039346656037ULL) {}
+
+	void add(const void *data, size_t len) {
+		const PFontUInt8 *p = (const PFontUInt8*)data;
+		PFontUInt64 h = value;
+		for (size_t i = 0; i < len; i++) {
+			h ^= p[i];
+			h *= 1099511628211ULL;
+		}
+		value = h;
+	}
+	void add(PFontUInt32 v) { add(&v, sizeof(v)); }
+	void add(PFontUInt64 v) { add(&v, sizeof(v)); }
+	// 長さ付きで追加する（連結による衝突を避ける）
+	void add(const std::string &str) {
+		add((PFontUInt32)str.size());
+		add(str.data(), str.size());
+	}
+
+	std::string hex() const {
+		char buf[20];
+		snprintf(buf, sizeof(buf), "%016llx", value);
+		return buf;
+	}
+};
+
+//--------------------------------------------------------------
+// キャッシュキー
+//
+// font   : フォントファイル内容のハッシュ
+// params : レンダリングに影響する設定を文字列化したもの（サイズ・太字・レンダラの設定など）
+
+inline std::string PFontCacheKey(PFontUInt64 font, const std::string &params, const PFontCharSet &chars)
+{
+	std::vector<PFontUInt16> codes;
+	chars.getCodes(codes);
+	PFontHash64 h;
+	h.add(PFontHeaderText, PFontHeaderLength);
+	h.add(PFontCacheVersion);
+	h.add(font);
+	h.add(params);
+	h.add((PFontUInt32)codes.size());
+	if (!codes.empty()) h.add(&codes.front(), codes.size() * sizeof(PFontUInt16));
+	return h.hex();
+}
+
+// キャッシュディレクトリ内のファイル名
+inline std::string PFontCacheFileName(const std::string &key)
+{
+	return key + ".tft";
+}
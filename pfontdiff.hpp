@@ -0,0 +1,195 @@
+#pragma once
+
+// レンダリング済みフォントの比較（プラットフォーム非依存部）
+//
+// 2つのフォントデータのコード表を突き合わせ，メトリクスと圧縮イメージが同一のグリフは展開せずに一致とみなす
+// それ以外のグリフのみ展開し，原点をそろえた比較領域で差の最大値・平均値を求める（並列処理）
+
+#include "pfont.hpp"
+
+enum PFontDiffStatus {
+	PFontDiffAdded   = 0x01, // 比較先(b)のみにある
+	PFontDiffRemoved = 0x02, // 比較元(a)のみにある
+	PFontDiffMetrics = 0x04, // メトリクス（blackbox/origin/inc）が異なる
+	PFontDiffImage   = 0x08, // イメージが異なる
+	PFontDiffError   = 0x10, // イメージの展開に失敗した
+};
+
+struct PFontGlyphDiff
+{
+	PFontUInt16 code;
+	PFontUInt32 status;     // PFontDiffStatus の組み合わせ
+	long        a, b;       // それぞれのグリフ番号（無ければ -1）
+	int         maxError;   // 差の最大値（0〜64）
+	double      meanError;  // 比較領域の画素あたりの差の平均（0〜64）
+	PFontUInt32 pixels;     // 差のある画素数
+
+	// 比較領域（ペン位置基準，top はベースラインから上向き）と差分画像（images 指定時のみ，|a-b| の 0〜64）
+	int left, top, width, height;
+	std::vector<PFontUInt8> image;
+
+	PFontGlyphDiff() : code(0), status(0), a(-1), b(-1), maxError(0), meanError(0), pixels(0), left(0), top(0), width(0), height(0) {}
+};
+
+//--------------------------------------------------------------
+// |a-b| を out に書き出して最大値・合計・0以外の画素数を求める
+
+inline void PFontAbsDiff(const PFontUInt8 *a, const PFontUInt8 *b, size_t n, PFontUInt8 *out,
+						 int &maxv, PFontUInt32 &sum, PFontUInt32 &count)
+{
+	size_t i = 0;
+	PFontUInt32 mx = 0, total = 0, nonzero = 0;
+#ifdef PFONT_USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one  = _mm_set1_epi8(1);
+	__m128i vmax = zero, vsum = zero, vcnt = zero;
+	for (; i + 16 <= n; i += 16) {
+		const __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+		const __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+		const __m128i d  = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+		_mm_storeu_si128((__m128i*)(out + i), d);
+		vmax = _mm_max_epu8(vmax, d);
+		vsum = _mm_add_epi64(vsum, _mm_sad_epu8(d, zero));
+		vcnt = _mm_add_epi64(vcnt, _mm_sad_epu8(_mm_min_epu8(d, one), zero));
+	}
+	PFontUInt8 lanes[16];
+	_mm_storeu_si128((__m128i*)lanes, vmax);
+	for (int k = 0; k < 16; k++) if (mx < lanes[k]) mx = lanes[k];
+	total   = (PFontUInt32)(_mm_cvtsi128_si32(vsum) + _mm_cvtsi128_si32(_mm_srli_si128(vsum, 8)));
+	nonzero = (PFontUInt32)(_mm_cvtsi128_si32(vcnt) + _mm_cvtsi128_si32(_mm_srli_si128(vcnt, 8)));
+#endif
+	for (; i < n; i++) {
+		const PFontUInt32 d = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+		out[i] = (PFontUInt8)d;
+		if (mx < d) mx = d;
+		total += d;
+		if (d) nonzero++;
+	}
+	maxv  = (int)mx;
+	sum   = total;
+	count = nonzero;
+}
+
+//--------------------------------------------------------------
+// 2つのフォントデータを比較する
+//
+// diffs  : 一致しなかったグリフ（コード順）
+// images : 差分画像を残す
+// @return 一致したグリフ数
+
+inline PFontUInt32 PFontDiffData(const PFontData &a, const PFontData &b, std::vector<PFontGlyphDiff> &diffs, bool images, int threads)
+{
+	std::vector<PFontUInt32> asizes, bsizes;
+	a.getImageSizes(asizes);
+	b.getImageSizes(bsizes);
+
+	// コード表の突き合わせ（どちらも昇順）
+	diffs.clear();
+	std::vector<PFontUInt32> compare; // 展開して比較する diffs の番号
+	PFontUInt32 same = 0, i = 0, j = 0;
+	while (i < a.count || j < b.count) {
+		PFontGlyphDiff d;
+		if (j >= b.count || (i < a.count && a.codes[i] < b.codes[j])) {
+			d.code = a.codes[i];
+			d.a = i++;
+			d.status = PFontDiffRemoved;
+			diffs.push_back(d);
+			continue;
+		}
+		if (i >= a.count || b.codes[j] < a.codes[i]) {
+			d.code = b.codes[j];
+			d.b = j++;
+			d.status = PFontDiffAdded;
+			diffs.push_back(d);
+			continue;
+		}
+		d.code = a.codes[i];
+		d.a = i;
+		d.b = j;
+		const PFontIndex &ia = a.index[i], &ib = b.index[j];
+		if (ia.width != ib.width || ia.height != ib.height || ia.origin_x != ib.origin_x || ia.origin_y != ib.origin_y ||
+			ia.inc_x != ib.inc_x || ia.inc_y != ib.inc_y || ia.inc != ib.inc) d.status |= PFontDiffMetrics;
+
+		// 同じ大きさ・格納形式で圧縮イメージが同一なら展開しない
+		bool identical = false;
+		if (ia.width == ib.width && ia.height == ib.height && (ia.reserved & PFontModeMask) == (ib.reserved & PFontModeMask)) {
+			const PFontUInt8 *pa = 0, *pb = 0;
+			size_t la = 0, lb = 0;
+			identical = !ia.width || !ia.height ||
+				(asizes[i] == bsizes[j] && a.getImage(i, pa, la) && b.getImage(j, pb, lb) &&
+				 la >= asizes[i] && lb >= bsizes[j] && !memcmp(pa, pb, asizes[i]));
+		}
+		i++, j++;
+		if (identical && !d.status) {
+			same++;
+			continue;
+		}
+		compare.push_back((PFontUInt32)diffs.size()); // メトリクスのみの違いもペン位置基準で比較する
+		diffs.push_back(d);
+	}
+
+	// 異なるグリフのみ展開して比較する（大きい順に割り当てる）
+	std::vector<PFontUInt32> cost(compare.size()), order;
+	for (size_t k = 0; k < compare.size(); k++) {
+		const PFontGlyphDiff &d = diffs[compare[k]];
+		cost[k] = (PFontUInt32)a.index[d.a].width * a.index[d.a].height + (PFontUInt32)b.index[d.b].width * b.index[d.b].height;
+	}
+	PFontSortByCost(cost, order);
+	PFontParallelFor(order.size(), threads, [&](size_t k) {
+		PFontGlyphDiff &d = diffs[compare[order[k]]];
+		const PFontIndex &ia = a.index[d.a], &ib = b.index[d.b];
+		std::vector<PFontUInt8> ga, gb;
+		if (!a.decode((PFontUInt32)d.a, ga) || !b.decode((PFontUInt32)d.b, gb)) {
+			d.status |= PFontDiffError;
+			return;
+		}
+		// 原点をそろえた比較領域（空のグリフは含めない）
+		bool first = true;
+		int left = 0, top = 0, right = 0, bottom = 0;
+		const PFontIndex *idx[2] = { &ia, &ib };
+		for (int n = 0; n < 2; n++) {
+			const PFontIndex &g = *idx[n];
+			if (!g.width || !g.height) continue;
+			const int l = g.origin_x, t = g.origin_y, r = l + g.width, btm = t - g.height;
+			if (first || l < left)  left = l;
+			if (first || t > top)   top = t;
+			if (first || r > right) right = r;
+			if (first || btm < bottom) bottom = btm;
+			first = false;
+		}
+		if (first) return; // どちらも空
+		d.left   = left;
+		d.top    = top;
+		d.width  = right - left;
+		d.height = top - bottom;
+		const size_t size = (size_t)d.width * d.height;
+		std::vector<PFontUInt8> ca(size, 0), cb(size, 0);
+		const std::vector<PFontUInt8> *src[2] = { &ga, &gb };
+		std::vector<PFontUInt8> *dst[2] = { &ca, &cb };
+		for (int n = 0; n < 2; n++) {
+			const PFontIndex &g = *idx[n];
+			if (!g.width || !g.height) continue;
+			const int ox = g.origin_x - left, oy = top - g.origin_y;
+			for (int y = 0; y < g.height; y++) memcpy(&(*dst[n])[(size_t)(oy + y) * d.width + ox], &(*src[n])[(size_t)y * g.width], g.width);
+		}
+		d.image.resize(size);
+		PFontUInt32 sum = 0;
+		PFontAbsDiff(&ca.front(), &cb.front(), size, &d.image.front(), d.maxError, sum, d.pixels);
+		d.meanError = (double)sum / size;
+		if (d.maxError) d.status |= PFontDiffImage;
+		if (!images || !d.maxError) std::vector<PFontUInt8>().swap(d.image);
+	});
+
+	// 展開してみたら一致していたもの（圧縮結果だけが異なる）を除く
+	size_t out = 0;
+	for (size_t k = 0; k < diffs.size(); k++) {
+		if (!diffs[k].status) {
+			same++;
+			continue;
+		}
+		if (out != k) diffs[out] = std::move(diffs[k]);
+		out++;
+	}
+	diffs.resize(out);
+	return same;
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+// レンダリング済みフォントのグリフ加工（縁取り・影用の派生フォント作成：プラットフォーム非依存部）
+//
+// 元のフォントのグリフ（0〜64）に対して 膨張（縁取り）→ ぼかし → 位置ずらし（影）の順に処理する
+// blackbox は加工で広がった分だけ大きくなり（最後に値0の外周は切り詰める），origin_x/origin_y もそれに合わせてずらす
+// 送り幅（inc/inc_x/inc_y）は変えないので，元のフォントと同じペン位置で重ねて描画できる
+
+#include "pfont.hpp"
+
+struct PFontEffect
+{
+	int outline;          // 縁取りの半径（円形の膨張：0なら行わない）
+	int blur;             // ぼかしの半径（ガウスぼかし σ = blur/2：0なら行わない）
+	int offsetX, offsetY; // 位置ずらし（右・下が正）
+
+	PFontEffect() : outline(0), blur(0), offsetX(0), offsetY(0) {}
+	bool empty() const { return !outline && !blur && !offsetX && !offsetY; }
+};
+
+//--------------------------------------------------------------
+// 円形の膨張（グレースケール：半径 r の円内の最大値）
+//
+// 各行について幅 2k+1 の横方向の最大値を k=0〜r まで順に求めておき，
+// 出力の各行は上下 dy の行の幅 sqrt((r+0.5)^2-dy^2) の最大値をまとめる
+// out は (w+2r) x (h+2r)
+
+inline void PFontDilate(const PFontUInt8 *src, int w, int h, int r, std::vector<PFontUInt8> &out)
+{
+	const int ow = w + r * 2, oh = h + r * 2;
+	const int stride = ow + 2; // 左右に値0の1画素を置く
+	out.assign((size_t)ow * oh, 0);
+	if (w <= 0 || h <= 0) return;
+
+	// planes[k] : 幅 2k+1 の横方向の最大値（行 y，x は出力座標）
+	std::vector<PFontUInt8> planes((size_t)(r + 1) * stride * h, 0);
+	for (int y = 0; y < h; y++) memcpy(&planes[(size_t)y * stride + 1 + r], src + (size_t)y * w, w);
+	for (int k = 1; k <= r; k++) {
+		const PFontUInt8 *prev = &planes[(size_t)(k - 1) * stride * h];
+		PFontUInt8       *cur  = &planes[(size_t)k * stride * h];
+		for (int y = 0; y < h; y++) {
+			const PFontUInt8 *p = prev + (size_t)y * stride; // p[x], p[x+1], p[x+2] が出力 x の左・中央・右
+			PFontUInt8       *c = cur  + (size_t)y * stride + 1;
+			int x = 0;
+#ifdef PFONT_USE_SSE2
+			for (; x + 16 <= ow; x += 16) {
+				__m128i m = _mm_max_epu8(_mm_loadu_si128((const __m128i*)(p + x)), _mm_loadu_si128((const __m128i*)(p + x + 1)));
+				_mm_storeu_si128((__m128i*)(c + x), _mm_max_epu8(m, _mm_loadu_si128((const __m128i*)(p + x + 2))));
+			}
+#endif
+			for (; x < ow; x++) {
+				PFontUInt8 m = p[x] > p[x + 1] ? p[x] : p[x + 1];
+				c[x] = m > p[x + 2] ? m : p[x + 2];
+			}
+		}
+	}
+
+	std::vector<int> span(r * 2 + 1);
+	for (int dy = -r; dy <= r; dy++) span[dy + r] = (int)std::sqrt((r + 0.5) * (r + 0.5) - (double)dy * dy);
+	for (int oy = 0; oy < oh; oy++) {
+		PFontUInt8 *d = &out[(size_t)oy * ow];
+		for (int dy = -r; dy <= r; dy++) {
+			const int sy = oy - r + dy;
+			if (sy < 0 || sy >= h) continue;
+			const PFontUInt8 *s = &planes[((size_t)span[dy + r] * h + sy) * stride + 1];
+			int x = 0;
+#ifdef PFONT_USE_SSE2
+			for (; x + 16 <= ow; x += 16)
+				_mm_storeu_si128((__m128i*)(d + x), _mm_max_epu8(_mm_loadu_si128((const __m128i*)(d + x)), _mm_loadu_si128((const __m128i*)(s + x))));
+#endif
+			for (; x < ow; x++) if (d[x] < s[x]) d[x] = s[x];
+		}
+	}
+}
+
+//--------------------------------------------------------------
+// ガウスぼかし（σ = r/2，±r で打ち切り）
+//
+// 重みは合計 256 の整数にして，横方向は 0〜64*256 の16bit，縦方向は32bitで積和する
+// out は (w+2r) x (h+2r)
+
+inline void PFontBlur(const PFontUInt8 *src, int w, int h, int r, std::vector<PFontUInt8> &out)
+{
+	const int ow = w + r * 2, oh = h + r * 2, taps = r * 2 + 1;
+	out.assign((size_t)ow * oh, 0);
+	if (w <= 0 || h <= 0) return;
+
+	std::vector<PFontInt16> weight(taps);
+	{
+		const double sigma = r / 2.0;
+		std::vector<double> g(taps);
+		double sum = 0;
+		for (int k = 0; k < taps; k++) sum += (g[k] = std::exp(-(double)(k - r) * (k - r) / (2 * sigma * sigma)));
+		int total = 0;
+		for (int k = 0; k < taps; k++) total += (weight[k] = (PFontInt16)(g[k] / sum * 256 + 0.5));
+		weight[r] += (PFontInt16)(256 - total);
+	}
+
+	// 横方向：行を左右に 2r ずつ値0で広げてから積和（出力 x は元の x - r を中心とする）
+	const int pw = w + r * 4;
+	std::vector<PFontUInt8> row(pw + 16, 0);
+	std::vector<PFontUInt16> tmp((size_t)ow * (h + r * 4), 0); // 上下に 2r 行の値0を置く
+	for (int y = 0; y < h; y++) {
+		memcpy(&row[r * 2], src + (size_t)y * w, w);
+		PFontUInt16 *t = &tmp[(size_t)(y + r * 2) * ow];
+		int x = 0;
+#ifdef PFONT_USE_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 8 <= ow; x += 8) {
+			__m128i acc = zero;
+			for (int k = 0; k < taps; k++) {
+				const __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&row[x + k]), zero);
+				acc = _mm_add_epi16(acc, _mm_mullo_epi16(v, _mm_set1_epi16(weight[k])));
+			}
+			_mm_storeu_si128((__m128i*)(t + x), acc);
+		}
+#endif
+		for (; x < ow; x++) {
+			int acc = 0;
+			for (int k = 0; k < taps; k++) acc += row[x + k] * weight[k];
+			t[x] = (PFontUInt16)acc;
+		}
+	}
+
+	// 縦方向：2行ずつ並べて pmaddwd で積和する
+	for (int y = 0; y < oh; y++) {
+		PFontUInt8 *d = &out[(size_t)y * ow];
+		const PFontUInt16 *base = &tmp[(size_t)y * ow]; // 出力 y は tmp の y〜y+2r 行
+		int x = 0;
+#ifdef PFONT_USE_SSE2
+		const __m128i zero  = _mm_setzero_si128();
+		const __m128i round = _mm_set1_epi32(0x8000);
+		for (; x + 8 <= ow; x += 8) {
+			__m128i lo = round, hi = round;
+			int k = 0;
+			for (; k + 2 <= taps; k += 2) {
+				const __m128i a  = _mm_loadu_si128((const __m128i*)(base + (size_t)k * ow + x));
+				const __m128i b  = _mm_loadu_si128((const __m128i*)(base + (size_t)(k + 1) * ow + x));
+				const __m128i wk = _mm_set1_epi32((int)(PFontUInt16)weight[k] | ((int)weight[k + 1] << 16));
+				lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wk));
+				hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wk));
+			}
+			if (k < taps) {
+				const __m128i a  = _mm_loadu_si128((const __m128i*)(base + (size_t)k * ow + x));
+				const __m128i wk = _mm_set1_epi32((int)(PFontUInt16)weight[k]);
+				lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), wk));
+				hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), wk));
+			}
+			const __m128i v = _mm_packs_epi32(_mm_srli_epi32(lo, 16), _mm_srli_epi32(hi, 16));
+			_mm_storel_epi64((__m128i*)(d + x), _mm_packus_epi16(v, zero));
+		}
+#endif
+		for (; x < ow; x++) {
+			int acc = 0x8000;
+			for (int k = 0; k < taps; k++) acc += base[(size_t)k * ow + x] * weight[k];
+			d[x] = (PFontUInt8)(acc >> 16);
+		}
+	}
+}
+
+//--------------------------------------------------------------
+// グリフへの適用
+
+inline void PFontApplyEffect(PFontGlyph &g, const PFontEffect &effect)
+{
+	if (!g.info.width || !g.info.height) return; // 空白文字はそのまま
+	std::vector<PFontUInt8> tmp;
+	const int passes[2] = { effect.outline, effect.blur };
+	for (int n = 0; n < 2; n++) {
+		const int r = passes[n];
+		if (r <= 0) continue;
+		if (n == 0) PFontDilate(&g.image.front(), g.info.width, g.info.height, r, tmp);
+		else        PFontBlur  (&g.image.front(), g.info.width, g.info.height, r, tmp);
+		g.image.swap(tmp);
+		g.info.width    = (PFontUInt16)(g.info.width  + r * 2);
+		g.info.height   = (PFontUInt16)(g.info.height + r * 2);
+		g.info.origin_x = (PFontInt16)(g.info.origin_x - r);
+		g.info.origin_y = (PFontInt16)(g.info.origin_y + r);
+	}
+	PFontCropGlyph(g);
+	if (!g.info.width) return;
+	g.info.origin_x = (PFontInt16)(g.info.origin_x + effect.offsetX);
+	g.info.origin_y = (PFontInt16)(g.info.origin_y - effect.offsetY);
+}
+
+// 全グリフに適用する（大きい順に並列処理）
+inline void PFontApplyEffects(std::vector<PFontGlyph> &glyphs, const PFontEffect &effect, int threads)
+{
+	std::vector<PFontUInt32> cost(glyphs.size()), order;
+	for (size_t i = 0; i < glyphs.size(); i++) cost[i] = (PFontUInt32)glyphs[i].info.width * glyphs[i].info.height;
+	PFontSortByCost(cost, order);
+	PFontParallelFor(order.size(), threads, [&](size_t k) {
+		PFontApplyEffect(glyphs[order[k]], effect);
+	});
+}
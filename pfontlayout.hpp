@@ -0,0 +1,184 @@
+#pragma once
+
+// レンダリング済みフォントのメトリクスによる文字列の計測と行分割（プラットフォーム非依存部）
+//
+// コード表とインデックスから 65536 要素の送り幅表を作り，文字列の幅は表引きの加算のみで求める
+// （送り幅は drawPreRenderedText と同じ inc，フォントに無い文字は 0）
+// 行分割では日本語の禁則処理（行頭禁則・行末禁則・分離禁止）と英数字の単語の分割禁止を行い，
+// 指定により句読点のぶら下げを行う。改行(\n)では必ず改行する
+
+#include "pfont.hpp"
+#include "pfontstack.hpp"
+
+struct PFontLine
+{
+	PFontUInt32 start, length; // 文字列中の位置（改行文字は含まない）
+	int width;
+};
+
+class PFontLayout
+{
+public:
+	enum CharClass {
+		Present = 0x01, // フォントにある
+		NoStart = 0x02, // 行頭禁則
+		NoEnd   = 0x04, // 行末禁則
+		Hang    = 0x08, // ぶら下げ可能
+		Word    = 0x10, // 英数字（単語の途中で分割しない）
+		Space   = 0x20, // 行末にはみ出しても幅に数えない
+		Chain   = 0x40, // 同じ文字どうしは分割しない（…‥―）
+	};
+
+	PFontLayout() : advance(0x10000, 0), classes(0x10000, 0) {
+		setupClasses();
+	}
+
+	void assign(const PFontData &data) {
+		std::fill(advance.begin(), advance.end(), 0);
+		for (size_t i = 0; i < classes.size(); i++) classes[i] &= ~Present;
+		for (PFontUInt32 i = 0; i < data.count; i++) {
+			advance[data.codes[i]] = data.index[i].inc;
+			classes[data.codes[i]] |= Present;
+		}
+	}
+	// 重ねたファイル（パッチのグリフを優先する）
+	void assign(const PFontStack &stack) {
+		std::fill(advance.begin(), advance.end(), 0);
+		for (size_t i = 0; i < classes.size(); i++) classes[i] &= ~Present;
+		for (PFontUInt32 n = 0; n < stack.count; n++) {
+			advance[stack.codes[n]] = stack.getIndex(n).inc;
+			classes[stack.codes[n]] |= Present;
+		}
+	}
+
+	bool has(PFontUInt16 ch) const { return (classes[ch] & Present) != 0; }
+	int getAdvance(PFontUInt16 ch) const { return advance[ch]; }
+
+	// 文字列の幅（複数行なら最も広い行の幅）
+	int measure(const PFontUInt16 *text, size_t len) const {
+		int width = 0, line = 0;
+		for (size_t i = 0; i < len; i++) {
+			if (text[i] == '\n') {
+				if (width < line) width = line;
+				line = 0;
+				continue;
+			}
+			line += advance[text[i]];
+		}
+		return width < line ? line : width;
+	}
+
+	// width に収まるように行に分割する
+	// hanging : 句読点のぶら下げ（行末に１文字だけはみ出してよい）
+	// @return 行数（lines が NULL なら数えるだけ）
+	size_t breakLines(const PFontUInt16 *text, size_t len, int width, bool hanging, std::vector<PFontLine> *lines) const {
+		if (lines) lines->clear();
+		size_t count = 0, pos = 0;
+		for (;;) {
+			const size_t start = pos;
+			size_t i = pos;
+			int w = 0;
+			for (; i < len && text[i] != '\n'; i++) {
+				const int a = advance[text[i]];
+				if (w + a > width && i > start) break;
+				w += a;
+			}
+			if (i >= len || text[i] == '\n') {
+				add(lines, start, i, w);
+				count++;
+				if (i >= len) break;
+				pos = i + 1;
+				continue;
+			}
+			size_t brk = findBreak(text, len, start, i, hanging);
+			add(lines, start, brk, lineWidth(text, start, brk));
+			count++;
+			pos = brk;
+			if (pos < len && text[pos] == '\n') pos++; // 行末のちょうど改行はその行の改行とする
+			else if (pos >= len) break;
+		}
+		return count;
+	}
+
+	// 複数の文字列の行数をまとめて求める（並列処理）
+	void countLines(const std::vector<std::vector<PFontUInt16> > &texts, int width, bool hanging,
+					std::vector<PFontUInt32> &counts, int threads) const {
+		counts.assign(texts.size(), 0);
+		std::vector<PFontUInt32> cost(texts.size()), order;
+		for (size_t i = 0; i < texts.size(); i++) cost[i] = (PFontUInt32)texts[i].size();
+		PFontSortByCost(cost, order);
+		PFontParallelFor(order.size(), threads, [&](size_t k) {
+			const std::vector<PFontUInt16> &t = texts[order[k]];
+			counts[order[k]] = (PFontUInt32)breakLines(t.empty() ? 0 : &t.front(), t.size(), width, hanging, 0);
+		});
+	}
+
+private:
+	std::vector<PFontInt16>  advance;
+	std::vector<PFontUInt8>  classes;
+
+	void setupClasses() {
+		static const char16_t noStart[] =
+			u"、。，．,.:;?!)]}）］｝」』】〕〉》〙〗〟’”｠»"
+			u"ヽヾゝゞ々〻ー‐゠–〜～？！：；・"
+			u"ぁぃぅぇぉっゃゅょゎゕゖァィゥェォッャュョヮヵヶ"
+			u"ㇰㇱㇲㇳㇴㇵㇶㇷㇸㇹㇺㇻㇼㇽㇾㇿ"
+			u"｡｣､･ｧｨｩｪｫｬｭｮｯｰﾞﾟ";
+		static const char16_t noEnd[] = u"([{（［｛「『【〔〈《〘〖〝‘“｟«｢";
+		static const char16_t hang[]  = u"、。，．,.､｡";
+		static const char16_t chain[] = u"…‥―—";
+		set(noStart, NoStart);
+		set(noEnd,   NoEnd);
+		set(hang,    Hang);
+		set(chain,   Chain);
+		for (PFontUInt32 ch = '0'; ch <= '9'; ch++) classes[ch] |= Word;
+		for (PFontUInt32 ch = 'A'; ch <= 'Z'; ch++) classes[ch] |= Word;
+		for (PFontUInt32 ch = 'a'; ch <= 'z'; ch++) classes[ch] |= Word;
+		for (PFontUInt32 ch = 0xC0; ch < 0x250; ch++) if (ch != 0xD7 && ch != 0xF7) classes[ch] |= Word;
+		classes['\''] |= Word;
+		classes[' ']  |= Space;
+	}
+	void set(const char16_t *chars, PFontUInt8 cls) {
+		for (; *chars; chars++) classes[(PFontUInt16)*chars] |= cls;
+	}
+
+	// k 番目の文字の前で改行できるか
+	bool canBreak(const PFontUInt16 *text, size_t k) const {
+		const PFontUInt8 prev = classes[text[k-1]], next = classes[text[k]];
+		if (next & NoStart) return false;
+		if (prev & NoEnd) return false;
+		if ((prev & Word) && (next & Word)) return false;
+		if ((prev & Chain) && text[k-1] == text[k]) return false;
+		return true;
+	}
+
+	// 幅を超えた文字 over の位置から改行位置を決める
+	size_t findBreak(const PFontUInt16 *text, size_t len, size_t start, size_t over, bool hanging) const {
+		// 行末の空白ははみ出してよい
+		size_t brk = over;
+		while (brk < len && (classes[text[brk]] & Space)) brk++;
+		if (brk > over) return brk;
+		// ぶら下げ（１文字だけ）
+		if (hanging && (classes[text[brk]] & Hang)) {
+			brk++;
+			if (brk >= len || canBreak(text, brk)) return brk;
+		}
+		// 追い出し（改行できる位置まで戻る：行頭まで戻ったら禁則を無視して分割する）
+		for (size_t k = over; k > start; k--) if (canBreak(text, k)) return k;
+		return over;
+	}
+
+	// 行の幅（行末の空白は数えない）
+	int lineWidth(const PFontUInt16 *text, size_t start, size_t end) const {
+		while (end > start && (classes[text[end-1]] & Space)) end--;
+		int w = 0;
+		for (size_t i = start; i < end; i++) w += advance[text[i]];
+		return w;
+	}
+
+	static void add(std::vector<PFontLine> *lines, size_t start, size_t end, int width) {
+		if (!lines) return;
+		PFontLine line = { (PFontUInt32)start, (PFontUInt32)(end - start), width };
+		lines->push_back(line);
+	}
+};
@@ -0,0 +1,913 @@
+#pragma once
+
+// アウトラインフォントの読み込みとラスタライズ（プラットフォーム非依存部）
+//
+// TrueType (glyf) / OpenType (CFF) のフォントファイルを直接解釈し，
+// 面積被覆率によるスキャンライン描画で 0〜64 のグリフイメージとメトリクスを生成する
+// GDI / DirectWrite を使わないので同じフォントファイルからはどの環境でも同じ結果になる
+// （ヒンティングは行わない／累積の加算順は SSE2 版と PFONT_NO_SIMD 版で同じにしてあり，ビルドによって結果は変わらない）
+//
+// 対応テーブル: head, hhea, maxp, hmtx, cmap(format 4/12), loca, glyf, CFF（CIDフォント含む）
+// TrueTypeコレクション（ttc/otc）は面番号で指定する
+
+#include <string>
+
+#include "pfont.hpp"
+
+//--------------------------------------------------------------
+// アウトライン（フォント単位，y は上向き）
+
+struct PFontPath
+{
+	enum Op { MoveTo, LineTo, QuadTo, CubicTo };
+	std::vector<PFontUInt8> ops;
+	std::vector<float>      pts; // 各操作の点（MoveTo/LineTo:1点，QuadTo:2点，CubicTo:3点）
+
+	void clear() { ops.clear(); pts.clear(); }
+	bool empty() const { return ops.empty(); }
+
+	void moveTo(float x, float y) { ops.push_back(MoveTo); add(x, y); }
+	void lineTo(float x, float y) { ops.push_back(LineTo); add(x, y); }
+	void quadTo(float cx, float cy, float x, float y) { ops.push_back(QuadTo); add(cx, cy); add(x, y); }
+	void cubicTo(float c1x, float c1y, float c2x, float c2y, float x, float y) {
+		ops.push_back(CubicTo); add(c1x, c1y); add(c2x, c2y); add(x, y);
+	}
+	// from 番目以降の点を変換する（複合グリフ用）
+	void transform(size_t from, float a, float b, float c, float d, float e, float f) {
+		for (size_t i = from; i + 1 < pts.size(); i += 2) {
+			float x = pts[i], y = pts[i+1];
+			pts[i]   = a * x + c * y + e;
+			pts[i+1] = b * x + d * y + f;
+		}
+	}
+private:
+	void add(float x, float y) { pts.push_back(x); pts.push_back(y); }
+};
+
+//--------------------------------------------------------------
+// フォントファイル
+
+class PFontOutlineFont
+{
+public:
+	PFontOutlineFont() : base(0), unitsPerEm(0), macStyle(0), ascender(0), descender(0), numGlyphs(0), numHMetrics(0), locFormat(0),
+		cmap(0), cmapFormat(0), hmtx(0), loca(0), glyf(0), glyfLength(0), cff(false), charStrings(0), fdSelect(0) {}
+
+	// フォントファイルを読み込む（data の内容は保持される）
+	// @return 対応していない形式なら false（error にメッセージ）
+	bool load(std::vector<PFontUInt8> &file, int face, std::string &error) {
+		data.swap(file);
+		if (!parse(face)) {
+			error = "unsupported font file";
+			return false;
+		}
+		return true;
+	}
+
+	// TrueTypeコレクションの面数（単体のフォントは1）
+	static int getFaceCount(const std::vector<PFontUInt8> &file) {
+		if (file.size() >= 12 && readTag(&file.front()) == tag("ttcf")) return (int)be32(&file.front() + 8);
+		return file.size() >= 12 ? 1 : 0;
+	}
+
+	// コレクション内で dir（面のテーブルディレクトリ）と一致する面番号（無ければ -1）
+	static int findFace(const std::vector<PFontUInt8> &file, const PFontUInt8 *dir, size_t len) {
+		const int count = getFaceCount(file);
+		if (file.size() < 12 || readTag(&file.front()) != tag("ttcf")) return count ? 0 : -1;
+		for (int i = 0; i < count; i++) {
+			if (12 + (size_t)i * 4 + 4 > file.size()) break;
+			size_t off = be32(&file.front() + 12 + i * 4);
+			if (off <= file.size() && len <= file.size() - off && !memcmp(&file.front() + off, dir, len)) return i;
+		}
+		return -1;
+	}
+
+	int getUnitsPerEm() const { return unitsPerEm; }
+	int getStyle()      const { return macStyle; } // head.macStyle（bit0:太字 bit1:斜体）
+	int getAscender()   const { return ascender; }
+	int getDescender()  const { return descender; }
+	int getGlyphCount() const { return numGlyphs; }
+
+	// 文字コードからグリフ番号（無ければ 0）
+	PFontUInt32 getGlyphIndex(PFontUInt32 code) const {
+		if (!cmap) return 0;
+		const PFontUInt8 *t = cmap;
+		if (cmapFormat == 4) {
+			if (code > 0xFFFF) return 0;
+			const PFontUInt32 segX2 = u16(t + 6);
+			const PFontUInt8 *ends = t + 14, *starts = ends + segX2 + 2, *deltas = starts + segX2, *ranges = deltas + segX2;
+			if (!inside(ranges, segX2)) return 0;
+			PFontUInt32 lo = 0, hi = segX2 / 2;
+			while (lo < hi) { // 終端コードの二分探索
+				PFontUInt32 mid = (lo + hi) / 2;
+				if (u16(ends + mid * 2) < code) lo = mid + 1;
+				else hi = mid;
+			}
+			if (lo >= segX2 / 2) return 0;
+			const PFontUInt32 start = u16(starts + lo * 2);
+			if (code < start) return 0;
+			const PFontUInt32 delta = u16(deltas + lo * 2), range = u16(ranges + lo * 2);
+			if (!range) return (code + delta) & 0xFFFF;
+			const PFontUInt8 *p = ranges + lo * 2 + range + (code - start) * 2;
+			if (!inside(p, 2)) return 0;
+			PFontUInt32 g = u16(p);
+			return g ? (g + delta) & 0xFFFF : 0;
+		}
+		if (cmapFormat == 12) {
+			const PFontUInt32 groups = u32(t + 12);
+			if (!inside(t + 16, (size_t)groups * 12)) return 0;
+			PFontUInt32 lo = 0, hi = groups;
+			while (lo < hi) {
+				PFontUInt32 mid = (lo + hi) / 2;
+				const PFontUInt8 *g = t + 16 + mid * 12;
+				if (u32(g + 4) < code) lo = mid + 1;
+				else hi = mid;
+			}
+			if (lo >= groups) return 0;
+			const PFontUInt8 *g = t + 16 + lo * 12;
+			return code >= u32(g) ? u32(g + 8) + (code - u32(g)) : 0;
+		}
+		return 0;
+	}
+
+	// 送り幅（フォント単位）
+	int getAdvance(PFontUInt32 gid) const {
+		if (!hmtx || !numHMetrics) return 0;
+		PFontUInt32 n = gid < numHMetrics ? gid : numHMetrics - 1;
+		return inside(hmtx + n * 4, 2) ? u16(hmtx + n * 4) : 0;
+	}
+
+	// アウトラインの取得
+	bool getOutline(PFontUInt32 gid, PFontPath &path) const {
+		path.clear();
+		if (gid >= (PFontUInt32)numGlyphs) return false;
+		return cff ? getCFFOutline(gid, path) : getGlyfOutline(gid, path, 0);
+	}
+
+private:
+	std::vector<PFontUInt8> data;
+	const PFontUInt8 *base;
+	int unitsPerEm, macStyle, ascender, descender, numGlyphs;
+	PFontUInt32 numHMetrics;
+	int locFormat;
+	const PFontUInt8 *cmap;
+	int cmapFormat;
+	const PFontUInt8 *hmtx, *loca, *glyf;
+	PFontUInt32 glyfLength;
+
+	// CFF
+	struct Index {
+		const PFontUInt8 *offsets, *data;
+		PFontUInt32 count, offSize;
+		Index() : offsets(0), data(0), count(0), offSize(0) {}
+	};
+	struct Private {
+		Index subrs;
+		float nominalWidth;
+		Private() : nominalWidth(0) {}
+	};
+	bool cff;
+	Index charStringIndex, globalSubrs;
+	const PFontUInt8 *charStrings, *fdSelect;
+	std::vector<Private> privates; // 通常は1つ，CIDフォントは FDArray の数
+
+	static PFontUInt32 tag(const char *s) { return ((PFontUInt32)(PFontUInt8)s[0] << 24) | ((PFontUInt8)s[1] << 16) | ((PFontUInt8)s[2] << 8) | (PFontUInt8)s[3]; }
+	static PFontUInt32 readTag(const PFontUInt8 *p) { return be32(p); }
+	static PFontUInt32 be32(const PFontUInt8 *p) { return ((PFontUInt32)p[0] << 24) | ((PFontUInt32)p[1] << 16) | ((PFontUInt32)p[2] << 8) | p[3]; }
+
+	bool inside(const PFontUInt8 *p, size_t len) const {
+		return !data.empty() && p >= &data.front() && p <= &data.front() + data.size() && len <= (size_t)(&data.front() + data.size() - p);
+	}
+	PFontUInt32 u8 (const PFontUInt8 *p) const { return inside(p, 1) ? p[0] : 0; }
+	PFontUInt32 u16(const PFontUInt8 *p) const { return inside(p, 2) ? ((PFontUInt32)p[0] << 8) | p[1] : 0; }
+	PFontUInt32 u32(const PFontUInt8 *p) const { return inside(p, 4) ? be32(p) : 0; }
+	int s16(const PFontUInt8 *p) const { return (int)(PFontInt16)(PFontUInt16)u16(p); }
+
+	const PFontUInt8 *findTable(const char *name, PFontUInt32 *length = 0) const {
+		const PFontUInt32 count = u16(base + 4), t = tag(name);
+		for (PFontUInt32 i = 0; i < count; i++) {
+			const PFontUInt8 *rec = base + 12 + i * 16;
+			if (u32(rec) != t) continue;
+			const PFontUInt32 off = u32(rec + 8), len = u32(rec + 12);
+			if (off > data.size() || len > data.size() - off) return 0;
+			if (length) *length = len;
+			return &data.front() + off;
+		}
+		return 0;
+	}
+
+	bool parse(int face) {
+		if (data.size() < 12) return false;
+		base = &data.front();
+		if (readTag(base) == tag("ttcf")) {
+			if (face < 0 || (PFontUInt32)face >= u32(base + 8)) return false;
+			PFontUInt32 off = u32(base + 12 + face * 4);
+			if (off + 12 > data.size()) return false;
+			base = &data.front() + off;
+		}
+		const PFontUInt8 *head = findTable("head"), *hhea = findTable("hhea"), *maxp = findTable("maxp");
+		hmtx = findTable("hmtx");
+		if (!head || !hhea || !maxp || !hmtx) return false;
+		unitsPerEm  = (int)u16(head + 18);
+		macStyle    = (int)u16(head + 44);
+		locFormat   = s16(head + 50);
+		ascender    = s16(hhea + 4);
+		descender   = s16(hhea + 6);
+		numHMetrics = u16(hhea + 34);
+		numGlyphs   = (int)u16(maxp + 4);
+		if (unitsPerEm <= 0) return false;
+		if (!parseCmap()) return false;
+
+		loca = findTable("loca");
+		glyf = findTable("glyf", &glyfLength);
+		if (loca && glyf) return true;
+		const PFontUInt8 *cfftable = findTable("CFF ");
+		return cfftable && parseCFF(cfftable);
+	}
+
+	bool parseCmap() {
+		const PFontUInt8 *t = findTable("cmap");
+		if (!t) return false;
+		const PFontUInt32 count = u16(t + 2);
+		int best = 0;
+		for (PFontUInt32 i = 0; i < count; i++) {
+			const PFontUInt8 *rec = t + 4 + i * 8;
+			const PFontUInt32 platform = u16(rec), encoding = u16(rec + 2);
+			const PFontUInt8 *sub = t + u32(rec + 4);
+			const int format = (int)u16(sub);
+			// Unicode の全範囲 > BMP の順に優先
+			int score = 0;
+			if (format == 12 && ((platform == 3 && encoding == 10) || platform == 0)) score = 3;
+			else if (format == 4 && ((platform == 3 && encoding == 1) || platform == 0)) score = 2;
+			if (score > best) {
+				best = score;
+				cmap = sub;
+				cmapFormat = format;
+			}
+		}
+		return best > 0;
+	}
+
+	//--------------------------------------------------------------
+	// glyf
+
+	bool getGlyphRange(PFontUInt32 gid, const PFontUInt8 *&p, PFontUInt32 &len) const {
+		PFontUInt32 start, end;
+		if (locFormat == 0) start = u16(loca + gid * 2) * 2, end = u16(loca + gid * 2 + 2) * 2;
+		else                start = u32(loca + gid * 4),     end = u32(loca + gid * 4 + 4);
+		if (end < start || end > glyfLength) return false;
+		p = glyf + start;
+		len = end - start;
+		return true;
+	}
+
+	bool getGlyfOutline(PFontUInt32 gid, PFontPath &path, int depth) const {
+		const PFontUInt8 *g;
+		PFontUInt32 len;
+		if (depth > 8 || !getGlyphRange(gid, g, len)) return false;
+		if (!len) return true; // 空白
+		const int contours = s16(g);
+		if (contours >= 0) return getSimpleOutline(g, contours, path);
+
+		// 複合グリフ
+		const PFontUInt8 *p = g + 10;
+		for (PFontUInt32 flags = 0x20; flags & 0x20;) {
+			flags = u16(p);
+			const PFontUInt32 component = u16(p + 2);
+			p += 4;
+			float dx = 0, dy = 0;
+			if (flags & 0x01) { dx = (float)s16(p); dy = (float)s16(p + 2); p += 4; }
+			else              { dx = (float)(signed char)u8(p); dy = (float)(signed char)u8(p + 1); p += 2; }
+			if (!(flags & 0x02)) dx = dy = 0; // 点の一致による配置は未対応
+			float a = 1, b = 0, c = 0, d = 1;
+			if (flags & 0x08)      { a = d = s16(p) / 16384.0f; p += 2; }
+			else if (flags & 0x40) { a = s16(p) / 16384.0f; d = s16(p + 2) / 16384.0f; p += 4; }
+			else if (flags & 0x80) { a = s16(p) / 16384.0f; b = s16(p + 2) / 16384.0f; c = s16(p + 4) / 16384.0f; d = s16(p + 6) / 16384.0f; p += 8; }
+			if (!inside(p, 0)) return false;
+			size_t from = path.pts.size();
+			if (!getGlyfOutline(component, path, depth + 1)) return false;
+			path.transform(from, a, b, c, d, dx, dy);
+		}
+		return true;
+	}
+
+	bool getSimpleOutline(const PFontUInt8 *g, int contours, PFontPath &path) const {
+		if (!contours) return true;
+		const PFontUInt8 *ends = g + 10;
+		const PFontUInt32 points = u16(ends + (contours - 1) * 2) + 1;
+		const PFontUInt8 *p = ends + contours * 2;
+		p += 2 + u16(p); // 命令は読み飛ばす
+		std::vector<PFontUInt8> flags(points);
+		for (PFontUInt32 i = 0; i < points;) {
+			PFontUInt8 f = (PFontUInt8)u8(p++);
+			flags[i++] = f;
+			if (f & 0x08) for (PFontUInt32 r = u8(p++); r > 0 && i < points; r--) flags[i++] = f;
+		}
+		std::vector<float> xs(points), ys(points);
+		int v = 0;
+		for (PFontUInt32 i = 0; i < points; i++) {
+			const PFontUInt8 f = flags[i];
+			if (f & 0x02) { int d = (int)u8(p++); v += (f & 0x10) ? d : -d; }
+			else if (!(f & 0x10)) { v += s16(p); p += 2; }
+			xs[i] = (float)v;
+		}
+		v = 0;
+		for (PFontUInt32 i = 0; i < points; i++) {
+			const PFontUInt8 f = flags[i];
+			if (f & 0x04) { int d = (int)u8(p++); v += (f & 0x20) ? d : -d; }
+			else if (!(f & 0x20)) { v += s16(p); p += 2; }
+			ys[i] = (float)v;
+		}
+		if (!inside(p, 0)) return false;
+
+		// 輪郭ごとに二次ベジェへ（連続する制御点の間は中点を通過点とする）
+		PFontUInt32 start = 0;
+		for (int c = 0; c < contours; c++) {
+			PFontUInt32 end = u16(ends + c * 2);
+			if (end < start || end >= points) return false;
+			const PFontUInt32 n = end - start + 1;
+			#define PFONT_ON(i)  (flags[start + ((i) % n)] & 1)
+			#define PFONT_X(i)   xs[start + ((i) % n)]
+			#define PFONT_Y(i)   ys[start + ((i) % n)]
+			// 開始点（通過点が無ければ最初の2制御点の中点）
+			PFontUInt32 first = 0;
+			while (first < n && !PFONT_ON(first)) first++;
+			float sx, sy;
+			if (first < n) sx = PFONT_X(first), sy = PFONT_Y(first);
+			else { first = 0; sx = (PFONT_X(0) + PFONT_X(1)) / 2; sy = (PFONT_Y(0) + PFONT_Y(1)) / 2; }
+			path.moveTo(sx, sy);
+			bool pending = false;
+			float cx = 0, cy = 0;
+			for (PFontUInt32 k = 1; k <= n; k++) {
+				const PFontUInt32 i = first + k;
+				const float x = PFONT_X(i), y = PFONT_Y(i);
+				if (PFONT_ON(i)) {
+					if (pending) path.quadTo(cx, cy, x, y);
+					else         path.lineTo(x, y);
+					pending = false;
+				} else {
+					if (pending) path.quadTo(cx, cy, (cx + x) / 2, (cy + y) / 2);
+					cx = x, cy = y;
+					pending = true;
+				}
+			}
+			if (pending) path.quadTo(cx, cy, sx, sy);
+			#undef PFONT_ON
+			#undef PFONT_X
+			#undef PFONT_Y
+			start = end + 1;
+		}
+		return true;
+	}
+
+	//--------------------------------------------------------------
+	// CFF
+
+	Index readIndex(const PFontUInt8 *&p) const {
+		Index idx;
+		idx.count = u16(p);
+		if (!idx.count) { p += 2; return idx; }
+		idx.offSize = u8(p + 2);
+		if (idx.offSize < 1 || idx.offSize > 4) { idx.count = 0; p += 3; return idx; }
+		idx.offsets = p + 3;
+		idx.data    = idx.offsets + (idx.count + 1) * idx.offSize - 1;
+		p = idx.data + offset(idx, idx.count);
+		return idx;
+	}
+	PFontUInt32 offset(const Index &idx, PFontUInt32 i) const {
+		PFontUInt32 v = 0;
+		for (PFontUInt32 k = 0; k < idx.offSize; k++) v = (v << 8) | u8(idx.offsets + i * idx.offSize + k);
+		return v;
+	}
+	bool getItem(const Index &idx, PFontUInt32 i, const PFontUInt8 *&p, PFontUInt32 &len) const {
+		if (i >= idx.count) return false;
+		PFontUInt32 a = offset(idx, i), b = offset(idx, i + 1);
+		if (b < a || !inside(idx.data + a, b - a)) return false;
+		p = idx.data + a;
+		len = b - a;
+		return true;
+	}
+
+	// DICT の解釈（op は 12 x を 1200+x として返す）
+	template <class F>
+	void parseDict(const PFontUInt8 *p, PFontUInt32 len, F func) const {
+		const PFontUInt8 *end = p + len;
+		float args[48];
+		int n = 0;
+		while (p < end && inside(p, 1)) {
+			PFontUInt32 b = *p++;
+			if (b <= 21) {
+				int op = (int)b;
+				if (b == 12) op = 1200 + (int)u8(p++);
+				func(op, args, n);
+				n = 0;
+				continue;
+			}
+			float v = 0;
+			if (b == 28)      { v = (float)(PFontInt16)(PFontUInt16)u16(p); p += 2; }
+			else if (b == 29) { v = (float)(int)u32(p); p += 4; }
+			else if (b == 30) { // 実数（読み飛ばして 0 扱い：使用する値には現れない）
+				while (p < end && (*p & 0x0F) != 0x0F && (*p & 0xF0) != 0xF0) p++;
+				p++;
+			}
+			else if (b >= 32 && b <= 246) v = (float)((int)b - 139);
+			else if (b >= 247 && b <= 250) v = (float)(((int)b - 247) * 256 + (int)u8(p++) + 108);
+			else if (b >= 251 && b <= 254) v = (float)(-((int)b - 251) * 256 - (int)u8(p++) - 108);
+			if (n < 48) args[n++] = v;
+		}
+	}
+
+	bool readPrivate(const PFontUInt8 *cffbase, PFontUInt32 size, PFontUInt32 off, Private &priv) const {
+		const PFontUInt8 *p = cffbase + off;
+		if (!inside(p, size)) return false;
+		PFontUInt32 subrs = 0;
+		parseDict(p, size, [&](int op, const float *args, int n) {
+			if (op == 19 && n >= 1) subrs = (PFontUInt32)args[n-1];
+			if (op == 21 && n >= 1) priv.nominalWidth = args[n-1];
+		});
+		if (subrs) {
+			const PFontUInt8 *s = p + subrs;
+			priv.subrs = readIndex(s);
+		}
+		return true;
+	}
+
+	bool parseCFF(const PFontUInt8 *t) {
+		const PFontUInt8 *p = t + u8(t + 2);
+		Index names = readIndex(p);
+		Index topdicts = readIndex(p);
+		Index strings = readIndex(p);
+		globalSubrs = readIndex(p);
+		(void)names; (void)strings;
+
+		const PFontUInt8 *top;
+		PFontUInt32 toplen;
+		if (!getItem(topdicts, 0, top, toplen)) return false;
+		PFontUInt32 charstrings = 0, privsize = 0, privoff = 0, fdarray = 0, fdselect = 0, type = 2;
+		parseDict(top, toplen, [&](int op, const float *args, int n) {
+			if (op == 17 && n >= 1) charstrings = (PFontUInt32)args[n-1];
+			if (op == 18 && n >= 2) privsize = (PFontUInt32)args[n-2], privoff = (PFontUInt32)args[n-1];
+			if (op == 1236 && n >= 1) fdarray  = (PFontUInt32)args[n-1];
+			if (op == 1237 && n >= 1) fdselect = (PFontUInt32)args[n-1];
+			if (op == 1206 && n >= 1) type = (PFontUInt32)args[n-1];
+		});
+		if (!charstrings || type != 2) return false;
+		const PFontUInt8 *cs = t + charstrings;
+		charStringIndex = readIndex(cs);
+		if (!charStringIndex.count) return false;
+
+		privates.clear();
+		if (fdarray && fdselect) {
+			const PFontUInt8 *fa = t + fdarray;
+			Index fds = readIndex(fa);
+			for (PFontUInt32 i = 0; i < fds.count; i++) {
+				const PFontUInt8 *fd;
+				PFontUInt32 fdlen, size = 0, off = 0;
+				if (!getItem(fds, i, fd, fdlen)) return false;
+				parseDict(fd, fdlen, [&](int op, const float *args, int n) {
+					if (op == 18 && n >= 2) size = (PFontUInt32)args[n-2], off = (PFontUInt32)args[n-1];
+				});
+				Private priv;
+				if (size && !readPrivate(t, size, off, priv)) return false;
+				privates.push_back(priv);
+			}
+			fdSelect = t + fdselect;
+		} else {
+			Private priv;
+			if (privsize && !readPrivate(t, privsize, privoff, priv)) return false;
+			privates.push_back(priv);
+		}
+		cff = true;
+		return true;
+	}
+
+	PFontUInt32 getFD(PFontUInt32 gid) const {
+		if (!fdSelect) return 0;
+		const PFontUInt32 format = u8(fdSelect);
+		if (format == 0) return u8(fdSelect + 1 + gid);
+		if (format == 3) {
+			const PFontUInt32 ranges = u16(fdSelect + 1);
+			for (PFontUInt32 i = 0; i < ranges; i++) {
+				const PFontUInt8 *r = fdSelect + 3 + i * 3;
+				if (gid >= u16(r) && gid < u16(r + 3)) return u8(r + 2);
+			}
+		}
+		return 0;
+	}
+
+	static PFontUInt32 subrBias(PFontUInt32 count) {
+		return count < 1240 ? 107 : count < 33900 ? 1131 : 32768;
+	}
+
+	// Type2 charstring の解釈
+	struct CharString {
+		const PFontOutlineFont &font;
+		const Private &priv;
+		PFontPath &path;
+		float stack[48];
+		int n, stems;
+		float x, y;
+		bool done;
+		CharString(const PFontOutlineFont &font, const Private &priv, PFontPath &path)
+			: font(font), priv(priv), path(path), n(0), stems(0), x(0), y(0), done(false) {}
+
+		void moveTo(float dx, float dy) { x += dx; y += dy; path.moveTo(x, y); }
+		void lineTo(float dx, float dy) { x += dx; y += dy; path.lineTo(x, y); }
+		void curveTo(float dx1, float dy1, float dx2, float dy2, float dx3, float dy3) {
+			float x1 = x + dx1, y1 = y + dy1, x2 = x1 + dx2, y2 = y1 + dy2;
+			x = x2 + dx3; y = y2 + dy3;
+			path.cubicTo(x1, y1, x2, y2, x, y);
+		}
+
+		bool run(const PFontUInt8 *p, PFontUInt32 len, int depth) {
+			if (depth > 10) return false;
+			const PFontUInt8 *end = p + len;
+			while (p < end && !done) {
+				PFontUInt32 b = *p++;
+				if (b >= 32 || b == 28) {
+					float v;
+					if (b == 28) { if (end - p < 2) return false; v = (float)(PFontInt16)(PFontUInt16)((p[0] << 8) | p[1]); p += 2; }
+					else if (b <= 246) v = (float)((int)b - 139);
+					else if (b <= 250) { if (p >= end) return false; v = (float)(((int)b - 247) * 256 + *p++ + 108); }
+					else if (b <= 254) { if (p >= end) return false; v = (float)(-((int)b - 251) * 256 - *p++ - 108); }
+					else { if (end - p < 4) return false; v = (float)(int)(((PFontUInt32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]) / 65536.0f; p += 4; }
+					if (n < 48) stack[n++] = v;
+					continue;
+				}
+				int i = 0;
+				switch (b) {
+				case 1: case 3: case 18: case 23: // hstem vstem hstemhm vstemhm
+					stems += n / 2;
+					n = 0;
+					break;
+				case 19: case 20: // hintmask cntrmask
+					stems += n / 2;
+					p += (stems + 7) / 8;
+					n = 0;
+					break;
+				case 21: // rmoveto
+					if (n >= 2) moveTo(stack[n-2], stack[n-1]);
+					n = 0;
+					break;
+				case 22: // hmoveto
+					if (n >= 1) moveTo(stack[n-1], 0);
+					n = 0;
+					break;
+				case 4: // vmoveto
+					if (n >= 1) moveTo(0, stack[n-1]);
+					n = 0;
+					break;
+				case 5: // rlineto
+					for (; i + 2 <= n; i += 2) lineTo(stack[i], stack[i+1]);
+					n = 0;
+					break;
+				case 6: case 7: { // hlineto vlineto
+					bool horz = (b == 6);
+					for (; i < n; i++, horz = !horz) lineTo(horz ? stack[i] : 0, horz ? 0 : stack[i]);
+					n = 0;
+					break;
+				}
+				case 8: // rrcurveto
+					for (; i + 6 <= n; i += 6) curveTo(stack[i], stack[i+1], stack[i+2], stack[i+3], stack[i+4], stack[i+5]);
+					n = 0;
+					break;
+				case 24: // rcurveline
+					for (; i + 6 <= n - 2; i += 6) curveTo(stack[i], stack[i+1], stack[i+2], stack[i+3], stack[i+4], stack[i+5]);
+					if (i + 2 <= n) lineTo(stack[i], stack[i+1]);
+					n = 0;
+					break;
+				case 25: // rlinecurve
+					for (; i + 2 <= n - 6; i += 2) lineTo(stack[i], stack[i+1]);
+					if (i + 6 <= n) curveTo(stack[i], stack[i+1], stack[i+2], stack[i+3], stack[i+4], stack[i+5]);
+					n = 0;
+					break;
+				case 26: { // vvcurveto
+					float dx1 = 0;
+					if (n & 1) dx1 = stack[i++];
+					for (; i + 4 <= n; i += 4, dx1 = 0) curveTo(dx1, stack[i], stack[i+1], stack[i+2], 0, stack[i+3]);
+					n = 0;
+					break;
+				}
+				case 27: { // hhcurveto
+					float dy1 = 0;
+					if (n & 1) dy1 = stack[i++];
+					for (; i + 4 <= n; i += 4, dy1 = 0) curveTo(stack[i], dy1, stack[i+1], stack[i+2], stack[i+3], 0);
+					n = 0;
+					break;
+				}
+				case 30: case 31: { // vhcurveto hvcurveto
+					bool horz = (b == 31);
+					for (; i + 4 <= n; i += 4, horz = !horz) {
+						float last = (n - i == 5) ? stack[i+4] : 0;
+						if (horz) curveTo(stack[i], 0, stack[i+1], stack[i+2], last, stack[i+3]);
+						else      curveTo(0, stack[i], stack[i+1], stack[i+2], stack[i+3], last);
+					}
+					n = 0;
+					break;
+				}
+				case 10: case 29: { // callsubr callgsubr
+					if (n < 1) return false;
+					const Index &subrs = (b == 10) ? priv.subrs : font.globalSubrs;
+					int index = (int)stack[--n] + (int)subrBias(subrs.count);
+					const PFontUInt8 *s;
+					PFontUInt32 slen;
+					if (index < 0 || !font.getItem(subrs, (PFontUInt32)index, s, slen) || !run(s, slen, depth + 1)) return false;
+					break;
+				}
+				case 11: // return
+					return true;
+				case 14: // endchar
+					done = true;
+					break;
+				case 12: {
+					if (p >= end) return false;
+					PFontUInt32 op = *p++;
+					const float *s = stack;
+					if (op == 35 && n >= 12) { // flex
+						curveTo(s[0], s[1], s[2], s[3], s[4], s[5]);
+						curveTo(s[6], s[7], s[8], s[9], s[10], s[11]);
+					} else if (op == 34 && n >= 7) { // hflex
+						curveTo(s[0], 0, s[1], s[2], s[3], 0);
+						curveTo(s[4], 0, s[5], -s[2], s[6], 0);
+					} else if (op == 36 && n >= 9) { // hflex1
+						curveTo(s[0], s[1], s[2], s[3], s[4], 0);
+						curveTo(s[5], 0, s[6], s[7], s[8], -(s[1] + s[3] + s[7]));
+					} else if (op == 37 && n >= 11) { // flex1
+						float dx = s[0] + s[2] + s[4] + s[6] + s[8];
+						float dy = s[1] + s[3] + s[5] + s[7] + s[9];
+						bool horz = std::fabs(dx) > std::fabs(dy);
+						curveTo(s[0], s[1], s[2], s[3], s[4], s[5]);
+						curveTo(s[6], s[7], s[8], s[9], horz ? s[10] : -dx, horz ? -dy : s[10]);
+					}
+					n = 0;
+					break;
+				}
+				default: // 未対応の演算子
+					n = 0;
+					break;
+				}
+			}
+			return true;
+		}
+	};
+
+	bool getCFFOutline(PFontUInt32 gid, PFontPath &path) const {
+		const PFontUInt8 *p;
+		PFontUInt32 len;
+		if (!getItem(charStringIndex, gid, p, len)) return false;
+		PFontUInt32 fd = getFD(gid);
+		if (fd >= privates.size()) return false;
+		CharString cs(*this, privates[fd], path);
+		return cs.run(p, len, 0);
+	}
+};
+
+//--------------------------------------------------------------
+// 面積被覆率によるスキャンライン描画
+//
+// 各線分が通過するピクセルに符号付き面積を加算し，行ごとに累積した絶対値を被覆率とする
+
+class PFontRasterizer
+{
+public:
+	void reset(int width, int height) {
+		w = width;
+		h = height;
+		pitch = w + 2;
+		acc.assign((size_t)pitch * (h > 0 ? h : 0) + 4, 0.0f);
+	}
+
+	void line(float x0, float y0, float x1, float y1) {
+		if (y0 == y1) return;
+		float dir = 1.0f;
+		if (y0 > y1) {
+			std::swap(x0, x1);
+			std::swap(y0, y1);
+			dir = -1.0f;
+		}
+		x0 = clampX(x0); x1 = clampX(x1);
+		if (y0 < 0) y0 = 0;
+		if (y1 > (float)h) y1 = (float)h;
+		if (y0 >= y1) return;
+		const float dxdy = (x1 - x0) / (y1 - y0);
+		float x = x0;
+		const int ystart = (int)y0, yend = (int)std::ceil(y1);
+		for (int y = ystart; y < yend && y < h; y++) {
+			float *line = &acc[(size_t)y * pitch];
+			const float dy = std::min((float)(y + 1), y1) - std::max((float)y, y0);
+			const float xnext = clampX(x + dxdy * dy);
+			const float d = dy * dir;
+			const float xa = std::min(x, xnext), xb = std::max(x, xnext);
+			const float xafloor = std::floor(xa);
+			const int xai = (int)xafloor;
+			const float xbceil = std::ceil(xb);
+			const int xbi = (int)xbceil;
+			if (xbi <= xai + 1) {
+				const float xmf = 0.5f * (x + xnext) - xafloor;
+				line[xai]     += d - d * xmf;
+				line[xai + 1] += d * xmf;
+			} else {
+				const float s = 1.0f / (xb - xa);
+				const float xaf = xa - xafloor;
+				const float a0 = 0.5f * s * (1.0f - xaf) * (1.0f - xaf);
+				const float xbf = xb - xbceil + 1.0f;
+				const float am = 0.5f * s * xbf * xbf;
+				line[xai] += d * a0;
+				if (xbi == xai + 2) {
+					line[xai + 1] += d * (1.0f - a0 - am);
+				} else {
+					const float a1 = s * (1.5f - xaf);
+					line[xai + 1] += d * (a1 - a0);
+					for (int xi = xai + 2; xi < xbi - 1; xi++) line[xi] += d * s;
+					const float a2 = a1 + (float)(xbi - xai - 3) * s;
+					line[xbi - 1] += d * (1.0f - a2 - am);
+				}
+				line[xbi] += d * am;
+			}
+			x = xnext;
+		}
+	}
+
+	// 累積して 0〜64 の被覆率に変換する（out は w*h）
+	// 4要素ずつブロック内の前置和を取り，前のブロックの合計を繰り越す
+	// （浮動小数の加算順が結果に影響するので，SIMD を使わない場合も同じ順序で加算する）
+	void accumulate(PFontUInt8 *out) const {
+		for (int y = 0; y < h; y++) {
+			const float *a = &acc[(size_t)y * pitch];
+			PFontUInt8 *o = out + (size_t)y * w;
+			int x = 0;
+			float sum = 0.0f;
+#ifdef PFONT_USE_SSE2
+			const __m128 sign  = _mm_set1_ps(-0.0f);
+			const __m128 one   = _mm_set1_ps(1.0f);
+			const __m128 scale = _mm_set1_ps(64.0f);
+			const __m128 half  = _mm_set1_ps(0.5f);
+			__m128 carry = _mm_setzero_ps();
+			for (; x + 4 <= w; x += 4) {
+				__m128 v = _mm_loadu_ps(a + x);
+				v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+				v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 8)));
+				v = _mm_add_ps(v, carry);
+				carry = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+				__m128 c = _mm_min_ps(_mm_andnot_ps(sign, v), one);
+				__m128i i = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half));
+				i = _mm_packs_epi32(i, i);
+				i = _mm_packus_epi16(i, i);
+				int packed = _mm_cvtsi128_si32(i);
+				memcpy(o + x, &packed, 4);
+			}
+			sum = _mm_cvtss_f32(carry);
+#else
+			for (; x + 4 <= w; x += 4) {
+				// SSE2 版の2段のシフト加算と同じ組み合わせ
+				const float s1 = a[x + 1] + a[x], s2 = a[x + 2] + a[x + 1], s3 = a[x + 3] + a[x + 2];
+				const float v0 = a[x] + sum, v1 = s1 + sum, v2 = (s2 + a[x]) + sum, v3 = (s3 + s1) + sum;
+				o[x]     = coverage(v0);
+				o[x + 1] = coverage(v1);
+				o[x + 2] = coverage(v2);
+				o[x + 3] = coverage(v3);
+				sum = v3;
+			}
+#endif
+			for (; x < w; x++) {
+				sum += a[x];
+				o[x] = coverage(sum);
+			}
+		}
+	}
+
+private:
+	int w, h, pitch;
+	std::vector<float> acc;
+
+	float clampX(float x) const { return x < 0 ? 0 : x > (float)w ? (float)w : x; }
+	static PFontUInt8 coverage(float sum) {
+		float c = std::fabs(sum);
+		if (c > 1.0f) c = 1.0f;
+		return (PFontUInt8)(int)(c * 64.0f + 0.5f);
+	}
+};
+
+//--------------------------------------------------------------
+// グリフの描画
+//
+// size   : 文字の高さ(pixel)＝1em
+// italic : 斜体（右上がりに 0.2 傾ける）
+// bold   : 太字（1ピクセル右に重ねる／送り幅も1ピクセル増える）
+//          いずれも書体自体が太字／斜体なら合成しない
+// メトリクスは GDI と同じ意味（origin_y はベースラインから上端までで上向きが正）
+
+inline bool PFontRenderOutline(const PFontOutlineFont &font, PFontUInt32 gid, int size, bool bold, bool italic, PFontGlyph &glyph)
+{
+	PFontPath path;
+	if (!font.getOutline(gid, path)) return false;
+	if (font.getStyle() & 1) bold   = false;
+	if (font.getStyle() & 2) italic = false;
+	const float scale = (float)size / font.getUnitsPerEm();
+	const float shear = italic ? 0.2f : 0.0f;
+
+	// 画素座標（y下向き）の折れ線に変換
+	std::vector<float> lines; // x0,y0,x1,y1 ...
+	{
+		const float tolerance = 0.05f; // 折れ線化の許容誤差(pixel)
+		float sx = 0, sy = 0, cx = 0, cy = 0;
+		bool open = false;
+		const float *p = path.pts.empty() ? 0 : &path.pts.front();
+		struct Emit {
+			std::vector<float> &lines;
+			float &cx, &cy;
+			void operator()(float x, float y) {
+				lines.push_back(cx); lines.push_back(cy); lines.push_back(x); lines.push_back(y);
+				cx = x, cy = y;
+			}
+		} emit = { lines, cx, cy };
+		#define PFONT_TX(px, py) ((px) * scale + (py) * scale * shear)
+		#define PFONT_TY(py)     (-(py) * scale)
+		for (size_t i = 0; i < path.ops.size(); i++) {
+			switch (path.ops[i]) {
+			case PFontPath::MoveTo:
+				if (open && (cx != sx || cy != sy)) emit(sx, sy);
+				sx = cx = PFONT_TX(p[0], p[1]);
+				sy = cy = PFONT_TY(p[1]);
+				open = true;
+				p += 2;
+				break;
+			case PFontPath::LineTo:
+				emit(PFONT_TX(p[0], p[1]), PFONT_TY(p[1]));
+				p += 2;
+				break;
+			case PFontPath::QuadTo: {
+				const float x0 = cx, y0 = cy;
+				const float x1 = PFONT_TX(p[0], p[1]), y1 = PFONT_TY(p[1]);
+				const float x2 = PFONT_TX(p[2], p[3]), y2 = PFONT_TY(p[3]);
+				const float dev = std::sqrt((x0 - 2*x1 + x2) * (x0 - 2*x1 + x2) + (y0 - 2*y1 + y2) * (y0 - 2*y1 + y2));
+				int n = 1 + (int)std::sqrt(dev / (4 * tolerance));
+				if (n > 64) n = 64;
+				for (int k = 1; k <= n; k++) {
+					const float t = (float)k / n, u = 1 - t;
+					emit(u*u*x0 + 2*u*t*x1 + t*t*x2, u*u*y0 + 2*u*t*y1 + t*t*y2);
+				}
+				p += 4;
+				break;
+			}
+			case PFontPath::CubicTo: {
+				const float x0 = cx, y0 = cy;
+				const float x1 = PFONT_TX(p[0], p[1]), y1 = PFONT_TY(p[1]);
+				const float x2 = PFONT_TX(p[2], p[3]), y2 = PFONT_TY(p[3]);
+				const float x3 = PFONT_TX(p[4], p[5]), y3 = PFONT_TY(p[5]);
+				const float d1 = std::sqrt((x0 - 2*x1 + x2) * (x0 - 2*x1 + x2) + (y0 - 2*y1 + y2) * (y0 - 2*y1 + y2));
+				const float d2 = std::sqrt((x1 - 2*x2 + x3) * (x1 - 2*x2 + x3) + (y1 - 2*y2 + y3) * (y1 - 2*y2 + y3));
+				int n = 1 + (int)std::sqrt(0.75f * std::max(d1, d2) / tolerance);
+				if (n > 64) n = 64;
+				for (int k = 1; k <= n; k++) {
+					const float t = (float)k / n, u = 1 - t;
+					const float a = u*u*u, b = 3*u*u*t, c = 3*u*t*t, d = t*t*t;
+					emit(a*x0 + b*x1 + c*x2 + d*x3, a*y0 + b*y1 + c*y2 + d*y3);
+				}
+				p += 6;
+				break;
+			}
+			}
+		}
+		if (open && (cx != sx || cy != sy)) emit(sx, sy);
+		#undef PFONT_TX
+		#undef PFONT_TY
+	}
+
+	PFontIndex &info = glyph.info;
+	memset(&info, 0, sizeof(info));
+	const int advance = (int)std::floor(font.getAdvance(gid) * scale + 0.5f) + (bold ? 1 : 0);
+	info.inc_x = info.inc = (PFontInt16)advance;
+	glyph.image.clear();
+	if (lines.empty()) return true;
+
+	float minx = lines[0], maxx = lines[0], miny = lines[1], maxy = lines[1];
+	for (size_t i = 0; i < lines.size(); i += 2) {
+		minx = std::min(minx, lines[i]);   maxx = std::max(maxx, lines[i]);
+		miny = std::min(miny, lines[i+1]); maxy = std::max(maxy, lines[i+1]);
+	}
+	const int left = (int)std::floor(minx), top = (int)std::floor(miny);
+	const int w = (int)std::ceil(maxx) - left, h = (int)std::ceil(maxy) - top;
+	if (w <= 0 || h <= 0) return true;
+
+	PFontRasterizer raster;
+	raster.reset(w, h);
+	for (size_t i = 0; i + 3 < lines.size(); i += 4)
+		raster.line(lines[i] - left, lines[i+1] - top, lines[i+2] - left, lines[i+3] - top);
+
+	const int ow = w + (bold ? 1 : 0);
+	std::vector<PFontUInt8> cov((size_t)w * h);
+	raster.accumulate(&cov.front());
+	glyph.image.assign((size_t)ow * h, 0);
+	for (int y = 0; y < h; y++) {
+		const PFontUInt8 *s = &cov[(size_t)y * w];
+		PFontUInt8 *d = &glyph.image[(size_t)y * ow];
+		if (!bold) memcpy(d, s, w);
+		else for (int x = 0; x < ow; x++) d[x] = std::max(x < w ? s[x] : (PFontUInt8)0, x > 0 ? s[x-1] : (PFontUInt8)0);
+	}
+	info.width    = (PFontUInt16)ow;
+	info.height   = (PFontUInt16)h;
+	info.origin_x = (PFontInt16)left;
+	info.origin_y = (PFontInt16)-top;
+	return true;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+// レンダリング済みフォントの縮小（大きいサイズのフォントから小さいサイズを作る：プラットフォーム非依存部）
+//
+// グリフの各画素をペン位置基準の座標に置き，ペン位置を中心に scale 倍した位置で出力の画素格子に再標本化する
+// （元のグリフの小数位置も反映されるように，出力の画素格子はペン位置にそろえる）
+// フィルタは面積平均（出力画素に重なる面積で平均）と Lanczos-3 を選べる
+// メトリクス（origin/inc）は scale 倍して丸め，blackbox は値0の外周を切り詰めた大きさになる
+
+#include "pfont.hpp"
+
+enum PFontResampleFilter {
+	PFontResampleArea    = 0,
+	PFontResampleLanczos = 1,
+};
+
+//--------------------------------------------------------------
+// 1軸分の重み
+//
+// 元の画素 i は座標 a+i〜a+i+1 にあり，出力の画素 origin+k は元の座標で (origin+k)/scale〜(origin+k+1)/scale
+// 出力画素 k の値は sum(weight[k*taps+t] * src[first[k]+t])
+
+struct PFontResampleAxis
+{
+	int origin, length, taps;
+	std::vector<int>   first;
+	std::vector<float> weight;
+
+	static double lanczos(double x) {
+		if (x < 0) x = -x;
+		if (x < 1e-9) return 1.0;
+		if (x >= 3.0) return 0.0;
+		const double px = 3.14159265358979323846 * x;
+		return 3.0 * std::sin(px) * std::sin(px / 3.0) / (px * px);
+	}
+
+	void setup(double a, int n, double scale, int filter) {
+		if (filter == PFontResampleLanczos) {
+			const double shrink = scale < 1.0 ? scale : 1.0; // 縮小時は出力の画素幅で，拡大時は元の画素幅でフィルタする
+			const double radius = 3.0 / shrink;               // 元の画素単位のフィルタ半径
+			origin = (int)std::floor(scale * (a - radius));
+			length = (int)std::ceil(scale * (a + n + radius)) - origin;
+			taps   = (int)std::ceil(radius) * 2 + 2;
+			first.assign(length, 0);
+			weight.assign((size_t)length * taps, 0.0f);
+			std::vector<double> w(taps);
+			for (int k = 0; k < length; k++) {
+				const double center = (origin + k + 0.5) / scale - a; // 元の画素番号での中心位置
+				const int i0 = (int)std::ceil(center - 0.5 - radius);
+				double sum = 0;
+				for (int t = 0; t < taps; t++) sum += (w[t] = lanczos((i0 + t + 0.5 - center) * shrink));
+				// 範囲外（値0）の画素も含めて正規化する
+				first[k] = i0 < 0 ? 0 : i0;
+				for (int t = 0; t < taps; t++) {
+					const int i = i0 + t;
+					if (i < 0 || i >= n || sum == 0) continue;
+					weight[(size_t)k * taps + (i - first[k])] = (float)(w[t] / sum);
+				}
+			}
+			return;
+		}
+		origin = (int)std::floor(scale * a);
+		length = (int)std::ceil(scale * (a + n)) - origin;
+		taps   = (int)std::ceil(1.0 / scale) + 1;
+		first.assign(length, 0);
+		weight.assign((size_t)length * taps, 0.0f);
+		for (int k = 0; k < length; k++) {
+			const double u0 = origin + k, u1 = u0 + 1;
+			int i0 = (int)std::floor(u0 / scale - a);
+			if (i0 < 0) i0 = 0;
+			first[k] = i0;
+			for (int t = 0; t < taps && i0 + t < n; t++) {
+				const double s0 = scale * (a + i0 + t), s1 = s0 + scale;
+				const double overlap = (s1 < u1 ? s1 : u1) - (s0 > u0 ? s0 : u0);
+				if (overlap > 0) weight[(size_t)k * taps + t] = (float)overlap;
+			}
+		}
+	}
+};
+
+inline PFontInt16 PFontScaleMetric(int v, double scale)
+{
+	return (PFontInt16)std::floor(v * scale + 0.5);
+}
+
+//--------------------------------------------------------------
+// グリフの縮小
+
+inline void PFontResampleGlyph(PFontGlyph &g, double scale, int filter)
+{
+	PFontIndex &info = g.info;
+	info.inc   = PFontScaleMetric(info.inc,   scale);
+	info.inc_x = PFontScaleMetric(info.inc_x, scale);
+	info.inc_y = PFontScaleMetric(info.inc_y, scale);
+	const int w = info.width, h = info.height;
+	if (!w || !h) {
+		info.origin_x = PFontScaleMetric(info.origin_x, scale);
+		info.origin_y = PFontScaleMetric(info.origin_y, scale);
+		return;
+	}
+
+	// y は下向き（元の画素の上端はベースラインから -origin_y）
+	PFontResampleAxis ax, ay;
+	ax.setup( info.origin_x, w, scale, filter);
+	ay.setup(-info.origin_y, h, scale, filter);
+
+	// 横方向
+	std::vector<float> tmp((size_t)h * ax.length);
+	for (int y = 0; y < h; y++) {
+		const PFontUInt8 *src = &g.image[(size_t)y * w];
+		float *dst = &tmp[(size_t)y * ax.length];
+		for (int k = 0; k < ax.length; k++) {
+			const float *wk = &ax.weight[(size_t)k * ax.taps];
+			const int i0 = ax.first[k], n = (w - i0 < ax.taps) ? w - i0 : ax.taps;
+			float sum = 0;
+			for (int t = 0; t < n; t++) sum += wk[t] * src[i0 + t];
+			dst[k] = sum;
+		}
+	}
+	// 縦方向
+	std::vector<PFontUInt8> out((size_t)ax.length * ay.length);
+	std::vector<float> acc(ax.length);
+	for (int k = 0; k < ay.length; k++) {
+		std::fill(acc.begin(), acc.end(), 0.0f);
+		const float *wk = &ay.weight[(size_t)k * ay.taps];
+		const int j0 = ay.first[k], n = (h - j0 < ay.taps) ? h - j0 : ay.taps;
+		for (int t = 0; t < n; t++) {
+			const float wt = wk[t];
+			if (wt == 0) continue;
+			const float *row = &tmp[(size_t)(j0 + t) * ax.length];
+			for (int x = 0; x < ax.length; x++) acc[x] += wt * row[x];
+		}
+		PFontUInt8 *dst = &out[(size_t)k * ax.length];
+		for (int x = 0; x < ax.length; x++) {
+			const float v = acc[x] + 0.5f;
+			dst[x] = v <= 0 ? 0 : v >= 64 ? 64 : (PFontUInt8)v;
+		}
+	}
+
+	g.image.swap(out);
+	info.width    = (PFontUInt16)ax.length;
+	info.height   = (PFontUInt16)ay.length;
+	info.origin_x = (PFontInt16) ax.origin;
+	info.origin_y = (PFontInt16)-ay.origin;
+	PFontCropGlyph(g);
+}
+
+// 全グリフを縮小する（大きい順に並列処理）
+inline void PFontResampleGlyphs(std::vector<PFontGlyph> &glyphs, double scale, int filter, int threads)
+{
+	std::vector<PFontUInt32> cost(glyphs.size()), order;
+	for (size_t i = 0; i < glyphs.size(); i++) cost[i] = (PFontUInt32)glyphs[i].info.width * glyphs[i].info.height;
+	PFontSortByCost(cost, order);
+	PFontParallelFor(order.size(), threads, [&](size_t k) {
+		PFontResampleGlyph(glyphs[order[k]], scale, filter);
+	});
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+// グリフの行ごとのスパン表現と描画（プラットフォーム非依存部）
+//
+// 圧縮イメージを w*h のバッファに展開せず，行ごとのスパン（不透明の連続・中間値の連続）に変換する
+// 値 0 の画素は持たないので描画時に読み飛ばす必要がなく，不透明スパンは単色の書き込みで済む
+// 65段階ランレングス圧縮はランを直接スパンにし，1/2/4bit 形式は行単位で展開してから変換する
+//
+// 変換は展開（PFontDecodeGlyph）の約3倍の時間がかかり，描画は PFontBlitImage より最大1割程度速いだけなので，
+// 同じグリフを何十回も描画する場合以外は展開したイメージを使うほうが速い（tftool bench で比較できる）
+// drawPreRenderedText は展開したイメージを使い，PreRenderedFontReader.spans が true ならスパンを使う
+
+#include "pfont.hpp"
+
+// 不透明スパンにする最小の長さ（これより短いものは中間値スパンにまとめる）
+static const int PFontSpanMinOpaque = 4;
+// 中間値スパンを分けない値0の画素数（これより短い隙間は 0 のまま含めて 4画素単位のブレンドを続ける）
+static const int PFontSpanMinGap = 4;
+
+struct PFontSpan
+{
+	PFontUInt16 x, y, length;
+	PFontUInt16 opaque;  // 0以外なら全画素 64
+	PFontUInt32 offset;  // 中間値スパンの coverage 上の位置
+};
+
+struct PFontSpanList
+{
+	std::vector<PFontSpan>  spans;    // 行順・行内は x 順
+	std::vector<PFontUInt8> coverage; // 中間値スパンの 0〜64
+	int width;                        // グリフの幅
+
+	PFontSpanList() : width(0) {}
+
+	void clear() {
+		spans.clear();
+		coverage.clear();
+		width = 0;
+	}
+	void begin(int w, int h) {
+		clear();
+		width = w;
+		spans.reserve((size_t)h * 2);
+		coverage.reserve((size_t)w * h);
+	}
+	void append(PFontUInt8 v, int n) {
+		if (n == 1) coverage.push_back(v);
+		else coverage.insert(coverage.end(), n, v);
+	}
+	bool empty() const { return spans.empty(); }
+
+	// 同じ値 v の n 画素を追加する（行内で x の昇順に呼ぶこと）
+	// 64 の連続が PFontSpanMinOpaque に達したら直前の中間値スパンの末尾の 64 を含めて不透明スパンにする
+	void add(int x, int y, PFontUInt8 v, int n) {
+		if (n <= 0) return;
+		if (!v) {
+			if (n < PFontSpanMinGap && !spans.empty()) {
+				PFontSpan &s = spans.back();
+				if (!s.opaque && s.y == y && s.x + s.length == x) {
+					s.length += (PFontUInt16)n;
+					append(0, n);
+				}
+			}
+			return;
+		}
+		if (v >= 64 && !spans.empty()) {
+			PFontSpan &s = spans.back();
+			if (!s.opaque && s.y == y && s.x + s.length == x) {
+				int k = 0;
+				while (k < s.length && coverage[coverage.size() - 1 - k] >= 64) k++;
+				if (k + n >= PFontSpanMinOpaque) {
+					s.length -= (PFontUInt16)k;
+					coverage.resize(coverage.size() - k);
+					if (!s.length) spans.pop_back();
+					x -= k;
+					n += k;
+				}
+			}
+		}
+		const PFontUInt16 opaque = (v >= 64 && n >= PFontSpanMinOpaque) ? 1 : 0;
+		if (!spans.empty()) {
+			PFontSpan &s = spans.back();
+			if (s.y == y && s.x + s.length == x && s.opaque == opaque) {
+				s.length += (PFontUInt16)n;
+				if (!opaque) append(v, n);
+				return;
+			}
+			close();
+		}
+		PFontSpan s = { (PFontUInt16)x, (PFontUInt16)y, (PFontUInt16)n, opaque, (PFontUInt32)coverage.size() };
+		spans.push_back(s);
+		if (!opaque) append(v, n);
+	}
+
+	// 最後の中間値スパンを閉じる（変換の最後にも呼ぶこと）
+	// 末尾の隙間を除いてから，グリフの幅に収まる範囲で 0 を足して4画素単位の長さにそろえる
+	// （PFontBlendLine が端数を1画素ずつ処理しないようにするため：0 の画素は描画しても変わらない）
+	// 詰め物は直後の不透明スパンに重なることがあるが，不透明スパンは後から書き込むので結果は同じ
+	void close() {
+		if (spans.empty() || spans.back().opaque) return;
+		PFontSpan &s = spans.back();
+		while (s.length && !coverage.back()) {
+			s.length--;
+			coverage.pop_back();
+		}
+		const int pad = (4 - (s.length & 3)) & 3;
+		if (pad && s.x + s.length + pad <= width) {
+			s.length += (PFontUInt16)pad;
+			append(0, pad);
+		}
+	}
+
+	// 0〜64 の1行分を追加する
+	void addLine(const PFontUInt8 *line, int w, int y) {
+		for (int x = 0; x < w;) {
+			const PFontUInt8 v = line[x];
+			int e = x + 1;
+			while (e < w && line[e] == v) e++;
+			add(x, y, v, e - x);
+			x = e;
+		}
+	}
+};
+
+//--------------------------------------------------------------
+// 圧縮イメージからスパンへの変換
+//
+// src/srclen/used は PFontDecodeGlyph と同じ
+// @return 全ピクセルを変換できたら true
+
+inline bool PFontDecodeSpans65(const PFontUInt8 *src, size_t srclen, int w, int h, PFontSpanList &out, size_t *used = NULL)
+{
+	const PFontUInt8 *s = src, *send = src + srclen;
+	PFontUInt8 last = 0;
+	int x = 0, y = 0;
+	while (y < h) {
+		if (s >= send) {
+			if (used) *used = (size_t)(s - src);
+			return false;
+		}
+		PFontUInt8 v = *s++;
+		if (v <= 0x40) {
+			out.add(x, y, last = v, 1);
+			if (++x >= w) x = 0, ++y;
+		} else {
+			int len = v - 0x40;
+			while (len > 0 && y < h) {
+				int n = w - x;
+				if (n > len) n = len;
+				out.add(x, y, last, n);
+				len -= n;
+				if ((x += n) >= w) x = 0, ++y;
+			}
+		}
+	}
+	if (used) *used = (size_t)(s - src);
+	return true;
+}
+
+inline bool PFontDecodeSpans(int mode, const PFontUInt8 *src, size_t srclen, int w, int h, PFontSpanList &out, size_t *used = NULL)
+{
+	out.clear();
+	mode &= PFontModeMask;
+	if (w <= 0 || h <= 0) {
+		if (used) *used = 0;
+		return true;
+	}
+	out.begin(w, h);
+	if (mode == PFontMode65) {
+		if (!PFontDecodeSpans65(src, srclen, w, h, out, used)) return false;
+		out.close();
+		return true;
+	}
+	const size_t pixels = (size_t)w * h;
+	if (used) *used = PFontPackedSize(mode, pixels);
+	std::vector<PFontUInt8> tmp(pixels);
+	if (!PFontUnpack(mode, src, srclen, pixels, &tmp.front())) return false;
+	for (int y = 0; y < h; y++) out.addLine(&tmp[(size_t)y * w], w, y);
+	out.close();
+	return true;
+}
+
+// フォントデータの n 番目のグリフをスパンに変換する
+inline bool PFontDecodeSpans(const PFontData &data, PFontUInt32 n, PFontSpanList &out)
+{
+	const PFontIndex &idx = data.index[n];
+	out.clear();
+	if (!idx.width || !idx.height) return true;
+	const PFontUInt8 *src = 0;
+	size_t len = 0;
+	return data.getImage(n, src, len) && PFontDecodeSpans(idx.reserved, src, len, idx.width, idx.height, out);
+}
+
+//--------------------------------------------------------------
+// スパンの描画
+//
+// dst/pitch  : 32bit ARGB の出力先（pitch はピクセル単位），w/h はその大きさ（範囲外はクリップ）
+// x, y       : グリフ左上の位置
+// 不透明スパンは color をそのまま書き込み，中間値スパンは PFontBlendLine でブレンドする
+// @return 描画したか（rect を指定すると更新範囲 left, top, right, bottom を広げる）
+
+inline void PFontFillLine(PFontUInt32 *dst, int n, PFontUInt32 color)
+{
+	int i = 0;
+#ifdef PFONT_USE_SSE2
+	const __m128i solid = _mm_set1_epi32((int)color);
+	for (; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i*)(dst + i), solid);
+#endif
+	for (; i < n; i++) dst[i] = color;
+}
+
+inline bool PFontBlitSpans(PFontUInt32 *dst, long pitch, int w, int h, int x, int y,
+						   const PFontSpanList &list, PFontUInt32 color, int *rect = NULL)
+{
+	color |= 0xFF000000;
+	bool drawn = false;
+	int l = w, t = h, r = 0, b = 0;
+	for (size_t i = 0; i < list.spans.size(); i++) {
+		const PFontSpan &s = list.spans[i];
+		const int sy = y + s.y;
+		if (sy < 0) continue;
+		if (sy >= h) break; // 行順なので以降は範囲外
+		int sx = x + s.x, n = s.length, skip = 0;
+		if (sx < 0) skip = -sx, n += sx, sx = 0;
+		if (sx + n > w) n = w - sx;
+		if (n <= 0) continue;
+		PFontUInt32 *line = dst + sy * pitch + sx;
+		if (s.opaque) PFontFillLine(line, n, color);
+		else PFontBlendLine(line, &list.coverage[s.offset + skip], n, color);
+		if (l > sx) l = sx;
+		if (t > sy) t = sy;
+		if (r < sx + n) r = sx + n;
+		if (b < sy + 1) b = sy + 1;
+		drawn = true;
+	}
+	if (drawn && rect) {
+		if (rect[0] > l) rect[0] = l;
+		if (rect[1] > t) rect[1] = t;
+		if (rect[2] < r) rect[2] = r;
+		if (rect[3] < b) rect[3] = b;
+	}
+	return drawn;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+// レンダリング済みフォントの重ね合わせ（パッチファイル：プラットフォーム非依存部）
+//
+// パッチファイルは追加・差し替えるグリフだけを持つ通常の tft ファイル
+// 複数のファイルを優先順（パッチ → ベース）に重ね，コード表を1つにまとめた参照表で引く
+// 参照表は各ファイルのグリフ番号を指すだけで，イメージはそれぞれのファイルのデータのまま使う
+// 平坦化（1つのファイルにまとめる）では圧縮イメージをそのままコピーする（再圧縮しない）
+
+#include "pfont.hpp"
+
+// 圧縮イメージの実際の長さ（srclen は上限値）
+// @return データが足りなければ false
+inline bool PFontGlyphLength(int mode, const PFontUInt8 *src, size_t srclen, int w, int h, size_t &len)
+{
+	const size_t pixels = (size_t)w * h;
+	mode &= PFontModeMask;
+	if (mode != PFontMode65) {
+		len = pixels ? PFontPackedSize(mode, pixels) : 0;
+		return len <= srclen;
+	}
+	const PFontUInt8 *s = src, *send = src + srclen;
+	for (size_t done = 0; done < pixels;) {
+		if (s >= send) return false;
+		const PFontUInt8 v = *s++;
+		done += (v <= 0x40) ? 1 : v - 0x40;
+	}
+	len = (size_t)(s - src);
+	return true;
+}
+
+//--------------------------------------------------------------
+// 重ね合わせた参照表
+
+struct PFontStack
+{
+	std::vector<const PFontData*> layers; // 優先順（先頭がいちばん上のパッチ）
+	std::vector<PFontUInt16> codes;        // まとめたコード表（昇順）
+	std::vector<PFontUInt16> layer;        // 各コードのグリフがあるファイル
+	std::vector<PFontUInt32> glyph;        // そのファイルでのグリフ番号
+	PFontUInt32 count;
+
+	PFontStack() : count(0) {}
+
+	// 各ファイルのコード表（昇順）を併合する：同じコードは先のファイルを使う
+	void assign(const std::vector<const PFontData*> &list) {
+		layers = list;
+		codes.clear();
+		layer.clear();
+		glyph.clear();
+		size_t total = 0;
+		for (size_t l = 0; l < layers.size(); l++) total += layers[l]->count;
+		codes.reserve(total);
+		layer.reserve(total);
+		glyph.reserve(total);
+
+		std::vector<PFontUInt32> pos(layers.size(), 0);
+		for (;;) {
+			long best = -1;
+			PFontUInt16 code = 0;
+			for (size_t l = 0; l < layers.size(); l++) {
+				if (pos[l] >= layers[l]->count) continue;
+				const PFontUInt16 c = layers[l]->codes[pos[l]];
+				if (best < 0 || c < code) best = (long)l, code = c;
+			}
+			if (best < 0) break;
+			codes.push_back(code);
+			layer.push_back((PFontUInt16)best);
+			glyph.push_back(pos[best]);
+			for (size_t l = 0; l < layers.size(); l++) // 下のファイルの同じコードは隠れる
+				if (pos[l] < layers[l]->count && layers[l]->codes[pos[l]] == code) pos[l]++;
+		}
+		count = (PFontUInt32)codes.size();
+	}
+
+	long find(PFontUInt16 ch) const {
+		return count ? PFontFindCode(&codes.front(), count, ch) : -1;
+	}
+	const PFontData&  getData (PFontUInt32 n) const { return *layers[layer[n]]; }
+	const PFontIndex& getIndex(PFontUInt32 n) const { return layers[layer[n]]->index[glyph[n]]; }
+
+	bool decode(PFontUInt32 n, std::vector<PFontUInt8> &buf) const {
+		return getData(n).decode(glyph[n], buf);
+	}
+
+	// ベースラインから上下の最大ピクセル数
+	void getExtent(int &ascent, int &descent) const {
+		ascent = descent = 0;
+		for (PFontUInt32 n = 0; n < count; n++) {
+			const PFontIndex &idx = getIndex(n);
+			if (!idx.height) continue;
+			if (ascent  < idx.origin_y) ascent  = idx.origin_y;
+			if (descent < idx.height - idx.origin_y) descent = idx.height - idx.origin_y;
+		}
+	}
+};
+
+//--------------------------------------------------------------
+// 1つのファイルに保存する（平坦化）
+//
+// select : 保存するグリフの参照表での番号（昇順：NULL なら全部）
+// 圧縮イメージはそのままコピーし，同じファイルで共有されていたイメージは共有したままにする
+// 各ファイルのイメージ領域は読み込み済みであること
+
+template <class Saver>
+void PFontFlattenStack(Saver &saver, const PFontStack &stack, const std::vector<PFontUInt32> *select = NULL)
+{
+	typedef PFontUInt32 SizeType;
+	const PFontUInt32 count = select ? (PFontUInt32)select->size() : stack.count;
+	if (!count) saver.error("empty characters");
+
+	std::vector<PFontUInt16> codes(count);
+	std::vector<PFontIndex>  index(count);
+	std::map<std::pair<PFontUInt32, PFontUInt32>, PFontUInt32> shared; // (ファイル, 元のオフセット) => 新しいオフセット
+	for (PFontUInt32 i = 0; i < count; i++) {
+		const PFontUInt32 n = select ? (*select)[i] : i;
+		const PFontData &data = stack.getData(n);
+		PFontIndex &info = index[i];
+		codes[i] = stack.codes[n];
+		info = stack.getIndex(n);
+		if (info.reserved & PFontModeMask) saver.packedUsed = true;
+		const PFontUInt32 offset = info.offset;
+		info.offset = saver.getPos();
+		if (!info.width || !info.height) continue;
+
+		const std::pair<PFontUInt32, PFontUInt32> key(stack.layer[n], offset);
+		std::map<std::pair<PFontUInt32, PFontUInt32>, PFontUInt32>::const_iterator it = shared.find(key);
+		if (it != shared.end()) {
+			info.offset = it->second;
+			continue;
+		}
+		const PFontUInt8 *src = 0;
+		size_t len = 0, size = 0;
+		if (!data.getImage(stack.glyph[n], src, len) ||
+			!PFontGlyphLength(info.reserved, src, len, info.width, info.height, size)) saver.error("invalid glyph image");
+		shared[key] = info.offset;
+		if (size) saver.write(src, (SizeType)size);
+	}
+
+	SizeType padding = 0;
+	SizeType chindexpos = saver.align(padding);
+	saver.write(&codes.front(), (SizeType)(count * sizeof(PFontUInt16)));
+	SizeType indexpos = saver.align(padding);
+	saver.write(&index.front(), (SizeType)(count * sizeof(PFontIndex)));
+	saver.writeHeader(count, chindexpos, indexpos);
+}
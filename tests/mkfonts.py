@@ -0,0 +1,76 @@
+# テスト用の最小フォント（tests/testfonts.inc）を作成する
+#   python3 mkfonts.py > testfonts.inc   （fontTools が必要）
+# glyf 版は 'O'（二次曲線の外周と逆回りの内周），CFF 版は 'S'（三次曲線）の1文字のみ
+import io
+from fontTools.fontBuilder import FontBuilder
+from fontTools.pens.ttGlyphPen import TTGlyphPen
+from fontTools.pens.t2CharStringPen import T2CharStringPen
+from fontTools.ttLib import TTFont
+
+KEEP = ("head", "hhea", "maxp", "hmtx", "cmap", "loca", "glyf", "CFF ")
+
+def draw_o(pen):
+    pen.moveTo((100, 350))
+    pen.qCurveTo((100, 720), (380, 720))
+    pen.qCurveTo((660, 720), (660, 350))
+    pen.qCurveTo((660, -20), (380, -20))
+    pen.qCurveTo((100, -20), (100, 350))
+    pen.closePath()
+    pen.moveTo((210, 350))
+    pen.qCurveTo((210, 80), (380, 80))
+    pen.qCurveTo((550, 80), (550, 350))
+    pen.qCurveTo((550, 620), (380, 620))
+    pen.qCurveTo((210, 620), (210, 350))
+    pen.closePath()
+
+def draw_s(pen):
+    pen.moveTo((560, 640))
+    pen.curveTo((480, 710), (150, 760), (120, 540))
+    pen.curveTo((95, 360), (560, 420), (570, 200))
+    pen.curveTo((580, -40), (170, -40), (80, 80))
+    pen.lineTo((150, 150))
+    pen.curveTo((220, 60), (470, 40), (460, 200))
+    pen.curveTo((450, 340), (20, 300), (30, 540))
+    pen.curveTo((45, 810), (520, 760), (620, 690))
+    pen.closePath()
+
+def build(cff):
+    fb = FontBuilder(1000, isTTF=not cff)
+    order = [".notdef", "glyph"]
+    fb.setupGlyphOrder(order)
+    fb.setupCharacterMap({0x53 if cff else 0x4F: "glyph"})
+    if cff:
+        empty = T2CharStringPen(600, None)
+        pen = T2CharStringPen(660, None)
+        draw_s(pen)
+        fb.setupCFF("T", {"FullName": "T"}, {".notdef": empty.getCharString(), "glyph": pen.getCharString()}, {})
+    else:
+        pen = TTGlyphPen(None)
+        draw_o(pen)
+        fb.setupGlyf({".notdef": TTGlyphPen(None).glyph(), "glyph": pen.glyph()})
+    fb.setupHorizontalMetrics({".notdef": (600, 0), "glyph": (760 if not cff else 660, 100 if not cff else 20)})
+    fb.setupHorizontalHeader(ascent=800, descent=-200)
+    fb.setupNameTable({"familyName": "T", "styleName": "Regular"})
+    fb.setupOS2()
+    fb.setupPost()
+    font = fb.font
+    for t in list(font.keys()):
+        if t not in KEEP and t != "GlyphOrder":
+            del font[t]
+    font["head"].created = font["head"].modified = 0 # 作成し直しても同じ内容になるように
+    font.recalcTimestamp = False
+    out = io.BytesIO()
+    font.save(out)
+    return out.getvalue()
+
+def emit(name, data):
+    print("static const unsigned char %s[%d] = {" % (name, len(data)))
+    for i in range(0, len(data), 16):
+        print("\t" + ", ".join("0x%02X" % b for b in data[i:i+16]) + ",")
+    print("};")
+
+print("// tests/mkfonts.py で作成（直接編集しないこと）")
+print("")
+emit("PFontTestFontGlyf", build(False))
+print("")
+emit("PFontTestFontCFF", build(True))
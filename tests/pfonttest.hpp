@@ -0,0 +1,39 @@
+#pragma once
+
+// プラットフォーム非依存部の単体テスト用の確認マクロ（テストごとに1つの実行ファイル）
+//
+// PFONT_CHECK(cond)     : 偽なら式と位置を表示して失敗を数える
+// PFONT_CHECK_EQ(a, b)  : 整数の比較（失敗時は両方の値も表示する）
+// return PFontTestResult("name"); で main を終える（失敗があれば 1）
+
+#include <cstdio>
+
+inline int &PFontTestFailures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+#define PFONT_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			PFontTestFailures()++; \
+		} \
+	} while (0)
+
+#define PFONT_CHECK_EQ(a, b) \
+	do { \
+		const long long va_ = (long long)(a), vb_ = (long long)(b); \
+		if (va_ != vb_) { \
+			fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, va_, vb_); \
+			PFontTestFailures()++; \
+		} \
+	} while (0)
+
+inline int PFontTestResult(const char *name)
+{
+	if (PFontTestFailures()) fprintf(stderr, "%s: %d checks failed\n", name, PFontTestFailures());
+	else printf("%s: OK\n", name);
+	return PFontTestFailures() ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+// 一括作成（PFontManifest / PFontBuilder）のテスト
+//
+// 合成グリフ（PFontSyntheticSource）で GDI を使わずに
+// マニフェストの解釈・ターゲットごとの失敗の分離・進捗と完了の通知の順序を確認する
+
+#include "pfontbuild.hpp"
+#include "pfonttest.hpp"
+
+static bool parseError(const char *text, const char *expect)
+{
+	PFontManifest manifest;
+	std::string error;
+	if (manifest.parse(text, error)) return false;
+	if (error != expect) fprintf(stderr, "error: %s (expected %s)\n", error.c_str(), expect);
+	return error == expect;
+}
+
+static void testManifest()
+{
+	PFontManifest manifest;
+	std::string error;
+	const char *text =
+		"\xEF\xBB\xBF# output\tface\tsize\tflags\tcharset\r\n"
+		"a.tft\tsynthetic\t24\t-\tU+0041-U+005A\r\n"
+		"\r\n"
+		"b.tft\tsynthetic\t16\tbold+italic+packed\tU+3042, chars.txt\r\n"
+		"c.tft\tfont.ttc#1\t32\tgray4\tU+0041-U+005A\n";
+	PFONT_CHECK(manifest.parse(text, error));
+	PFONT_CHECK_EQ(manifest.targets.size(), 3);
+	if (manifest.targets.size() == 3) {
+		const PFontBuildTarget &a = manifest.targets[0], &b = manifest.targets[1], &c = manifest.targets[2];
+		PFONT_CHECK(a.output == "a.tft" && a.face == "synthetic" && a.size == 24 && a.flags == 0);
+		PFONT_CHECK(b.output == "b.tft" && b.size == 16 && b.flags == (PFontBold | PFontItalic | PFontPacked));
+		PFONT_CHECK(b.charset == "U+3042 chars.txt");
+		PFONT_CHECK(c.face == "font.ttc#1" && c.flags == PFontGray4);
+	}
+
+	// テキストファイルは1回だけ読み込み，同じ指定の文字セットは共有する
+	int loads = 0;
+	PFONT_CHECK(manifest.resolve([&](const std::string &name, PFontCharSet &chars) {
+		loads++;
+		if (name != "chars.txt") return false;
+		PFontAddTextChars(chars, "\xE3\x81\x84\xE3\x81\x86\n"); // いう
+		return true;
+	}, error));
+	PFONT_CHECK_EQ(loads, 1);
+	PFONT_CHECK_EQ(manifest.getCharSetCount(), 2);
+	if (manifest.targets.size() == 3) {
+		PFONT_CHECK(manifest.targets[0].chars == manifest.targets[2].chars);
+		std::vector<PFontUInt16> codes;
+		manifest.targets[1].chars->getCodes(codes);
+		PFONT_CHECK_EQ(codes.size(), 3);
+	}
+
+	PFONT_CHECK(parseError("a.tft\tsynthetic\t24\t-\n", "manifest line 1: too few fields"));
+	PFONT_CHECK(parseError("#\na.tft\tsynthetic\t0\t-\tU+0041\n", "manifest line 2: invalid size"));
+	PFONT_CHECK(parseError("a.tft\tsynthetic\t24\tunderline\tU+0041\n", "manifest line 1: unknown flag"));
+
+	PFontManifest bad;
+	PFONT_CHECK(bad.parse("a.tft\tsynthetic\t24\t-\tU+0041-U+0030\n", error));
+	PFONT_CHECK(!bad.resolve([](const std::string&, PFontCharSet&) { return false; }, error));
+	PFONT_CHECK(error == "can't read charset:U+0041-U+0030");
+}
+
+// 指定した文字で例外を出す供給元
+class FailingSource : public PFontSyntheticSource
+{
+	PFontUInt16 fail;
+public:
+	FailingSource(int size, PFontUInt16 fail) : PFontSyntheticSource(size, 0), fail(fail) {}
+	bool render(PFontUInt16 ch, PFontGlyph &glyph) {
+		if (ch == fail) throw std::runtime_error("render failed");
+		return PFontSyntheticSource::render(ch, glyph);
+	}
+};
+
+// ヘッダの読み込みでエラーになるか（確保の前に "invalid tft header" で止まること）
+static bool headerError(std::vector<PFontUInt8> file)
+{
+	try {
+		PFontData data;
+		PFontLoaderT<PFontMemoryStream> loader(&file);
+		loader.readData(data);
+	} catch (const std::exception &e) {
+		return std::string(e.what()) == "invalid tft header";
+	}
+	return false;
+}
+
+static void setHeader(std::vector<PFontUInt8> &file, PFontUInt32 count, PFontUInt32 chindexpos, PFontUInt32 indexpos)
+{
+	memcpy(&file[PFontHeaderLength],     &count,      4);
+	memcpy(&file[PFontHeaderLength + 4], &chindexpos, 4);
+	memcpy(&file[PFontHeaderLength + 8], &indexpos,   4);
+}
+
+static void testHeader(const std::vector<PFontUInt8> &valid)
+{
+	PFontUInt32 count, chindexpos, indexpos;
+	memcpy(&count,      &valid[PFontHeaderLength],     4);
+	memcpy(&chindexpos, &valid[PFontHeaderLength + 4], 4);
+	memcpy(&indexpos,   &valid[PFontHeaderLength + 8], 4);
+	PFONT_CHECK(!headerError(valid));
+
+	// 文字数だけのファイル（count * 2 が32bitで桁あふれする値も含む）
+	std::vector<PFontUInt8> file(valid.begin(), valid.begin() + PFontHeaderLength + 12);
+	const PFontUInt32 end = (PFontUInt32)file.size();
+	setHeader(file, 0x80000000, end, end);
+	PFONT_CHECK(headerError(file));
+	setHeader(file, 0xFFFFFFFF, end, end);
+	PFONT_CHECK(headerError(file));
+	setHeader(file, 0, end, end);
+	PFONT_CHECK(!headerError(file));
+
+	// 位置がファイルの外・ヘッダの内側
+	file = valid;
+	setHeader(file, count, (PFontUInt32)file.size() + 1, indexpos);
+	PFONT_CHECK(headerError(file));
+	setHeader(file, count, PFontHeaderLength, indexpos);
+	PFONT_CHECK(headerError(file));
+	setHeader(file, count, chindexpos, 0xFFFFFFF0);
+	PFONT_CHECK(headerError(file));
+	setHeader(file, count + 1, chindexpos, indexpos);
+	PFONT_CHECK(headerError(file));
+
+	// 末尾が欠けたファイル
+	file = valid;
+	file.pop_back();
+	PFONT_CHECK(headerError(file));
+}
+
+static void testBuilder()
+{
+	PFontManifest manifest;
+	std::string error;
+	PFONT_CHECK(manifest.parse(
+		"ok1.tft\tsynthetic\t12\t-\tU+4E00-U+51FF\n"     // 1024文字
+		"fail.tft\tfailing\t12\t-\tU+4E00-U+51FF\n"      // 600文字目で失敗
+		"none.tft\tmissing\t12\t-\tU+0041-U+005A\n"      // 供給元なし
+		"cached.tft\tsynthetic\t12\t-\tU+0041-U+005A\n"  // キャッシュ済み
+		"ok2.tft\tsynthetic\t20\tpacked\tU+0020-U+007E\n", error));
+	PFONT_CHECK(manifest.resolve([](const std::string&, PFontCharSet&) { return false; }, error));
+	std::vector<PFontBuildTarget> &targets = manifest.targets;
+	if (targets.size() != 5) {
+		PFontTestFailures()++;
+		return;
+	}
+	targets[3].cached = true;
+
+	PFontBuilder builder(targets, [](const PFontBuildTarget &t) -> PFontGlyphSource* {
+		if (t.face == "synthetic") return new PFontSyntheticSource(t.size, t.flags);
+		if (t.face == "failing")   return new FailingSource(t.size, 0x4E00 + 600);
+		return 0;
+	}, 3);
+	builder.start();
+
+	// 各ターゲットの進捗は増加し，完了はちょうど1回・そのターゲットの最後の通知になる
+	std::vector<PFontUInt32> last(targets.size(), 0);
+	std::vector<int> finished(targets.size(), 0), progress(targets.size(), 0);
+	PFontBuildEvent ev;
+	while (builder.wait(ev)) {
+		PFONT_CHECK(ev.target < targets.size());
+		if (ev.target >= targets.size()) continue;
+		PFONT_CHECK(!finished[ev.target]);
+		PFONT_CHECK(ev.done >= last[ev.target] && ev.done <= ev.total);
+		last[ev.target] = ev.done;
+		if (ev.finished) {
+			finished[ev.target]++;
+			PFONT_CHECK_EQ(ev.done, ev.total);
+		} else progress[ev.target]++;
+	}
+	for (size_t i = 0; i < targets.size(); i++) PFONT_CHECK_EQ(finished[i], 1);
+	PFONT_CHECK_EQ(progress[0], 4);
+	PFONT_CHECK_EQ(progress[1], 2); // 失敗するまでの進捗は通知される
+	PFONT_CHECK_EQ(progress[3], 0);
+
+	// 失敗したターゲットだけがエラーになり，他は作成される
+	PFONT_CHECK(targets[1].error == "render failed" && targets[1].file.empty());
+	PFONT_CHECK(targets[2].error == "no glyph source:missing" && targets[2].file.empty());
+	PFONT_CHECK(targets[3].error.empty() && targets[3].file.empty());
+	const size_t built[] = { 0, 4 };
+	const PFontUInt32 counts[] = { 1024, 95 };
+	for (int k = 0; k < 2; k++) {
+		PFontBuildTarget &t = targets[built[k]];
+		PFONT_CHECK(t.error.empty());
+		PFONT_CHECK_EQ(t.glyphs, counts[k]);
+		PFontData data;
+		PFontLoaderT<PFontMemoryStream> loader(&t.file);
+		loader.readData(data);
+		PFONT_CHECK_EQ(data.count, counts[k]);
+		PFontSyntheticSource source(t.size, t.flags);
+		for (PFontUInt32 n = 0; n < data.count; n++) {
+			PFontGlyph g;
+			source.render(data.codes[n], g);
+			std::vector<PFontUInt8> buf;
+			PFONT_CHECK(data.decode(n, buf));
+			if (buf != g.image) {
+				fprintf(stderr, "%s: glyph U+%04X differs\n", t.output.c_str(), data.codes[n]);
+				PFontTestFailures()++;
+				break;
+			}
+		}
+	}
+	testHeader(targets[4].file);
+}
+
+int main()
+{
+	testManifest();
+	testBuilder();
+	return PFontTestResult("test_build");
+}
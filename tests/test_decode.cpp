@@ -0,0 +1,110 @@
+// 65段階ランレングス圧縮の展開（PFontDecode65）のテスト
+//
+// 既知の圧縮データを各出力ピクセル形式（Conv）で展開し，
+// 先頭のラン（アンダーフロー）・末尾を越えるラン（オーバーラン）・途中で切れたデータを確認する
+
+#include <cstdlib>
+#include "pfont.hpp"
+#include "pfonttest.hpp"
+
+static const PFontUInt32 Guard = 0xA5A5A5A5;
+
+struct Case
+{
+	const char *name;
+	std::vector<PFontUInt8> src;
+	int w, h;
+	std::vector<PFontUInt8> expect; // 0〜64（w*h）
+	bool ok;
+	size_t used;
+};
+
+// pitch を w+1 にして行末の1ピクセルと出力の後ろに番兵を置き，書き込み範囲も確認する
+template <class Conv>
+static void checkCase(const Case &c)
+{
+	typedef typename Conv::Pixel Pixel;
+	const long pitch = c.w + 1;
+	std::vector<Pixel> dst((size_t)pitch * c.h + 4, (Pixel)Guard);
+	size_t used = 0;
+	const bool ok = PFontDecode65<Conv>(c.src.empty() ? 0 : &c.src.front(), c.src.size(), c.w, c.h, &dst.front(), pitch, &used);
+	PFONT_CHECK_EQ(ok, c.ok);
+	PFONT_CHECK_EQ(used, c.used);
+	if (!c.ok) return;
+	for (int y = 0; y < c.h; y++) {
+		for (int x = 0; x < c.w; x++) {
+			const Pixel v = dst[(size_t)y * pitch + x];
+			if (v != Conv::conv(c.expect[(size_t)y * c.w + x])) {
+				fprintf(stderr, "%s: pixel (%d,%d) = %u\n", c.name, x, y, (unsigned)v);
+				PFontTestFailures()++;
+			}
+		}
+		PFONT_CHECK(dst[(size_t)y * pitch + c.w] == (Pixel)Guard);
+	}
+	for (size_t i = (size_t)pitch * c.h; i < dst.size(); i++) PFONT_CHECK(dst[i] == (Pixel)Guard);
+}
+
+static Case makeCase(const char *name, std::initializer_list<int> src, int w, int h, std::initializer_list<int> expect, bool ok, size_t used)
+{
+	Case c;
+	c.name = name;
+	for (int v : src) c.src.push_back((PFontUInt8)v);
+	c.w = w;
+	c.h = h;
+	for (int v : expect) c.expect.push_back((PFontUInt8)v);
+	c.ok = ok;
+	c.used = used;
+	return c;
+}
+
+int main()
+{
+	std::vector<Case> cases;
+	// 値とランの混在（後続のグリフのデータは読まない）
+	cases.push_back(makeCase("basic", { 0x00, 0x40, 0x20, 0x42, 0x10, 0x42, 0x33, 0x33 }, 4, 2,
+							 { 0, 64, 32, 32, 32, 16, 16, 16 }, true, 6));
+	// 先頭のラン：直前の値は 0 とみなす
+	cases.push_back(makeCase("underflow", { 0x43, 0x40 }, 2, 2, { 0, 0, 0, 64 }, true, 2));
+	// 末尾を越えるラン：残りのピクセルだけ書いて終わる
+	cases.push_back(makeCase("overrun", { 0x40, 0x4A, 0x20 }, 2, 2, { 64, 64, 64, 64 }, true, 2));
+	// 行をまたぐラン
+	cases.push_back(makeCase("wrap", { 0x08, 0x44, 0x30 }, 3, 2, { 8, 8, 8, 8, 8, 48 }, true, 3));
+	// 途中で切れたデータ
+	cases.push_back(makeCase("truncated", { 0x40, 0x41 }, 2, 2, {}, false, 2));
+	cases.push_back(makeCase("empty", {}, 1, 1, {}, false, 0));
+
+	for (size_t i = 0; i < cases.size(); i++) {
+		checkCase<PFontConv64>(cases[i]);
+		checkCase<PFontConv255>(cases[i]);
+		checkCase<PFontConvARGB>(cases[i]);
+		checkCase<PFontConvARGBPremul>(cases[i]);
+	}
+
+	// 各形式の変換値
+	PFONT_CHECK_EQ(PFontConv255::conv(64), 255);
+	PFONT_CHECK_EQ(PFontConv255::conv(32), 127);
+	PFONT_CHECK_EQ(PFontConvARGB::conv(0),  0u);
+	PFONT_CHECK_EQ(PFontConvARGB::conv(32), 0x80FFFFFFu);
+	PFONT_CHECK_EQ(PFontConvARGB::conv(64), 0xFFFFFFFFu);
+	PFONT_CHECK_EQ(PFontConvARGBPremul::conv(32), 0x80808080u);
+	PFONT_CHECK_EQ(PFontConvARGBPremul::conv(64), 0xFFFFFFFFu);
+
+	// 圧縮と展開の往復（190 を超えるランを含む）
+	srand(1);
+	for (int n = 0; n < 200; n++) {
+		const int w = 1 + rand() % 70, h = 1 + rand() % 9;
+		std::vector<PFontUInt8> img((size_t)w * h);
+		for (size_t i = 0; i < img.size();) {
+			const size_t run = (rand() % 4) ? 1 + rand() % 4 : 1 + rand() % 300;
+			const PFontUInt8 v = (PFontUInt8)((rand() % 3) ? (rand() % 2) * 64 : rand() % 65);
+			for (size_t k = 0; k < run && i < img.size(); k++) img[i++] = v;
+		}
+		std::vector<PFontUInt8> enc(img.size()), dec(img.size());
+		const size_t len = PFontEncode65(&img.front(), img.size(), &enc.front());
+		size_t used = 0;
+		PFONT_CHECK(PFontDecode65<PFontConv64>(&enc.front(), len, w, h, &dec.front(), w, &used));
+		PFONT_CHECK_EQ(used, len);
+		PFONT_CHECK(dec == img);
+	}
+	return PFontTestResult("test_decode");
+}
@@ -0,0 +1,98 @@
+// 1/2/4bit 格納形式（PFontEncodeGlyph / PFontUnpack / PFontDecodeGlyph）のテスト
+//
+// 8 の倍数でないピクセル数・奇数の幅で圧縮と展開を往復し，
+// PFontUnpack は詰め込みのビット配置から直接求めた値と比較する
+// （SIMD 版・PFONT_NO_SIMD 版の実行ファイルがどちらも同じ基準と一致することで SSSE3 版と表引き版の一致を確認する）
+
+#include <cstdlib>
+#include "pfont.hpp"
+#include "pfonttest.hpp"
+
+// 基準：ピクセル i は i*bits ビット目から bits ビット（下位ビットから順）
+static void referenceUnpack(int mode, const PFontUInt8 *src, size_t pixels, PFontUInt8 *dst)
+{
+	int count = 0;
+	const PFontUInt8 *levels = PFontModeLevels(mode, count);
+	const int bits = PFontModeBits(mode);
+	for (size_t i = 0; i < pixels; i++) {
+		const size_t bit = i * bits;
+		dst[i] = levels[(src[bit >> 3] >> (bit & 7)) & (count - 1)];
+	}
+}
+
+static void checkUnpack(int mode, size_t pixels)
+{
+	const size_t len = PFontPackedSize(mode, pixels);
+	std::vector<PFontUInt8> src(len + 1);
+	for (size_t i = 0; i < src.size(); i++) src[i] = (PFontUInt8)rand();
+	std::vector<PFontUInt8> expect(pixels + 1), dst(pixels + 16, 0xEE);
+	if (pixels) referenceUnpack(mode, &src.front(), pixels, &expect.front());
+	PFONT_CHECK(PFontUnpack(mode, &src.front(), len, pixels, &dst.front()));
+	for (size_t i = 0; i < pixels; i++) {
+		if (dst[i] != expect[i]) {
+			fprintf(stderr, "unpack mode %d pixels %u: [%u] = %u (expected %u)\n", mode, (unsigned)pixels, (unsigned)i, dst[i], expect[i]);
+			PFontTestFailures()++;
+			break;
+		}
+	}
+	for (size_t i = pixels; i < dst.size(); i++) PFONT_CHECK(dst[i] == 0xEE);
+	if (len) PFONT_CHECK(!PFontUnpack(mode, &src.front(), len - 1, pixels, &dst.front()));
+}
+
+// 段階値だけを使ったグリフを圧縮・展開する
+static void checkRoundTrip(int mode, int w, int h)
+{
+	int count = 0;
+	const PFontUInt8 *levels = PFontModeLevels(mode, count);
+	const size_t pixels = (size_t)w * h;
+	std::vector<PFontUInt8> img(pixels);
+	for (size_t i = 0; i < pixels; i++) img[i] = levels[rand() % count];
+	img[0] = levels[count - 1]; // 4bit の画像が 2bit にならないように段階値をそろえる
+	if (pixels > 1) img[1] = levels[1];
+
+	std::vector<PFontUInt8> enc(pixels);
+	PFontUInt16 stored = 0;
+	const size_t len = PFontEncodeGlyph(&img.front(), pixels, &enc.front(), true, stored);
+	// 乱数の画像ではランレングス圧縮より必ず小さくなる
+	if (pixels >= 16) PFONT_CHECK_EQ(stored, mode);
+	if (stored != PFontMode65) PFONT_CHECK_EQ(len, PFontPackedSize(stored, pixels));
+
+	const long pitch = w + 3;
+	std::vector<PFontUInt8> dec((size_t)pitch * h, 0xEE);
+	size_t used = 0;
+	PFONT_CHECK(PFontDecodeGlyph<PFontConv64>(stored, &enc.front(), len, w, h, &dec.front(), pitch, &used));
+	PFONT_CHECK_EQ(used, len);
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			if (dec[(size_t)y * pitch + x] != img[(size_t)y * w + x]) {
+				fprintf(stderr, "round trip mode %d %dx%d: pixel (%d,%d)\n", mode, w, h, x, y);
+				PFontTestFailures()++;
+				return;
+			}
+		}
+		for (int x = w; x < pitch; x++) PFONT_CHECK(dec[(size_t)y * pitch + x] == 0xEE);
+	}
+}
+
+int main()
+{
+#ifdef PFONT_USE_SSSE3
+	printf("SSSE3 unpack enabled\n");
+#else
+	printf("table unpack only\n");
+#endif
+	srand(2);
+	for (int mode = PFontMode1Bit; mode <= PFontMode4Bit; mode++) {
+		for (size_t pixels = 0; pixels <= 130; pixels++) checkUnpack(mode, pixels);
+		checkUnpack(mode, 1001);
+		const int sizes[][2] = { { 1, 1 }, { 1, 7 }, { 3, 3 }, { 5, 7 }, { 7, 5 }, { 9, 13 }, { 15, 17 }, { 17, 1 }, { 31, 33 }, { 33, 31 }, { 63, 65 } };
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) checkRoundTrip(mode, sizes[i][0], sizes[i][1]);
+	}
+
+	// 段階値以外を含む画像は常にランレングス圧縮
+	PFontUInt8 img[9] = { 0, 1, 2, 3, 4, 5, 6, 7, 8 }, enc[9];
+	PFontUInt16 stored = 0xFF;
+	PFontEncodeGlyph(img, 9, enc, true, stored);
+	PFONT_CHECK_EQ(stored, PFontMode65);
+	return PFontTestResult("test_packed");
+}
@@ -0,0 +1,81 @@
+// アウトラインの描画（PFontRenderOutline）のゴールデンイメージテスト
+//
+// glyf（二次曲線）と CFF（三次曲線）の最小フォントの1文字を描画し，
+// メトリクスとイメージのハッシュを記録した値と比較する
+// SIMD 版と PFONT_NO_SIMD 版の実行ファイルが同じ値と一致することで，ビルドによらず同じ結果になることを確認する
+// （描画を変更した場合は，表示された値を確認したうえで表を更新し，pfontcache.hpp の PFontCacheVersion も上げること）
+
+#include "pfontraster.hpp"
+#include "pfontcache.hpp"
+#include "pfonttest.hpp"
+#include "testfonts.inc"
+
+struct Golden
+{
+	int font;         // 0:glyf 1:CFF
+	PFontUInt16 code;
+	int size;
+	bool bold, italic;
+	int width, height, originX, originY, inc;
+	PFontUInt64 hash; // イメージ（0〜64）の PFontHash64
+};
+
+static const Golden goldens[] = {
+	{ 0, 'O', 37, false, false, 22, 28, 3, 27, 28, 0x16278FE59390391AULL },
+	{ 0, 'O', 24, true , true , 16, 19, 3, 18, 19, 0xC740E3A22D020586ULL },
+	{ 1, 'S', 37, false, false, 22, 28, 1, 28, 24, 0x50C5E0E0C7ACDFBDULL },
+	{ 1, 'S', 24, true , true , 18, 18, 2, 18, 17, 0x8C735831E85A4968ULL },
+};
+
+static void dump(const PFontGlyph &g)
+{
+	static const char shade[] = " .:-=+*#%@";
+	for (int y = 0; y < g.info.height; y++) {
+		std::string line;
+		for (int x = 0; x < g.info.width; x++) line += shade[g.image[(size_t)y * g.info.width + x] * 9 / 64];
+		fprintf(stderr, "  |%s|\n", line.c_str());
+	}
+}
+
+int main()
+{
+#ifdef PFONT_USE_SSE2
+	printf("SSE2 accumulate\n");
+#else
+	printf("scalar accumulate\n");
+#endif
+	PFontOutlineFont fonts[2];
+	const unsigned char *files[2] = { PFontTestFontGlyf, PFontTestFontCFF };
+	const size_t sizes[2] = { sizeof(PFontTestFontGlyf), sizeof(PFontTestFontCFF) };
+	for (int i = 0; i < 2; i++) {
+		std::vector<PFontUInt8> file(files[i], files[i] + sizes[i]);
+		std::string error;
+		PFONT_CHECK(fonts[i].load(file, 0, error));
+		PFONT_CHECK_EQ(fonts[i].getGlyphCount(), 2);
+	}
+	PFONT_CHECK_EQ(fonts[0].getGlyphIndex('O'), 1);
+	PFONT_CHECK_EQ(fonts[1].getGlyphIndex('S'), 1);
+
+	for (size_t i = 0; i < sizeof(goldens) / sizeof(goldens[0]); i++) {
+		const Golden &e = goldens[i];
+		const PFontOutlineFont &font = fonts[e.font];
+		PFontGlyph g;
+		g.code = e.code;
+		memset(&g.info, 0, sizeof(g.info));
+		PFONT_CHECK(PFontRenderOutline(font, font.getGlyphIndex(e.code), e.size, e.bold, e.italic, g));
+		PFontHash64 h;
+		if (!g.image.empty()) h.add(&g.image.front(), g.image.size());
+		const PFontIndex &info = g.info;
+		if (info.width != e.width || info.height != e.height || info.origin_x != e.originX || info.origin_y != e.originY ||
+			info.inc != e.inc || h.value != e.hash) {
+			fprintf(stderr, "golden %u (%s %c %d%s%s) differs:\n", (unsigned)i, e.font ? "CFF" : "glyf", e.code, e.size,
+					e.bold ? " bold" : "", e.italic ? " italic" : "");
+			fprintf(stderr, "  { %d, '%c', %d, %s, %s, %d, %d, %d, %d, %d, 0x%016llXULL },\n", e.font, e.code, e.size,
+					e.bold ? "true " : "false", e.italic ? "true " : "false",
+					info.width, info.height, info.origin_x, info.origin_y, info.inc, (unsigned long long)h.value);
+			dump(g);
+			PFontTestFailures()++;
+		}
+	}
+	return PFontTestResult("test_raster");
+}
@@ -0,0 +1,145 @@
+// スパン（PFontDecodeSpans / PFontBlitSpans）のテスト
+//
+// 乱数のグリフを65段階ランレングス圧縮・1/2/4bit 形式で圧縮し，
+// スパンで描画した結果が展開したイメージを PFontBlitImage で描画した結果と一致することを確認する
+// （不透明の連続・短い隙間・中間値を混ぜて不透明スパンへの繰り上げと4画素単位の詰め物を通す／負の位置・右下のクリップも含む）
+
+#include <cstdlib>
+#include "pfont.hpp"
+#include "pfontspan.hpp"
+#include "pfonttest.hpp"
+
+// 0・64・中間値の連続を混ぜた画像（levels を指定するとその段階値だけを使う）
+static void makeGlyph(std::vector<PFontUInt8> &img, int w, int h, const PFontUInt8 *levels, int count)
+{
+	img.resize((size_t)w * h);
+	for (size_t i = 0; i < img.size();) {
+		PFontUInt8 v;
+		switch (rand() % 4) {
+		case 0:  v = 0; break;
+		case 1:  v = 64; break;
+		default: v = levels ? levels[rand() % count] : (PFontUInt8)(rand() % 65); break;
+		}
+		size_t n = 1 + rand() % 8;
+		while (n-- > 0 && i < img.size()) img[i++] = v;
+	}
+}
+
+static int changed(const std::vector<PFontUInt32> &a, const std::vector<PFontUInt32> &b, int cw, int *rect)
+{
+	int n = 0;
+	for (size_t i = 0; i < a.size(); i++) {
+		if (a[i] == b[i]) continue;
+		const int x = (int)(i % cw), y = (int)(i / cw);
+		if (x < rect[0] || y < rect[1] || x >= rect[2] || y >= rect[3]) return -1;
+		n++;
+	}
+	return n;
+}
+
+// スパンの並び（行順・行内は x 順・グリフの幅に収まる）と coverage の配置
+// 中間値スパンの末尾の詰め物は次の不透明スパンに重なってよいが，重なる部分は 0 であること
+static bool checkList(const PFontSpanList &list, int w, int h)
+{
+	size_t offset = 0;
+	int lastx = 0, lasty = -1;
+	for (size_t i = 0; i < list.spans.size(); i++) {
+		const PFontSpan &s = list.spans[i];
+		if (!s.length || s.y >= h || s.x + s.length > w) return false;
+		if (s.y < lasty) return false;
+		if (s.y == lasty && s.x < lastx) {
+			const PFontSpan &p = list.spans[i - 1];
+			if (p.opaque || !s.opaque || s.x < p.x) return false;
+			for (int x = s.x; x < lastx; x++) if (list.coverage[p.offset + (x - p.x)]) return false;
+		}
+		if (s.opaque) {
+			if (s.length < PFontSpanMinOpaque) return false;
+		} else {
+			if (s.offset != offset) return false;
+			offset += s.length;
+		}
+		lastx = s.x + s.length;
+		lasty = s.y;
+	}
+	return offset == list.coverage.size();
+}
+
+// 1つのグリフを圧縮してから，いくつかの位置に両方の方法で描画して比較する
+static void checkGlyph(const std::vector<PFontUInt8> &img, int w, int h, bool packed)
+{
+	std::vector<PFontUInt8> enc(img.size() + 1);
+	PFontUInt16 mode = 0;
+	const size_t len = PFontEncodeGlyph(&img.front(), img.size(), &enc.front(), packed, mode);
+
+	std::vector<PFontUInt8> dec(img.size());
+	PFONT_CHECK(PFontDecodeGlyph<PFontConv64>(mode, &enc.front(), len, w, h, &dec.front(), w));
+	PFontSpanList list;
+	size_t used = 0;
+	PFONT_CHECK(PFontDecodeSpans(mode, &enc.front(), len, w, h, list, &used));
+	PFONT_CHECK_EQ(used, len);
+	PFONT_CHECK(checkList(list, w, h));
+	if (len) PFONT_CHECK(!PFontDecodeSpans(mode, &enc.front(), len - 1, w, h, list));
+	PFONT_CHECK(PFontDecodeSpans(mode, &enc.front(), len, w, h, list));
+
+	const int cw = 37, ch = 29;
+	std::vector<PFontUInt32> base((size_t)cw * ch);
+	for (size_t i = 0; i < base.size(); i++) base[i] = ((PFontUInt32)rand() << 16) ^ (PFontUInt32)rand();
+	const PFontUInt32 color = ((PFontUInt32)rand() << 16) ^ (PFontUInt32)rand();
+
+	const int pos[][2] = {
+		{ 0, 0 }, { 3, 2 }, { -1, -1 }, { -w + 1, 5 }, { 4, -h + 1 }, { -3, -2 },
+		{ cw - w / 2, ch - h / 2 }, { cw - 1, 0 }, { -w, 0 }, { 0, ch },
+		{ rand() % (cw + w) - w, rand() % (ch + h) - h },
+	};
+	for (size_t k = 0; k < sizeof(pos) / sizeof(pos[0]); k++) {
+		const int x = pos[k][0], y = pos[k][1];
+		std::vector<PFontUInt32> image(base), spans(base);
+		int irect[4] = { cw, ch, 0, 0 }, srect[4] = { cw, ch, 0, 0 };
+		PFontBlitImage(&image.front(), cw, cw, ch, x, y, &dec.front(), w, h, color, irect);
+		PFontBlitSpans(&spans.front(), cw, cw, ch, x, y, list, color, srect);
+		if (image != spans) {
+			fprintf(stderr, "mode %d %dx%d at (%d,%d): spans differ from image\n", mode, w, h, x, y);
+			PFontTestFailures()++;
+			return;
+		}
+		// スパンの更新範囲は変わった画素をすべて含み，イメージの更新範囲に収まる
+		PFONT_CHECK(changed(base, spans, cw, srect) >= 0);
+		if (srect[0] < srect[2]) {
+			PFONT_CHECK(srect[0] >= irect[0] && srect[1] >= irect[1]);
+			PFONT_CHECK(srect[2] <= irect[2] && srect[3] <= irect[3]);
+		}
+	}
+}
+
+int main()
+{
+#ifdef PFONT_USE_SSE2
+	printf("SSE2 blend enabled\n");
+#else
+	printf("scalar blend only\n");
+#endif
+	srand(3);
+	std::vector<PFontUInt8> img;
+	for (int i = 0; i < 3000; i++) {
+		const int w = 1 + rand() % 24, h = 1 + rand() % 24;
+		makeGlyph(img, w, h, NULL, 0);
+		checkGlyph(img, w, h, false);
+		const int mode = PFontMode1Bit + rand() % 3;
+		int count = 0;
+		const PFontUInt8 *levels = PFontModeLevels(mode, count);
+		makeGlyph(img, w, h, levels, count);
+		checkGlyph(img, w, h, true);
+	}
+
+	// 全画素 64・全画素 0・幅1
+	const int sizes[][2] = { { 1, 1 }, { 1, 9 }, { 4, 4 }, { 7, 3 }, { 16, 2 } };
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		const int w = sizes[i][0], h = sizes[i][1];
+		img.assign((size_t)w * h, 64);
+		checkGlyph(img, w, h, false);
+		checkGlyph(img, w, h, true);
+		img.assign((size_t)w * h, 0);
+		checkGlyph(img, w, h, false);
+	}
+	return PFontTestResult("test_span");
+}
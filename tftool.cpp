@@ -0,0 +1,907 @@
+// レンダリング済みフォント(*.tft)のコマンドラインツール
+//
+// 吉里吉里やWindowsを使わずにフォントファイルの確認・変換を行う
+// フォーマット処理は pfont.hpp をプラグインと共有する
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+#include <chrono>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "pfont.hpp"
+#include "pfontbuild.hpp"
+#include "pfontcache.hpp"
+#include "pfontdiff.hpp"
+#include "pfonteffect.hpp"
+#include "pfontresample.hpp"
+#include "pfontstack.hpp"
+#include "pfontlayout.hpp"
+#include "pfontspan.hpp"
+
+//--------------------------------------------------------------
+// ファイル操作クラス（標準入出力）
+
+struct PFontStdStream
+{
+	PFontStdStream(const char *storage, unsigned int flags) : fp(0), storage(storage)
+	{
+		const char *mode = (flags == PFontWrite) ? "wb" : (flags == PFontUpdate) ? "r+b" : "rb";
+		fp = fopen(storage, mode);
+		if (!fp) error("can't open storage");
+	}
+	PFontStdStream(const std::string &storage, unsigned int flags) : PFontStdStream(storage.c_str(), flags) {}
+
+	~PFontStdStream() {
+		if (fp) fclose(fp);
+		fp = 0;
+	}
+
+	void error(const char *message) const {
+		throw std::runtime_error(std::string(message) + ":" + storage);
+	}
+
+	typedef PFontUInt32 SizeType;
+
+	void write(void const *buf, SizeType length) {
+		if (length && fwrite(buf, 1, length, fp) != length) error("can't write storage");
+	}
+	void read(void *buf, SizeType length) {
+		if (length && fread(buf, 1, length, fp) != length) error("can't read storage");
+	}
+	void seek(SizeType pos) {
+		fseek(fp, (long)pos, SEEK_SET);
+	}
+	SizeType getPos() const {
+		return (SizeType)ftell(fp);
+	}
+	SizeType getSize() const {
+		long pos = ftell(fp);
+		fseek(fp, 0, SEEK_END);
+		long size = ftell(fp);
+		fseek(fp, pos, SEEK_SET);
+		return (SizeType)size;
+	}
+
+private:
+	PFontStdStream(const PFontStdStream&);
+	PFontStdStream& operator=(const PFontStdStream&);
+
+	FILE *fp;
+	std::string storage;
+};
+
+typedef PFontSaverT <PFontStdStream> PFontSaver;
+typedef PFontLoaderT<PFontStdStream> PFontLoader;
+
+//--------------------------------------------------------------
+// 共通処理
+
+struct Options
+{
+	int  threads;
+	bool dedup;
+	bool packed;
+	int  levels;
+	bool link;
+	bool hang;
+	PFontEffect effect;
+	double scale;
+	int    filter;
+	std::string outdir;
+	std::string cachedir;
+	Options() : threads(0), dedup(false), packed(false), levels(0), link(false), hang(false), scale(0), filter(PFontResampleArea) {}
+};
+
+static std::string format(const char *fmt, ...)
+{
+	char buf[1024];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	return buf;
+}
+
+static std::string toUTF8(PFontUInt16 ch)
+{
+	std::string r;
+	if (ch < 0x20 || (ch >= 0xD800 && ch < 0xE000)) return "?";
+	if (ch < 0x80) r += (char)ch;
+	else if (ch < 0x800) {
+		r += (char)(0xC0 | (ch >> 6));
+		r += (char)(0x80 | (ch & 0x3F));
+	} else {
+		r += (char)(0xE0 | (ch >> 12));
+		r += (char)(0x80 | ((ch >> 6) & 0x3F));
+		r += (char)(0x80 | (ch & 0x3F));
+	}
+	return r;
+}
+
+// UTF-8 を UTF-16 に変換（BMP 外の文字は '?'）
+static void fromUTF8(const std::string &str, std::vector<PFontUInt16> &out)
+{
+	out.clear();
+	const unsigned char *p = (const unsigned char*)str.c_str(), *end = p + str.size();
+	while (p < end) {
+		const unsigned char c = *p++;
+		int n = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC0) ? 1 : 0;
+		PFontUInt32 ch = n ? (c & (0x3F >> n)) : c;
+		for (; n > 0 && p < end && (*p & 0xC0) == 0x80; n--) ch = (ch << 6) | (*p++ & 0x3F);
+		out.push_back(ch > 0xFFFF ? (PFontUInt16)'?' : (PFontUInt16)ch);
+	}
+}
+
+// "U+3042" / "0x3042" / "12354" / "あ" のいずれかをキャラクタコードに変換
+static long parseCode(const char *arg)
+{
+	const unsigned char *p = (const unsigned char*)arg;
+	if ((p[0] == 'U' || p[0] == 'u') && p[1] == '+') return strtol(arg + 2, 0, 16);
+	if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) return strtol(arg + 2, 0, 16);
+	if (p[0] >= '0' && p[0] <= '9') return strtol(arg, 0, 10);
+	if (p[0] < 0x80) return p[0];
+	if ((p[0] & 0xE0) == 0xC0) return ((p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+	if ((p[0] & 0xF0) == 0xE0) return ((p[0] & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+	return -1;
+}
+
+static std::string baseName(const std::string &path)
+{
+	size_t pos = path.find_last_of("/\\");
+	return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+// 途中のフォルダも作成する（既にあれば何もしない）
+static void makeDirectory(const std::string &path)
+{
+	for (size_t pos = path.find_first_of("/\\", 1);; pos = path.find_first_of("/\\", pos + 1)) {
+		const std::string dir = path.substr(0, pos);
+#ifdef _WIN32
+		_mkdir(dir.c_str());
+#else
+		mkdir(dir.c_str(), 0777);
+#endif
+		if (pos == std::string::npos) break;
+	}
+}
+
+// 2つのパスが同じファイルを指しているか（どちらかが存在しなければ false）
+static bool sameFile(const std::string &a, const std::string &b)
+{
+#ifdef _WIN32
+	char fa[_MAX_PATH], fb[_MAX_PATH];
+	if (!_fullpath(fa, a.c_str(), _MAX_PATH) || !_fullpath(fb, b.c_str(), _MAX_PATH)) return a == b;
+	return _stricmp(fa, fb) == 0;
+#else
+	struct stat sa, sb;
+	if (stat(a.c_str(), &sa) != 0 || stat(b.c_str(), &sb) != 0) return false;
+	return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+}
+
+// ファイルごとのコマンドの保存先 <outdir>/<ファイル名>（入力を上書きする場合はエラー）
+static std::string outputPath(const std::string &file, const Options &opt)
+{
+	const std::string dst = (opt.outdir.empty() ? std::string(".") : opt.outdir) + "/" + baseName(file);
+	if (sameFile(dst, file)) throw std::runtime_error("output overwrites input (use -o):" + file);
+	return dst;
+}
+
+static void writePGM(const std::string &path, const std::vector<PFontUInt8> &img, int width, int height)
+{
+	FILE *fp = fopen(path.c_str(), "wb");
+	if (!fp) throw std::runtime_error("can't open storage:" + path);
+	fprintf(fp, "P5\n%d %d\n255\n", width, height);
+	bool ok = fwrite(&img.front(), 1, img.size(), fp) == img.size();
+	fclose(fp);
+	if (!ok) throw std::runtime_error("can't write storage:" + path);
+}
+
+static void writePGM(const std::string &path, const PFontData &data, PFontUInt32 n)
+{
+	const PFontIndex &idx = data.index[n];
+	std::vector<PFontUInt8> img((size_t)idx.width * idx.height);
+	const PFontUInt8 *src = 0;
+	size_t len = 0;
+	if (!data.getImage(n, src, len) ||
+		!PFontDecodeGlyph<PFontConv255>(idx.reserved, src, len, idx.width, idx.height, &img.front(), idx.width))
+		throw std::runtime_error("invalid glyph image:" + path);
+	writePGM(path, img, idx.width, idx.height);
+}
+
+static void loadFont(const std::string &file, PFontData &data)
+{
+	PFontLoader loader(file);
+	loader.readData(data);
+}
+
+//--------------------------------------------------------------
+// コマンド（ファイルごとの処理：結果は out に出力）
+
+static int cmdInfo(const std::string &file, const Options &, std::string &out)
+{
+	PFontData data;
+	loadFont(file, data);
+	int ascent = 0, descent = 0;
+	data.getExtent(ascent, descent);
+	std::vector<PFontUInt32> sizes;
+	data.getImageSizes(sizes);
+	size_t pixels = 0;
+	for (PFontUInt32 i = 0; i < data.count; i++) pixels += (size_t)data.index[i].width * data.index[i].height;
+
+	out += format("%s:\n", file.c_str());
+	out += format("  glyphs      : %u\n", data.count);
+	if (data.count)
+		out += format("  codes       : U+%04X - U+%04X\n", data.codes.front(), data.codes[data.count - 1]);
+	out += format("  image bytes : %u (%u pixels decoded)\n", data.chindexpos - data.imagepos, (unsigned)pixels);
+	out += format("  ascent      : %d\n", ascent);
+	out += format("  descent     : %d\n", descent);
+	if (data.hotpos)
+		out += format("  hot prefix  : %u bytes\n", data.hotpos - data.imagepos);
+	PFontUInt32 modes[4] = { 0, 0, 0, 0 };
+	for (PFontUInt32 i = 0; i < data.count; i++) modes[data.index[i].reserved & PFontModeMask]++;
+	if (modes[PFontMode1Bit] || modes[PFontMode2Bit] || modes[PFontMode4Bit])
+		out += format("  storage     : rle65 %u, 1bit %u, 2bit %u, 4bit %u\n", modes[0], modes[1], modes[2], modes[3]);
+	return 0;
+}
+
+static int cmdCheck(const std::string &file, const Options &opt, std::string &out)
+{
+	PFontData data;
+	loadFont(file, data);
+	int errors = 0;
+	for (PFontUInt32 i = 1; i < data.count; i++) {
+		if (data.codes[i-1] >= data.codes[i]) {
+			out += format("%s: code table not sorted at %u\n", file.c_str(), i);
+			errors++;
+		}
+	}
+	std::vector<PFontUInt8> arena;
+	std::vector<PFontUInt32> offsets;
+	PFontUInt32 failed = PFontDecodeAll(data, arena, offsets, opt.threads);
+	if (failed) {
+		out += format("%s: %u invalid glyph images\n", file.c_str(), failed);
+		errors++;
+	}
+	if (!errors) out += format("%s: OK (%u glyphs)\n", file.c_str(), data.count);
+	return errors ? 1 : 0;
+}
+
+static const char *modeNames[] = { "rle65", "1bit", "2bit", "4bit" };
+
+static int cmdList(const std::string &file, const Options &, std::string &out)
+{
+	PFontData data;
+	loadFont(file, data);
+	std::vector<PFontUInt32> sizes;
+	data.getImageSizes(sizes);
+	out += format("# %s\n# code\tch\tw\th\tox\toy\tinc_x\tinc_y\tinc\toffset\tbytes\tmode\n", file.c_str());
+	for (PFontUInt32 i = 0; i < data.count; i++) {
+		const PFontIndex &idx = data.index[i];
+		out += format("U+%04X\t%s\t%u\t%u\t%d\t%d\t%d\t%d\t%d\t%u\t%u\t%s\n",
+					  data.codes[i], toUTF8(data.codes[i]).c_str(),
+					  idx.width, idx.height, idx.origin_x, idx.origin_y, idx.inc_x, idx.inc_y, idx.inc,
+					  idx.offset, sizes[i], modeNames[idx.reserved & PFontModeMask]);
+	}
+	return 0;
+}
+
+static int cmdExtractAll(const std::string &file, const Options &opt, std::string &out)
+{
+	PFontData data;
+	loadFont(file, data);
+	std::string dir = (opt.outdir.empty() ? std::string(".") : opt.outdir) + "/" + baseName(file);
+	makeDirectory(dir);
+	PFontUInt32 written = 0;
+	for (PFontUInt32 i = 0; i < data.count; i++) {
+		if (!data.index[i].width || !data.index[i].height) continue;
+		writePGM(format("%s/%04X.pgm", dir.c_str(), data.codes[i]), data, i);
+		written++;
+	}
+	out += format("%s: %u glyphs -> %s\n", file.c_str(), written, dir.c_str());
+	return 0;
+}
+
+static int cmdRepack(const std::string &file, const Options &opt, std::string &out)
+{
+	PFontData data;
+	loadFont(file, data);
+	std::vector<PFontGlyph> glyphs;
+	if (PFontDecodeGlyphs(data, glyphs, opt.threads) > 0) throw std::runtime_error("invalid glyph image:" + file);
+
+	const std::string dst = outputPath(file, opt);
+	PFontUInt32 before = data.chindexpos - data.imagepos, after = 0;
+	{
+		PFontSaver saver(dst);
+		saver.packed = opt.packed || opt.levels;
+		saver.levels = opt.levels;
+		PFontSaveGlyphs(saver, glyphs, opt.dedup, opt.threads);
+	}
+	{
+		PFontData result;
+		PFontLoader loader(dst);
+		loader.readTables(result);
+		after = result.chindexpos - result.imagepos;
+	}
+	out += format("%s -> %s: image %u -> %u bytes\n", file.c_str(), dst.c_str(), before, after);
+	return 0;
+}
+
+static int cmdEffect(const std::string &file, const Options &opt, std::string &out)
+{
+	PFontData data;
+	loadFont(file, data);
+	std::vector<PFontGlyph> glyphs;
+	if (PFontDecodeGlyphs(data, glyphs, opt.threads) > 0) throw std::runtime_error("invalid glyph image:" + file);
+	PFontApplyEffects(glyphs, opt.effect, opt.threads);
+
+	const std::string dst = outputPath(file, opt);
+	{
+		PFontSaver saver(dst);
+		saver.packed = opt.packed || opt.levels;
+		saver.levels = opt.levels;
+		PFontSaveGlyphs(saver, glyphs, opt.dedup, opt.threads);
+	}
+	out += format("%s -> %s: outline %d, blur %d, offset %d,%d\n", file.c_str(), dst.c_str(),
+				  opt.effect.outline, opt.effect.blur, opt.effect.offsetX, opt.effect.offsetY);
+	return 0;
+}
+
+static int cmdResample(const std::string &file, const Options &opt, std::string &out)
+{
+	if (!(opt.scale > 0.0 && opt.scale <= 1.0)) throw std::runtime_error("resample: --scale must be in (0, 1]");
+	PFontData data;
+	loadFont(file, data);
+	std::vector<PFontGlyph> glyphs;
+	if (PFontDecodeGlyphs(data, glyphs, opt.threads) > 0) throw std::runtime_error("invalid glyph image:" + file);
+	PFontResampleGlyphs(glyphs, opt.scale, opt.filter, opt.threads);
+
+	const std::string dst = outputPath(file, opt);
+	{
+		PFontSaver saver(dst);
+		saver.packed = opt.packed || opt.levels;
+		saver.levels = opt.levels;
+		PFontSaveGlyphs(saver, glyphs, opt.dedup, opt.threads);
+	}
+	out += format("%s -> %s: scale %.4f (%s)\n", file.c_str(), dst.c_str(), opt.scale, opt.filter == PFontResampleLanczos ? "lanczos" : "area");
+	return 0;
+}
+
+static int cmdBench(const std::string &file, const Options &opt, std::string &out)
+{
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point t0 = Clock::now();
+	PFontData data;
+	loadFont(file, data);
+	Clock::time_point t1 = Clock::now();
+
+	std::vector<PFontUInt8> arena;
+	std::vector<PFontUInt32> offsets;
+	PFontDecodeAll(data, arena, offsets, 1);
+	Clock::time_point t2 = Clock::now();
+	PFontDecodeAll(data, arena, offsets, opt.threads);
+	Clock::time_point t3 = Clock::now();
+	std::vector<PFontSpanList> spans(data.count);
+	size_t nspans = 0;
+	for (PFontUInt32 i = 0; i < data.count; i++) {
+		PFontDecodeSpans(data, i, spans[i]);
+		nspans += spans[i].spans.size();
+	}
+	Clock::time_point t4 = Clock::now();
+
+	// 全グリフを 1024x1024 に描画（展開済みイメージ／スパン）
+	const int cw = 1024, ch = 1024;
+	std::vector<PFontUInt32> canvas((size_t)cw * ch, 0xFF000000);
+	struct Place {
+		static void get(const PFontIndex &idx, PFontUInt32 n, int cw, int ch, int &x, int &y) {
+			x = (int)((n * 37) % (PFontUInt32)(cw > idx.width  ? cw - idx.width  : 1));
+			y = (int)((n * 53) % (PFontUInt32)(ch > idx.height ? ch - idx.height : 1));
+		}
+	};
+	Clock::time_point t4b = Clock::now();
+	for (PFontUInt32 i = 0; i < data.count; i++) {
+		const PFontIndex &idx = data.index[i];
+		int x, y;
+		Place::get(idx, i, cw, ch, x, y);
+		PFontBlitImage(&canvas.front(), cw, cw, ch, x, y, arena.empty() ? 0 : &arena[offsets[i]], idx.width, idx.height, 0xFFFFFF);
+	}
+	Clock::time_point t5 = Clock::now();
+	for (PFontUInt32 i = 0; i < data.count; i++) {
+		int x, y;
+		Place::get(data.index[i], i, cw, ch, x, y);
+		PFontBlitSpans(&canvas.front(), cw, cw, ch, x, y, spans[i], 0xFFFFFF);
+	}
+	Clock::time_point t6 = Clock::now();
+
+	const double load = std::chrono::duration<double, std::milli>(t1 - t0).count();
+	const double one  = std::chrono::duration<double, std::milli>(t2 - t1).count();
+	const double all  = std::chrono::duration<double, std::milli>(t3 - t2).count();
+	const double span = std::chrono::duration<double, std::milli>(t4 - t3).count();
+	const double blit = std::chrono::duration<double, std::milli>(t5 - t4b).count();
+	const double sblt = std::chrono::duration<double, std::milli>(t6 - t5).count();
+	const double mb   = arena.size() / (1024.0 * 1024.0);
+	out += format("%s:\n", file.c_str());
+	out += format("  load            : %8.2f ms\n", load);
+	out += format("  decode (1 thr)  : %8.2f ms  %8.1f MB/s\n", one, one > 0 ? mb / one * 1000 : 0.0);
+	out += format("  decode (%d thr)%*s: %8.2f ms  %8.1f MB/s\n", PFontThreadCount(opt.threads), PFontThreadCount(opt.threads) < 10 ? 2 : 1, "", all, all > 0 ? mb / all * 1000 : 0.0);
+	out += format("  spans (1 thr)   : %8.2f ms  %8.1f MB/s  (%u spans)\n", span, span > 0 ? mb / span * 1000 : 0.0, (unsigned)nspans);
+	out += format("  draw image      : %8.2f ms\n", blit);
+	out += format("  draw spans      : %8.2f ms\n", sblt);
+	return 0;
+}
+
+// ファイルごとのコマンドを並列に実行する（結果はファイル順に表示）
+static int runFiles(int (*command)(const std::string&, const Options&, std::string&),
+					const std::vector<std::string> &files, const Options &opt, bool parallel)
+{
+	std::vector<std::string> outputs(files.size());
+	std::vector<int> results(files.size(), 0);
+	Options inner = opt;
+	if (parallel && files.size() > 1) inner.threads = 1; // ファイル単位で並列化する
+	PFontParallelFor(files.size(), parallel ? opt.threads : 1, [&](size_t i) {
+		try {
+			results[i] = command(files[i], inner, outputs[i]);
+		} catch (std::exception &e) {
+			outputs[i] += std::string("error: ") + e.what() + "\n";
+			results[i] = 1;
+		}
+	});
+	int status = 0;
+	for (size_t i = 0; i < files.size(); i++) {
+		fputs(outputs[i].c_str(), stdout);
+		if (results[i]) status = 1;
+	}
+	return status;
+}
+
+static int cmdDumpGlyph(const std::vector<std::string> &args)
+{
+	if (args.size() != 3) throw std::runtime_error("usage: dump-glyph <file> <code> <out.pgm>");
+	PFontData data;
+	loadFont(args[0], data);
+	long ch = parseCode(args[1].c_str());
+	long n = (ch >= 0 && ch < 0x10000) ? data.find((PFontUInt16)ch) : -1;
+	if (n < 0) throw std::runtime_error("character not found:" + args[1]);
+	if (!data.index[n].width || !data.index[n].height) throw std::runtime_error("empty glyph:" + args[1]);
+	writePGM(args[2], data, (PFontUInt32)n);
+	return 0;
+}
+
+// 2つのファイルのグリフごとの差分（-o 指定時は差分画像 <outdir>/XXXX.pgm も出力）
+static int cmdDiff(const std::vector<std::string> &args, const Options &opt)
+{
+	if (args.size() != 2) throw std::runtime_error("usage: diff <a.tft> <b.tft>");
+	PFontData a, b;
+	loadFont(args[0], a);
+	loadFont(args[1], b);
+	std::vector<PFontGlyphDiff> diffs;
+	const bool images = !opt.outdir.empty();
+	const PFontUInt32 same = PFontDiffData(a, b, diffs, images, opt.threads);
+
+	PFontUInt32 added = 0, removed = 0, changed = 0;
+	for (size_t i = 0; i < diffs.size(); i++) {
+		const PFontGlyphDiff &d = diffs[i];
+		if      (d.status & PFontDiffAdded)   added++;
+		else if (d.status & PFontDiffRemoved) removed++;
+		else changed++;
+	}
+	printf("%s -> %s: %u same, %u changed, %u added, %u removed\n", args[0].c_str(), args[1].c_str(), same, changed, added, removed);
+	for (size_t i = 0; i < diffs.size(); i++) {
+		const PFontGlyphDiff &d = diffs[i];
+		std::string status;
+		if (d.status & PFontDiffAdded)   status += "+added";
+		if (d.status & PFontDiffRemoved) status += "+removed";
+		if (d.status & PFontDiffMetrics) status += "+metrics";
+		if (d.status & PFontDiffImage)   status += "+image";
+		if (d.status & PFontDiffError)   status += "+error";
+		printf("  U+%04X %-3s %-16s", d.code, toUTF8(d.code).c_str(), status.c_str() + 1);
+		if (d.status & PFontDiffImage) printf(" max %2d  mean %6.3f  pixels %u", d.maxError, d.meanError, d.pixels);
+		printf("\n");
+		if (!d.image.empty()) {
+			std::vector<PFontUInt8> img(d.image.size());
+			for (size_t k = 0; k < img.size(); k++) img[k] = PFontConv255::conv(d.image[k]);
+			writePGM(format("%s/%04X.pgm", opt.outdir.c_str(), d.code), img, d.width, d.height);
+		}
+	}
+	return diffs.empty() ? 0 : 1;
+}
+
+// 重ねたファイルを1つにまとめる（files は優先順：パッチ → ベース）
+static int cmdFlatten(const std::vector<std::string> &args)
+{
+	if (args.size() < 2) throw std::runtime_error("usage: flatten <out.tft> <patch.tft>... <base.tft>");
+	const std::string &dst = args[0];
+	std::vector<PFontData> datas(args.size() - 1);
+	std::vector<const PFontData*> layers;
+	for (size_t i = 1; i < args.size(); i++) {
+		if (args[i] == dst || sameFile(args[i], dst)) throw std::runtime_error("output overwrites input:" + dst);
+		loadFont(args[i], datas[i - 1]);
+		layers.push_back(&datas[i - 1]);
+	}
+	PFontStack stack;
+	stack.assign(layers);
+	{
+		PFontSaver saver(dst);
+		PFontFlattenStack(saver, stack);
+	}
+	std::vector<PFontUInt32> used(layers.size(), 0);
+	for (PFontUInt32 n = 0; n < stack.count; n++) used[stack.layer[n]]++;
+	printf("%s: %u glyphs\n", dst.c_str(), stack.count);
+	for (size_t l = 0; l < layers.size(); l++) printf("  %s: %u of %u glyphs\n", args[l + 1].c_str(), used[l], layers[l]->count);
+	return 0;
+}
+
+// 更新後のファイルから追加・変更されたグリフだけのパッチファイルを作る
+static int cmdMakePatch(const std::vector<std::string> &args, const Options &opt)
+{
+	if (args.size() != 3) throw std::runtime_error("usage: make-patch <base.tft> <new.tft> <patch.tft>");
+	for (size_t i = 0; i < 2; i++)
+		if (args[i] == args[2] || sameFile(args[i], args[2])) throw std::runtime_error("output overwrites input:" + args[2]);
+	PFontData base, next;
+	loadFont(args[0], base);
+	loadFont(args[1], next);
+	std::vector<PFontGlyphDiff> diffs;
+	PFontDiffData(base, next, diffs, false, opt.threads);
+
+	std::vector<const PFontData*> layers(1, &next);
+	PFontStack stack;
+	stack.assign(layers);
+	std::vector<PFontUInt32> select;
+	PFontUInt32 added = 0, changed = 0, removed = 0;
+	for (size_t i = 0; i < diffs.size(); i++) {
+		const PFontGlyphDiff &d = diffs[i];
+		if (d.status & PFontDiffRemoved) {
+			removed++;
+			continue;
+		}
+		if (d.status & PFontDiffAdded) added++;
+		else changed++;
+		select.push_back((PFontUInt32)d.b);
+	}
+	if (removed) printf("warning: %u glyphs removed in %s can't be expressed by a patch\n", removed, args[1].c_str());
+	if (select.empty()) {
+		printf("%s: no changes\n", args[1].c_str());
+		return 0;
+	}
+	{
+		PFontSaver saver(args[2]);
+		PFontFlattenStack(saver, stack, &select);
+	}
+	printf("%s: %u added, %u changed\n", args[2].c_str(), added, changed);
+	return 0;
+}
+
+static bool readFile(const std::string &path, std::string &text)
+{
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (!fp) return false;
+	char buf[0x10000];
+	size_t len;
+	text.clear();
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) text.append(buf, len);
+	fclose(fp);
+	return true;
+}
+
+// フォントファイルの読み込み（face は file.ttc#1 のような面指定も可）
+static std::shared_ptr<const PFontOutlineFont> loadOutlineFont(const std::string &face, PFontUInt64 *hash = 0)
+{
+	std::string path, text, error;
+	int index;
+	PFontParseFontFile(face, path, index);
+	if (!readFile(path, text)) throw std::runtime_error("can't open storage:" + path);
+	if (hash) {
+		PFontHash64 h;
+		h.add(text);
+		h.add((PFontUInt32)index);
+		*hash = h.value;
+	}
+	std::vector<PFontUInt8> data(text.begin(), text.end());
+	std::shared_ptr<PFontOutlineFont> font(new PFontOutlineFont());
+	if (!font->load(data, index, error)) throw std::runtime_error(error + ":" + face);
+	return font;
+}
+
+static int cmdRender(const std::vector<std::string> &args)
+{
+	if (args.size() != 4) throw std::runtime_error("usage: render <fontfile> <size> <code> <out.pgm>");
+	std::shared_ptr<const PFontOutlineFont> font = loadOutlineFont(args[0]);
+	long ch = parseCode(args[2].c_str());
+	PFontUInt32 gid = ch >= 0 ? font->getGlyphIndex((PFontUInt32)ch) : 0;
+	if (!gid) throw std::runtime_error("character not found:" + args[2]);
+	PFontGlyph glyph;
+	if (!PFontRenderOutline(*font, gid, atoi(args[1].c_str()), false, false, glyph)) throw std::runtime_error("invalid outline:" + args[2]);
+	const PFontIndex &idx = glyph.info;
+	printf("glyph %u: %dx%d origin(%d,%d) inc %d\n", gid, idx.width, idx.height, idx.origin_x, idx.origin_y, idx.inc);
+	if (!idx.width || !idx.height) throw std::runtime_error("empty glyph:" + args[2]);
+	std::vector<PFontUInt8> img(glyph.image.size());
+	for (size_t i = 0; i < img.size(); i++) img[i] = PFontConv255::conv(glyph.image[i]);
+	writePGM(args[3], img, idx.width, idx.height);
+	return 0;
+}
+static bool writeFile(const std::string &path, const void *data, size_t size)
+{
+	remove(path.c_str()); // ハードリンク先（キャッシュ）を書き換えないように作り直す
+	FILE *fp = fopen(path.c_str(), "wb");
+	if (!fp) return false;
+	bool ok = fwrite(data, 1, size, fp) == size;
+	if (fclose(fp) != 0) ok = false;
+	return ok;
+}
+
+//--------------------------------------------------------------
+// ビルドキャッシュ
+
+struct BuildCache
+{
+	std::string dir;
+	bool link;
+	PFontUInt32 hits, misses;
+	BuildCache(const std::string &dir, bool link) : dir(dir), link(link), hits(0), misses(0) {
+		if (!dir.empty()) makeDirectory(dir);
+	}
+	bool enabled() const { return !dir.empty(); }
+	std::string path(const std::string &key) const { return dir + "/" + PFontCacheFileName(key); }
+
+	// キャッシュからコピー（またはハードリンク）する
+	bool fetch(const std::string &key, const std::string &output, PFontUInt32 &glyphs) {
+		std::string src = path(key), data;
+		struct stat st;
+		if (stat(src.c_str(), &st) != 0) return false;
+#ifndef _WIN32
+		if (link) {
+			remove(output.c_str());
+			if (::link(src.c_str(), output.c_str()) == 0 && readHeader(src, glyphs)) return true;
+		}
+#endif
+		if (!readFile(src, data) || data.size() < PFontHeaderLength + 4) return false;
+		memcpy(&glyphs, data.data() + PFontHeaderLength, 4);
+		return writeFile(output, data.data(), data.size());
+	}
+	// 作成したファイルを登録する（一時ファイルに書いてから置き換える）
+	void store(const std::string &key, const std::vector<PFontUInt8> &file) {
+		std::string dst = path(key), tmp = format("%s.%d.tmp", dst.c_str(), (int)getpid());
+		if (writeFile(tmp, &file.front(), file.size()) && rename(tmp.c_str(), dst.c_str()) == 0) return;
+		remove(tmp.c_str());
+	}
+
+private:
+	static bool readHeader(const std::string &file, PFontUInt32 &glyphs) {
+		try {
+			PFontLoader loader(file);
+			PFontUInt32 chindexpos, indexpos;
+			loader.readHeader(glyphs, chindexpos, indexpos);
+			return true;
+		} catch (std::exception&) {
+			return false;
+		}
+	}
+};
+
+// マニフェストによる一括作成（face がフォントファイルなら描画，synthetic なら合成グリフ）
+static int cmdBuild(const std::vector<std::string> &args, const Options &opt)
+{
+	int status = 0;
+	BuildCache cache(opt.cachedir, opt.link);
+	for (size_t m = 0; m < args.size(); m++) {
+		PFontManifest list;
+		std::string text, error;
+		if (!readFile(args[m], text)) throw std::runtime_error("can't open storage:" + args[m]);
+		if (!list.parse(text, error) ||
+			!list.resolve([](const std::string &name, PFontCharSet &chars) {
+				std::string content;
+				if (!readFile(name, content)) return false;
+				PFontAddTextChars(chars, content);
+				return true;
+			}, error)) throw std::runtime_error(error + ":" + args[m]);
+
+		std::vector<PFontBuildTarget> &targets = list.targets;
+		printf("%s: %u targets, %u charsets\n", args[m].c_str(), (unsigned)targets.size(), (unsigned)list.getCharSetCount());
+		std::vector<std::string> outputs(targets.size());
+		std::map<std::string, std::shared_ptr<const PFontOutlineFont> > fonts;
+		std::map<std::string, PFontUInt64> hashes;
+		for (size_t i = 0; i < targets.size(); i++) {
+			PFontBuildTarget &t = targets[i];
+			outputs[i] = opt.outdir.empty() ? t.output : opt.outdir + "/" + t.output;
+			std::string path;
+			int index;
+			const bool outline = PFontParseFontFile(t.face, path, index);
+			if (outline && !fonts.count(t.face)) {
+				try {
+					fonts[t.face] = loadOutlineFont(t.face, &hashes[t.face]);
+				} catch (std::exception &e) {
+					printf("  %s: error: %s\n", t.face.c_str(), e.what());
+					fonts[t.face].reset();
+					status = 1;
+				}
+			}
+			if (!cache.enabled() || (!outline && t.face != "synthetic") || (outline && !fonts[t.face])) continue;
+			PFontHash64 font;
+			font.add(t.face);
+			if (outline) font.value = hashes[t.face];
+			t.key = PFontCacheKey(font.value, format("%s size=%d flags=%u", outline ? "outline" : "synthetic", t.size, t.flags), *t.chars);
+			t.cached = cache.fetch(t.key, outputs[i], t.glyphs);
+			if (t.cached) cache.hits++;
+			else          cache.misses++;
+		}
+
+		PFontBuilder builder(targets, [&fonts](const PFontBuildTarget &target) -> PFontGlyphSource* {
+			if (target.face == "synthetic") return new PFontSyntheticSource(target.size, target.flags);
+			std::map<std::string, std::shared_ptr<const PFontOutlineFont> >::const_iterator it = fonts.find(target.face);
+			if (it != fonts.end() && it->second) return new PFontOutlineSource(it->second, target.size, target.flags);
+			return 0;
+		}, opt.threads);
+		builder.start();
+
+		PFontBuildEvent ev;
+		while (builder.wait(ev)) {
+			PFontBuildTarget &t = targets[ev.target];
+			if (!ev.finished) continue;
+			const std::string &output = outputs[ev.target];
+			if (!t.cached && t.error.empty()) {
+				if (!writeFile(output, &t.file.front(), t.file.size())) t.error = "can't write storage:" + output;
+				else if (!t.key.empty()) cache.store(t.key, t.file);
+				std::vector<PFontUInt8>().swap(t.file);
+			}
+			if (!t.error.empty()) {
+				printf("  %s: error: %s\n", output.c_str(), t.error.c_str());
+				status = 1;
+			} else printf("  %s: %u glyphs%s\n", output.c_str(), t.glyphs, t.cached ? " (cached)" : "");
+			fflush(stdout);
+		}
+	}
+	if (cache.enabled()) printf("cache: %u hits, %u misses\n", cache.hits, cache.misses);
+	return status;
+}
+
+// テキストファイルを禁則処理つきで行に分割して表示する（PreRenderedFontLayout と同じ処理）
+static int cmdLayout(const std::vector<std::string> &args, const Options &opt)
+{
+	if (args.size() != 3) throw std::runtime_error("usage: layout <file.tft> <width> <text.txt>");
+	PFontData data;
+	{
+		PFontLoader loader(args[0]);
+		loader.readTables(data);
+	}
+	PFontLayout layout;
+	layout.assign(data);
+	const int width = atoi(args[1].c_str());
+	std::string text;
+	if (!readFile(args[2], text)) throw std::runtime_error("can't open storage:" + args[2]);
+
+	// 改行は LF にそろえる
+	std::string lf;
+	for (size_t i = 0; i < text.size(); i++) if (text[i] != '\r') lf += text[i];
+	std::vector<PFontUInt16> str;
+	fromUTF8(lf, str);
+	std::vector<PFontLine> lines;
+	layout.breakLines(str.empty() ? 0 : &str.front(), str.size(), width, opt.hang, &lines);
+	for (size_t i = 0; i < lines.size(); i++) {
+		std::string line;
+		for (PFontUInt32 k = 0; k < lines[i].length; k++) line += toUTF8(str[lines[i].start + k]);
+		printf("%5d |%s\n", lines[i].width, line.c_str());
+	}
+	return 0;
+}
+
+//--------------------------------------------------------------
+
+static void usage()
+{
+	fputs(
+		"usage: tftool [options] <command> <args...>\n"
+		"\n"
+		"commands:\n"
+		"  info <file>...                     show summary\n"
+		"  check <file>...                    validate tables and decode every glyph\n"
+		"  list <file>...                     list glyph metrics\n"
+		"  dump-glyph <file> <code> <out.pgm> write one glyph as PGM (code: U+XXXX, 0xXXXX, decimal or the character)\n"
+		"  extract-all <file>...              write every glyph as <outdir>/<file>/XXXX.pgm\n"
+		"  repack <file>...                   re-encode into <outdir>/<file>\n"
+		"  bench <file>...                    measure load and decode speed\n"
+		"  effect <file>...                   write an outlined/blurred/shifted variant into <outdir>/<file>\n"
+		"  resample <file>...                 write a downscaled copy into <outdir>/<file> (--scale)\n"
+		"  render <font> <size> <code> <out.pgm> rasterize one glyph of a .ttf/.otf/.ttc file as PGM\n"
+		"  diff <a> <b>                       compare glyphs of two files (exit 1 if different, -o: write |a-b| as PGM)\n"
+		"  layout <file> <width> <text>       break a UTF-8 text file into lines of <width> pixels (--hang: hanging punctuation)\n"
+		"  flatten <out> <file>...            merge a stack of patch files (topmost first, base last) into one file\n"
+		"  make-patch <base> <new> <out>      write only the glyphs added or changed in <new> as a patch file\n"
+		"  build <manifest>...                build every target of the manifest (face: font file or \"synthetic\")\n"
+		"\n"
+		"options:\n"
+		"  -j <n>       worker threads (default: number of CPUs)\n"
+		"  -o <dir>     output directory (default: ., build: as written in the manifest)\n"
+		"  --dedup      share identical glyph images when repacking\n"
+		"  --packed     store glyphs in 1/2/4bit modes when smaller (repack)\n"
+		"  --levels <n> round glyphs to 2, 4 or 16 levels before packing (repack)\n"
+		"  --cache <dir> reuse unchanged build results from <dir> (build)\n"
+		"  --link       hardlink cached results instead of copying\n"
+		"  --hang       allow hanging punctuation at line ends (layout)\n"
+		"  --outline <r> dilate glyphs by radius r (effect)\n"
+		"  --blur <r>   gaussian blur of radius r (effect)\n"
+		"  --offset <x>,<y> shift glyphs right/down (effect)\n"
+		"  --scale <s>  scale factor or <size>/<master size>, e.g. 24/64 (resample)\n"
+		"  --filter <f> area (default) or lanczos (resample)\n",
+		stderr);
+}
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	std::vector<std::string> args;
+	for (int i = 1; i < argc; i++) {
+		std::string a = argv[i];
+		if      (a == "-j" && i + 1 < argc) opt.threads = atoi(argv[++i]);
+		else if (a == "-o" && i + 1 < argc) opt.outdir  = argv[++i];
+		else if (a == "--cache" && i + 1 < argc) opt.cachedir = argv[++i];
+		else if (a == "--levels" && i + 1 < argc) opt.levels = atoi(argv[++i]);
+		else if (a == "--dedup") opt.dedup = true;
+		else if (a == "--packed") opt.packed = true;
+		else if (a == "--link")  opt.link  = true;
+		else if (a == "--hang")  opt.hang  = true;
+		else if (a == "--outline" && i + 1 < argc) opt.effect.outline = atoi(argv[++i]);
+		else if (a == "--blur" && i + 1 < argc)    opt.effect.blur    = atoi(argv[++i]);
+		else if (a == "--offset" && i + 1 < argc) {
+			const char *p = argv[++i];
+			opt.effect.offsetX = atoi(p);
+			p = strchr(p, ',');
+			opt.effect.offsetY = p ? atoi(p + 1) : 0;
+		}
+		else if (a == "--scale" && i + 1 < argc) {
+			const char *p = argv[++i];
+			opt.scale = atof(p);
+			p = strchr(p, '/');
+			if (p) opt.scale = atof(p + 1) > 0 ? opt.scale / atof(p + 1) : 0;
+		}
+		else if (a == "--filter" && i + 1 < argc) {
+			std::string f = argv[++i];
+			if      (f == "area")    opt.filter = PFontResampleArea;
+			else if (f == "lanczos") opt.filter = PFontResampleLanczos;
+			else { usage(); return 2; }
+		}
+		else if (a == "-h" || a == "--help") { usage(); return 0; }
+		else args.push_back(a);
+	}
+	if (args.size() < 2) {
+		usage();
+		return 2;
+	}
+	const std::string command = args[0];
+	args.erase(args.begin());
+	if (!opt.outdir.empty()) makeDirectory(opt.outdir);
+
+	try {
+		if (command == "info")        return runFiles(cmdInfo,       args, opt, true);
+		if (command == "check")       return runFiles(cmdCheck,      args, opt, true);
+		if (command == "list")        return runFiles(cmdList,       args, opt, true);
+		if (command == "extract-all") return runFiles(cmdExtractAll, args, opt, true);
+		if (command == "repack")      return runFiles(cmdRepack,     args, opt, true);
+		if (command == "bench")       return runFiles(cmdBench,      args, opt, false);
+		if (command == "effect")      return runFiles(cmdEffect,     args, opt, true);
+		if (command == "resample")    return runFiles(cmdResample,   args, opt, true);
+		if (command == "dump-glyph")  return cmdDumpGlyph(args);
+		if (command == "render")      return cmdRender(args);
+		if (command == "diff")        return cmdDiff(args, opt);
+		if (command == "layout")      return cmdLayout(args, opt);
+		if (command == "flatten")     return cmdFlatten(args);
+		if (command == "make-patch")  return cmdMakePatch(args, opt);
+		if (command == "build")       return cmdBuild(args, opt);
+	} catch (std::exception &e) {
+		fprintf(stderr, "error: %s\n", e.what());
+		return 1;
+	}
+	usage();
+	return 2;
+}